@@ -0,0 +1,593 @@
+/*
+ * font2pbm
+ * Files inside Commodore disk, tape and cartridge images.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+/* The directory and the BAM are on the middle track */
+#define DIRTRACK 18
+
+/* Tape images: a header, then a directory of 32 byte entries */
+#define T64MAGIC "C64"
+#define T64HEADER 64
+#define T64ENTRY 32
+
+/* Cartridges: a header, then a packet for each chip */
+#define CRTMAGIC "C64 CARTRIDGE   "
+#define CRTHEADER 64
+#define CHIPHEADER 16
+
+/* Extensions of image file names */
+static const char *const extensions[] = { ".d64", ".t64", ".crt" };
+
+/* Image sizes, without and with one error byte per sector */
+static const struct
+{
+    size_t length;
+    int tracks;
+} d64sizes[] =
+{
+    { 174848, 35 }, { 175531, 35 },
+    { 196608, 40 }, { 197376, 40 },
+    { 205312, 42 }, { 206114, 42 }
+};
+
+static int nextdisk(const struct archive *, struct archivefile *);
+static int nexttape(const struct archive *, struct archivefile *);
+static int nextcartridge(const struct archive *, struct archivefile *);
+static int tapeentries(const struct archive *);
+static int listtape(struct archive *);
+static size_t tapelimit(const struct archive *, size_t);
+static int compareoffsets(const void *, const void *);
+static void copyname(char *, const unsigned char *, int);
+static unsigned long getle(const unsigned char *, int);
+static unsigned long getbe(const unsigned char *, int);
+static int sectorspertrack(int);
+static int totalsectors(const struct archive *);
+static const unsigned char *getsector(const struct archive *, int, int);
+static long readchain(const struct archive *, int, int, char *);
+static int namematches(const char *, const char *);
+
+int openarchive(struct archive *archive, const char *filename)
+{
+    struct stat st;
+    void *map;
+    size_t i;
+    int fd, saved;
+
+    archive->data = NULL;
+    archive->length = 0;
+    archive->format = ARCHIVE_DISK;
+    archive->tracks = 0;
+    archive->map = NULL;
+    archive->maplength = 0;
+    archive->tapeoffsets = NULL;
+    archive->numtapeoffsets = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0)
+    {
+        saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size < T64HEADER)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    saved = errno;
+    close(fd);
+    if (MAP_FAILED == map)
+    {
+        errno = saved;
+        return -1;
+    }
+    archive->map = map;
+    archive->maplength = st.st_size;
+    archive->data = map;
+    archive->length = st.st_size;
+
+    /* Tapes and cartridges say what they are, disks only have a size */
+    if (0 == memcmp(map, CRTMAGIC, strlen(CRTMAGIC)))
+    {
+        archive->format = ARCHIVE_CARTRIDGE;
+        return 0;
+    }
+    for (i = 0; i < sizeof d64sizes / sizeof d64sizes[0]; ++ i)
+    {
+        if ((size_t) st.st_size == d64sizes[i].length)
+        {
+            archive->tracks = d64sizes[i].tracks;
+            return 0;
+        }
+    }
+    if (0 == memcmp(map, T64MAGIC, strlen(T64MAGIC)))
+    {
+        archive->format = ARCHIVE_TAPE;
+        if (listtape(archive) != 0)
+        {
+            closearchive(archive);
+            errno = ENOMEM;
+            return -1;
+        }
+        return 0;
+    }
+    closearchive(archive);
+    errno = EINVAL;
+    return -1;
+}
+
+void closearchive(struct archive *archive)
+{
+    if (archive->map)
+    {
+        munmap(archive->map, archive->maplength);
+    }
+    free(archive->tapeoffsets);
+    archive->tapeoffsets = NULL;
+    archive->numtapeoffsets = 0;
+    archive->map = NULL;
+    archive->data = NULL;
+    archive->length = 0;
+}
+
+void rewindarchive(struct archivefile *file)
+{
+    file->slot = -1;
+    file->dirtrack = 0;
+}
+
+int nextarchivefile(const struct archive *archive, struct archivefile *file)
+{
+    switch (archive->format)
+    {
+        case ARCHIVE_TAPE:
+            return nexttape(archive, file);
+        case ARCHIVE_CARTRIDGE:
+            return nextcartridge(archive, file);
+        default:
+            return nextdisk(archive, file);
+    }
+}
+
+int findarchivefile(const struct archive *archive, const char *name,
+                    struct archivefile *file)
+{
+    rewindarchive(file);
+    while (nextarchivefile(archive, file) > 0)
+    {
+        if (namematches(name, file->name)) return 0;
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+int readarchivefile(const struct archive *archive,
+                    const struct archivefile *file, char *buffer)
+{
+    const char *data;
+    unsigned loadaddress;
+
+    if (file->broken)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    data = archivefiledata(archive, file, &loadaddress);
+    if (data)
+    {
+        buffer[0] = loadaddress & 255;
+        buffer[1] = loadaddress >> 8;
+        memcpy(buffer + 2, data, file->length - 2);
+        return 0;
+    }
+    if (readchain(archive, file->track, file->sector, buffer) < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+const char *archivefiledata(const struct archive *archive,
+                            const struct archivefile *file,
+                            unsigned *loadaddress)
+{
+    if (ARCHIVE_DISK == archive->format || file->broken) return NULL;
+    *loadaddress = file->loadaddress;
+    return (const char *) archive->data + file->offset;
+}
+
+int isarchive(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+    size_t i;
+
+    for (i = 0; dot && i < sizeof extensions / sizeof extensions[0]; ++ i)
+    {
+        if (0 == strcasecmp(dot, extensions[i])) return 1;
+    }
+    return 0;
+}
+
+size_t archivepath(const char *name)
+{
+    const char *colon;
+    size_t i;
+
+    for (colon = strchr(name, ':'); colon; colon = strchr(colon + 1, ':'))
+    {
+        for (i = 0; i < sizeof extensions / sizeof extensions[0]; ++ i)
+        {
+            if (colon - name > 4 &&
+                0 == strncasecmp(colon - 4, extensions[i], 4))
+            {
+                return colon - name;
+            }
+        }
+    }
+    return 0;
+}
+
+/* The directory of a disk runs through a sector chain on track 18 */
+static int nextdisk(const struct archive *archive, struct archivefile *file)
+{
+    const unsigned char *dir, *entry;
+    long length;
+
+    for (;;)
+    {
+        if (file->slot < 0)
+        {
+            /* The BAM sector links to the first directory sector */
+            dir = getsector(archive, DIRTRACK, 0);
+            file->dirtrack = dir[0];
+            file->dirsector = dir[1];
+            file->slot = 0;
+            file->sectors = 0;
+        }
+        else if (!file->dirtrack)
+        {
+            return 0;
+        }
+        else if (8 == ++ file->slot)
+        {
+            /* Eight entries to a sector, then on to the next one */
+            dir = getsector(archive, file->dirtrack, file->dirsector);
+            file->dirtrack = dir[0];
+            file->dirsector = dir[1];
+            file->slot = 0;
+        }
+        if (!file->dirtrack) return 0;
+
+        /* A chain longer than the disk goes round in circles */
+        dir = getsector(archive, file->dirtrack, file->dirsector);
+        if (!dir ||
+            (0 == file->slot && ++ file->sectors > totalsectors(archive)))
+        {
+            return -1;
+        }
+
+        /* Empty slots, scratched files and files never closed are skipped */
+        entry = dir + 32 * file->slot;
+        if (!(entry[2] & 0x80)) continue;
+
+        file->type = entry[2] & 7;
+        file->track = entry[3];
+        file->sector = entry[4];
+        copyname(file->name, entry + 5, 16);
+
+        length = readchain(archive, file->track, file->sector, NULL);
+        file->broken = length < 0;
+        file->length = length < 0 ? 0 : length;
+        return 1;
+    }
+}
+
+/*
+ * The directory of a tape follows its header. Only ordinary files are
+ * listed, not free entries or memory snapshots. The end address is often
+ * wrong, so a file is cut off where the next one starts.
+ */
+static int nexttape(const struct archive *archive, struct archivefile *file)
+{
+    int entries = tapeentries(archive);
+
+    while (++ file->slot < entries)
+    {
+        const unsigned char *entry =
+            archive->data + T64HEADER + T64ENTRY * file->slot;
+        size_t start, end, length, limit;
+        int i;
+
+        if (entry[0] != 1) continue;
+
+        /* Writers disagree on the type, tapes hold programs */
+        file->type = 0x81 == entry[1] ? ARCHIVE_SEQ : ARCHIVE_PRG;
+        copyname(file->name, entry + 16, 16);
+        for (i = strlen(file->name); i > 0 && ' ' == file->name[i - 1]; -- i)
+        {
+            file->name[i - 1] = 0;
+        }
+
+        start = getle(entry + 2, 2);
+        end = getle(entry + 4, 2);
+        file->offset = getle(entry + 8, 4);
+        file->loadaddress = start;
+        file->broken = file->offset >= archive->length;
+        if (file->broken)
+        {
+            file->length = 0;
+            return 1;
+        }
+        limit = tapelimit(archive, file->offset) - file->offset;
+        length = end > start ? end - start : limit;
+        file->length = (length < limit ? length : limit) + 2;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Each chip in a cartridge is a packet: a header with the bank and the
+ * address it appears at, then the ROM contents. RAM chips have none.
+ */
+static int nextcartridge(const struct archive *archive,
+                         struct archivefile *file)
+{
+    for (;;)
+    {
+        const unsigned char *chip;
+        size_t packet, size;
+
+        if (file->slot < 0)
+        {
+            file->next = getbe(archive->data + 16, 4);
+            if (file->next < CRTHEADER) file->next = CRTHEADER;
+            file->slot = 0;
+        }
+        if (file->next >= archive->length ||
+            archive->length - file->next < CHIPHEADER)
+        {
+            return 0;
+        }
+        chip = archive->data + file->next;
+        packet = getbe(chip + 4, 4);
+        if (memcmp(chip, "CHIP", 4) != 0 || packet < CHIPHEADER) return -1;
+
+        file->offset = file->next + CHIPHEADER;
+        file->next = packet < archive->length - file->next
+                     ? file->next + packet : archive->length;
+        ++ file->slot;
+        if (1 == getbe(chip + 8, 2)) continue;
+
+        file->type = ARCHIVE_ROM;
+        file->loadaddress = getbe(chip + 12, 2);
+        sprintf(file->name, "BANK%lu-%04X", getbe(chip + 10, 2),
+                file->loadaddress);
+        size = getbe(chip + 14, 2);
+        file->broken = size > archive->length - file->offset;
+        file->length = file->broken ? 0 : size + 2;
+        return 1;
+    }
+}
+
+/* Entries in a tape directory, as many as fit if the header says more */
+static int tapeentries(const struct archive *archive)
+{
+    size_t entries = getle(archive->data + 34, 2);
+    size_t room = (archive->length - T64HEADER) / T64ENTRY;
+
+    return entries < room ? entries : room;
+}
+
+/*
+ * Sort the offsets of the files on a tape, so that tapelimit() finds
+ * where the one after any of them starts without going through the whole
+ * directory. Returns 0, or -1 if out of memory.
+ */
+static int listtape(struct archive *archive)
+{
+    int i, entries = tapeentries(archive), count = 0;
+    size_t *offsets = malloc((entries ? entries : 1) * sizeof (size_t));
+
+    if (!offsets) return -1;
+    for (i = 0; i < entries; ++ i)
+    {
+        const unsigned char *entry =
+            archive->data + T64HEADER + T64ENTRY * i;
+
+        if (entry[0]) offsets[count ++] = getle(entry + 8, 4);
+    }
+    qsort(offsets, count, sizeof (size_t), compareoffsets);
+    archive->tapeoffsets = offsets;
+    archive->numtapeoffsets = count;
+    return 0;
+}
+
+/* Where the next file on a tape starts, or the end of the image */
+static size_t tapelimit(const struct archive *archive, size_t offset)
+{
+    const size_t *offsets = archive->tapeoffsets;
+    int low = 0, high = archive->numtapeoffsets;
+
+    /* The first offset past this one */
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (offsets[middle] > offset)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    if (low < archive->numtapeoffsets && offsets[low] < archive->length)
+    {
+        return offsets[low];
+    }
+    return archive->length;
+}
+
+static int compareoffsets(const void *a, const void *b)
+{
+    size_t first = *(const size_t *) a, second = *(const size_t *) b;
+
+    return first < second ? -1 : first > second;
+}
+
+/*
+ * Convert a file name from PETSCII, up to the shifted space that pads it.
+ * Shifted letters are the same letters to the user.
+ */
+static void copyname(char *name, const unsigned char *petscii, int length)
+{
+    int i;
+
+    for (i = 0; i < length && petscii[i] != 0xa0; ++ i)
+    {
+        int c = petscii[i];
+
+        if (c >= 0xc1 && c <= 0xda) c -= 0x80;
+        name[i] = c >= 0x20 && c <= 0x5a ? c : '?';
+    }
+    name[i] = 0;
+}
+
+/* Numbers in tape images are little endian, in cartridges big endian */
+static unsigned long getle(const unsigned char *data, int bytes)
+{
+    unsigned long value = 0;
+
+    while (bytes --)
+    {
+        value = (value << 8) | data[bytes];
+    }
+    return value;
+}
+
+static unsigned long getbe(const unsigned char *data, int bytes)
+{
+    unsigned long value = 0;
+    int i;
+
+    for (i = 0; i < bytes; ++ i)
+    {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+/* Tracks get shorter towards the middle of the disk */
+static int sectorspertrack(int track)
+{
+    return track <= 17 ? 21 : track <= 24 ? 19 : track <= 30 ? 18 : 17;
+}
+
+static int totalsectors(const struct archive *archive)
+{
+    int track, total = 0;
+
+    for (track = 1; track <= archive->tracks; ++ track)
+    {
+        total += sectorspertrack(track);
+    }
+    return total;
+}
+
+/* The 256 bytes of a sector, or NULL if there is no such sector */
+static const unsigned char *getsector(const struct archive *archive,
+                                      int track, int sector)
+{
+    size_t offset = 0;
+    int t;
+
+    if (track < 1 || track > archive->tracks ||
+        sector < 0 || sector >= sectorspertrack(track))
+    {
+        return NULL;
+    }
+    for (t = 1; t < track; ++ t)
+    {
+        offset += sectorspertrack(t);
+    }
+    return archive->data + (offset + sector) * 256;
+}
+
+/*
+ * Follow a file's sector chain, copying the data into buffer unless it
+ * is NULL. Every sector links to the next; the last one has track 0 and
+ * the position of its last byte instead. Returns the length of the file,
+ * or -1 if the chain is broken.
+ */
+static long readchain(const struct archive *archive, int track, int sector,
+                      char *buffer)
+{
+    int limit = totalsectors(archive);
+    long length = 0;
+
+    for (;;)
+    {
+        const unsigned char *data = getsector(archive, track, sector);
+        int used;
+
+        if (!data || limit -- == 0) return -1;
+        used = data[0] ? 254 : data[1] > 1 ? data[1] - 1 : 0;
+        if (buffer) memcpy(buffer + length, data + 2, used);
+        length += used;
+        if (!data[0]) return length;
+        track = data[0];
+        sector = data[1];
+    }
+}
+
+/* A name against a pattern with the disk drive's wildcards */
+static int namematches(const char *pattern, const char *name)
+{
+    for (; *pattern; ++ pattern, ++ name)
+    {
+        if ('*' == *pattern) return 1;
+        if (!*name ||
+            ('?' != *pattern &&
+             toupper((unsigned char) *pattern) !=
+             toupper((unsigned char) *name)))
+        {
+            return 0;
+        }
+    }
+    return !*name;
+}
@@ -0,0 +1,137 @@
+/*
+ * font2pbm
+ * Files inside Commodore disk, tape and cartridge images.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+
+/* Kinds of image, told apart by their contents */
+enum archiveformat
+{
+    ARCHIVE_DISK,               /* D64 */
+    ARCHIVE_TAPE,               /* T64 */
+    ARCHIVE_CARTRIDGE           /* CRT */
+};
+
+/*
+ * An image opened for reading: a D64 as written by the 1541 and by VICE,
+ * with 35, 40 or 42 tracks and optionally the error bytes at the end, a
+ * T64 tape archive, or a CRT cartridge dump whose ROM chips are listed as
+ * files. The image is mapped and nothing is extracted to disk. Files on
+ * tape and ROM chips are stored in one piece and can be used in place;
+ * files on disk are read by following their sector chains.
+ */
+struct archive
+{
+    const unsigned char *data;
+    size_t length;
+    enum archiveformat format;
+    int tracks;                 /* Of a disk image */
+
+    /* Private */
+    void *map;
+    size_t maplength;
+    size_t *tapeoffsets;        /* Where the files on a tape start, sorted */
+    int numtapeoffsets;
+};
+
+/* File types in the directory */
+#define ARCHIVE_DEL 0
+#define ARCHIVE_SEQ 1
+#define ARCHIVE_PRG 2
+#define ARCHIVE_USR 3
+#define ARCHIVE_REL 4
+#define ARCHIVE_ROM 5           /* A chip in a cartridge */
+
+/*
+ * A directory entry. The name is converted from PETSCII, letters and
+ * digits as themselves and anything without an ASCII equivalent as '?'.
+ * Cartridge chips are named after their bank and address, "BANK0-8000".
+ */
+struct archivefile
+{
+    char name[17];
+    int type;                   /* ARCHIVE_PRG and so on */
+    size_t length;              /* Bytes, load address included */
+    int broken;                 /* The data is not all in the image */
+
+    /* Private */
+    int track, sector;          /* First data sector */
+    int dirtrack, dirsector;    /* Directory sector being listed */
+    int slot, sectors;          /* Entry in it, sectors listed so far */
+    size_t offset;              /* Data stored in one piece */
+    unsigned loadaddress;       /* Kept apart from it */
+    size_t next;                /* Next chip in a cartridge */
+};
+
+/*
+ * Open an image. Returns 0, or -1 with errno set; files that are neither
+ * a tape or cartridge image nor the size of any D64 fail with EINVAL.
+ */
+int openarchive(struct archive *, const char *filename);
+
+/* Release an opened image */
+void closearchive(struct archive *);
+
+/*
+ * List the directory: after rewindarchive(), each call of
+ * nextarchivefile() fills in the next closed file. Returns 1 for a file,
+ * 0 at the end, or -1 if the directory is damaged.
+ */
+void rewindarchive(struct archivefile *);
+int nextarchivefile(const struct archive *, struct archivefile *);
+
+/*
+ * Find the first file matching a name, ignoring case, with '?' matching
+ * any character and '*' the rest of the name, as the disk drive does.
+ * Returns 0, or -1 with errno set to ENOENT.
+ */
+int findarchivefile(const struct archive *, const char *name,
+                    struct archivefile *);
+
+/*
+ * Copy a file, load address included, into a buffer of at least its
+ * length. Returns 0, or -1 with errno set to EINVAL if it is broken.
+ */
+int readarchivefile(const struct archive *, const struct archivefile *,
+                    char *buffer);
+
+/*
+ * The contents of a file stored in one piece, after the load address,
+ * which is stored in *loadaddress. The data is valid as long as the image
+ * stays open. Returns NULL for files that have to be read with
+ * readarchivefile().
+ */
+const char *archivefiledata(const struct archive *,
+                            const struct archivefile *,
+                            unsigned *loadaddress);
+
+/* Whether a file name is that of an image, from its extension */
+int isarchive(const char *filename);
+
+/*
+ * A file inside an image is named as the image followed by a colon and
+ * the name of the file, "fonts.d64:BIGFONT" or "game.crt:BANK1-A000".
+ * Returns the length of the image part of such a name, or 0 if it is not
+ * one.
+ */
+size_t archivepath(const char *name);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * font2pbm
+ * Bump allocator for per-worker conversion buffers.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Alignment of all allocations; enough for SIMD loads and stores */
+#define ALIGN 32
+#define ROUNDUP(n) (((n) + ALIGN - 1) & ~(size_t) (ALIGN - 1))
+
+struct arenablock
+{
+    struct arenablock *next;    /* Older blocks, freed on reset */
+    char *data;
+    size_t size, used;
+    size_t last;                /* Offset of the latest allocation */
+};
+
+static struct arenablock *newblock(size_t size)
+{
+    struct arenablock *block = malloc(sizeof *block);
+
+    if (!block) return NULL;
+    if (posix_memalign((void **) &block->data, ALIGN, size ? size : ALIGN))
+    {
+        free(block);
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+    return block;
+}
+
+static void freeblocks(struct arenablock *block)
+{
+    while (block)
+    {
+        struct arenablock *next = block->next;
+        free(block->data);
+        free(block);
+        block = next;
+    }
+}
+
+int initarena(struct arena *arena, size_t size)
+{
+    arena->used = 0;
+    arena->highwater = 0;
+    arena->overflows = 0;
+    arena->block = newblock(ROUNDUP(size));
+    return arena->block ? 0 : -1;
+}
+
+void *arenaalloc(struct arena *arena, size_t bytes)
+{
+    struct arenablock *block = arena->block;
+    size_t rounded = ROUNDUP(bytes);
+
+    if (block->size - block->used < rounded)
+    {
+        /* Chain an overflow block big enough for this and then some */
+        size_t size = block->size * 2 > rounded ? block->size * 2 : rounded;
+        struct arenablock *overflow = newblock(size);
+
+        if (!overflow) return NULL;
+        overflow->next = block;
+        arena->block = block = overflow;
+        ++ arena->overflows;
+    }
+
+    block->last = block->used;
+    block->used += rounded;
+    arena->used += rounded;
+    if (arena->used > arena->highwater)
+    {
+        arena->highwater = arena->used;
+    }
+    return block->data + block->last;
+}
+
+void *arenagrow(struct arena *arena, void *ptr, size_t oldsize,
+                size_t newsize)
+{
+    struct arenablock *block = arena->block;
+    void *grown;
+
+    if (!ptr) return arenaalloc(arena, newsize);
+
+    /* In place if this is the latest allocation and it fits */
+    if ((char *) ptr == block->data + block->last &&
+        block->size - block->last >= ROUNDUP(newsize))
+    {
+        size_t current = block->used - block->last, extra;
+
+        if (ROUNDUP(newsize) <= current) return ptr;
+        extra = ROUNDUP(newsize) - current;
+        block->used += extra;
+        arena->used += extra;
+        if (arena->used > arena->highwater)
+        {
+            arena->highwater = arena->used;
+        }
+        return ptr;
+    }
+
+    grown = arenaalloc(arena, newsize);
+    if (grown)
+    {
+        memcpy(grown, ptr, oldsize < newsize ? oldsize : newsize);
+    }
+    return grown;
+}
+
+void resetarena(struct arena *arena)
+{
+    struct arenablock *block = arena->block;
+
+    /* Coalesce overflows into one block covering the high-water mark */
+    if (block->next)
+    {
+        struct arenablock *bigger = newblock(ROUNDUP(arena->highwater));
+
+        if (bigger)
+        {
+            freeblocks(block);
+            arena->block = block = bigger;
+        }
+        else
+        {
+            freeblocks(block->next);
+            block->next = NULL;
+        }
+    }
+
+    block->used = 0;
+    block->last = 0;
+    arena->used = 0;
+}
+
+void freearena(struct arena *arena)
+{
+    freeblocks(arena->block);
+    arena->block = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ * font2pbm
+ * Bump allocator for per-worker conversion buffers.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * An arena hands out buffers by bumping a pointer and releases them all
+ * at once with resetarena(). It is meant to be owned by one worker and
+ * reset between fonts, so steady-state conversion never touches the
+ * shared allocator. If a font needs more than the arena holds, the
+ * overflow comes from malloc and the arena is grown to the high-water
+ * mark on the next reset.
+ */
+struct arena
+{
+    struct arenablock *block;
+    size_t used;
+    size_t highwater;
+    unsigned long overflows;
+};
+
+/* Set up an arena with an initial size. Returns 0, or -1 if out of memory */
+int initarena(struct arena *, size_t size);
+
+/* Allocate from the arena, aligned for any type. NULL if out of memory */
+void *arenaalloc(struct arena *, size_t bytes);
+
+/*
+ * Grow an allocation. If it is the latest one and there is room it grows
+ * in place, otherwise it is copied. NULL if out of memory.
+ */
+void *arenagrow(struct arena *, void *ptr, size_t oldsize, size_t newsize);
+
+/* Release everything allocated since the last reset */
+void resetarena(struct arena *);
+
+/* Release the arena itself */
+void freearena(struct arena *);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * benchblit
+ * Micro-benchmark of the font2pbm glyph blit kernels and band converters.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "convert.h"
+
+#define CHARS 256
+#define ROUNDS 20000
+
+/* The conversion loop as it was before the blit kernels, for reference */
+static void legacyband(int x, int y, const char *data, int numchars, int row,
+                       char *band)
+{
+    int charsperline = 32 / x, column;
+
+    for (column = 0; column < charsperline; ++ column)
+    {
+        int i = row * charsperline + column, xchar, ychar, line;
+
+        for (xchar = 0; xchar < x; ++ xchar)
+        {
+            for (ychar = 0; ychar < y; ++ ychar)
+            {
+                int fontofs = (i + xchar * numchars + ychar * numchars * x) * 8;
+                int bandofs = 8 * ychar * 256 / 8 + column * x + xchar;
+
+                for (line = 0; line < 8; ++ line)
+                {
+                    band[bandofs + line * 256 / 8] = data[fontofs + line];
+                }
+            }
+        }
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Convert the whole font ROUNDS times, returning the seconds taken. With
+ * a band converter, use that, otherwise the generic blitband() if given
+ * a kernel, otherwise the legacy loop.
+ */
+static double run(bandfunc convert, blitfunc blit, int x, int y,
+                  const char *data, char *image)
+{
+    int rows = pbmheight(x, y, CHARS) / (8 * y), round, row;
+    double start = now();
+
+    for (round = 0; round < ROUNDS; ++ round)
+    {
+        for (row = 0; row < rows; ++ row)
+        {
+            char *band = image + row * 8 * y * 256 / 8;
+
+            if (convert)
+            {
+                convert(blit, data, CHARS, row, band);
+            }
+            else if (blit)
+            {
+                blitband(blit, x, y, data, CHARS, row, band);
+            }
+            else
+            {
+                legacyband(x, y, data, CHARS, row, band);
+            }
+        }
+        /* Keep the compiler from hoisting the work out of the loop */
+        __asm__ __volatile__("" : : "r" (image) : "memory");
+    }
+    return now() - start;
+}
+
+static void report(const char *mode, const char *kernel, double seconds,
+                   double legacy, int bytes)
+{
+    printf("%s\t%-16s\t%8.2f ns/glyph\t%8.1f MB/s\t%5.2fx\n",
+           mode, kernel, seconds * 1e9 / ((double) ROUNDS * CHARS),
+           (double) bytes * ROUNDS / seconds / 1e6, legacy / seconds);
+}
+
+int main(void)
+{
+    static const int modes[4][2] = { { 1, 1 }, { 1, 2 }, { 2, 1 }, { 2, 2 } };
+    char data[CHARS * 4 * 8], *expect, *image;
+    unsigned long seed = 1;
+    int m, i;
+
+    for (i = 0; i < (int) sizeof data; ++ i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (char) (seed >> 16);
+    }
+
+    expect = malloc(sizeof data);
+    image = malloc(sizeof data);
+    if (!expect || !image) return 1;
+
+    printf("mode\t%-16s\t    time/glyph\t    throughput\tspeedup\n", "converter");
+    for (m = 0; m < 4; ++ m)
+    {
+        int x = modes[m][0], y = modes[m][1];
+        int bytes = 256 / 8 * pbmheight(x, y, CHARS);
+        const struct blitkernel *kernel;
+        char mode[8];
+        double legacy;
+
+        snprintf(mode, sizeof mode, "%dx%d", x, y);
+        legacy = run(NULL, NULL, x, y, data, expect);
+        report(mode, "legacy", legacy, legacy, bytes);
+
+        /* Each kernel, first with generic then specialised band setup */
+        for (kernel = blitkernels; kernel->name; ++ kernel)
+        {
+            int special;
+
+            if (!kernel->supported()) continue;
+            for (special = 0; special < 2; ++ special)
+            {
+                char name[32];
+                double seconds;
+
+                memset(image, 0, sizeof data);
+                seconds = run(special ? getbandfunc(x, y, 8, 8) : NULL,
+                              kernel->blit, x, y, data, image);
+                snprintf(name, sizeof name, "%s/%s",
+                         special ? "special" : "generic", kernel->name);
+                if (memcmp(image, expect, bytes) != 0)
+                {
+                    printf("%s\t%s\tOUTPUT DIFFERS\n", mode, name);
+                    return 1;
+                }
+                report(mode, name, seconds, legacy, bytes);
+            }
+        }
+    }
+
+    free(expect);
+    free(image);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * benchsuite
+ * Benchmark suite for font2pbm: read, convert and write stages,
+ * end-to-end conversion on a synthetic corpus, and the system calls
+ * made writing a streamed PBM.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "font2pbm.h"
+#include "convert.h"
+#include "input.h"
+
+/*
+ * Every size mode with the usual character counts, plus large sets as
+ * produced by concatenating many fonts.
+ */
+static const int modes[4][2] = { { 1, 1 }, { 1, 2 }, { 2, 1 }, { 2, 2 } };
+static const int counts[] = { 64, 128, 192, 256, 2048, 8192 };
+#define NUMCOUNTS (int) (sizeof counts / sizeof counts[0])
+
+/*
+ * The stdio stage streams a PBM to /dev/null the way font2pbm used to,
+ * the header with fprintf() and each band with fwrite(); the stream
+ * stage does the same through an output buffer.
+ */
+enum stage { READ, CONVERT, WRITE, ENDTOEND, STDIO, STREAM };
+static const char *const stagenames[] =
+{
+    "read", "convert", "write", "end-to-end", "stdio", "stream"
+};
+
+/* Everything a stage needs for one font */
+struct font
+{
+    int x, y, chars;
+    char path[4096], outpath[4096];
+    char *file;             /* Font file contents, load address first */
+    size_t filesize;
+    char *image;            /* Complete PBM */
+    size_t imagesize;
+    int outfd;
+    int nullfd;             /* /dev/null */
+    FILE *null;             /* Counting stream on nullfd */
+};
+
+static double mintime = 0.2;
+static volatile unsigned sink;
+
+/* System calls made by the streaming stages */
+static unsigned long syscalls;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Deterministic font data, the same generator as mkcorpus */
+static void generate(char *file, size_t size, unsigned long seed)
+{
+    size_t i;
+
+    file[0] = 0x00;
+    file[1] = 0x30;
+    for (i = 2; i < size; ++ i)
+    {
+        seed = seed * 1103515245 + 12345;
+        file[i] = (char) (seed >> 16);
+    }
+}
+
+/* Write function for the counting stream */
+static ssize_t countwrite(void *cookie, const char *data, size_t size)
+{
+    ++ syscalls;
+    return write(*(int *) cookie, data, size);
+}
+
+/*
+ * A stream on fd that counts its writes, buffered as glibc buffers
+ * stdout on a pipe or on most file systems.
+ */
+static FILE *countingstream(int *fd)
+{
+    static const cookie_io_functions_t functions =
+    {
+        NULL, countwrite, NULL, NULL
+    };
+    FILE *f = fopencookie(fd, "w", functions);
+
+    if (f) setvbuf(f, NULL, _IOFBF, 4096);
+    return f;
+}
+
+static int writefile(const char *path, const char *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+
+    if (!f) return -1;
+    if (fwrite(data, 1, size, f) != size)
+    {
+        fclose(f);
+        return -1;
+    }
+    return fclose(f);
+}
+
+/* Run one stage once; returns 0 or -1 */
+static int runstage(enum stage stage, struct font *font)
+{
+    struct input input;
+    struct output output;
+    const char *data;
+    char band[2 * 8 * 256 / 8];
+    size_t i;
+    int fd, row, rc;
+
+    switch (stage)
+    {
+        case READ:
+            /* Map, touch every byte, unmap */
+            if (openinput(&input, font->path, NULL) != 0) return -1;
+            for (i = 0; i < input.length; i += 64)
+            {
+                sink += (unsigned char) input.data[i];
+            }
+            closeinput(&input);
+            return 0;
+
+        case CONVERT:
+            data = font->file + 2;
+            return formatpbm(font->x, font->y, data, font->chars,
+                             font->image, font->imagesize) ? 0 : -1;
+
+        case WRITE:
+            return pwrite(font->outfd, font->image, font->imagesize, 0) ==
+                   (ssize_t) font->imagesize ? 0 : -1;
+
+        case ENDTOEND:
+            if (openinput(&input, font->path, NULL) != 0) return -1;
+            if (!formatpbm(font->x, font->y, input.data, font->chars,
+                           font->image, font->imagesize))
+            {
+                closeinput(&input);
+                return -1;
+            }
+            closeinput(&input);
+            fd = open(font->outpath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (fd < 0) return -1;
+            if (write(fd, font->image, font->imagesize) !=
+                (ssize_t) font->imagesize)
+            {
+                close(fd);
+                return -1;
+            }
+            return close(fd);
+
+        case STDIO:
+            data = font->file + 2;
+            printheader(256, pbmheight(font->x, font->y, font->chars),
+                        font->null);
+            for (row = 0; row < font->chars / (32 / font->x); ++ row)
+            {
+                createband(font->x, font->y, data, font->chars, row, band);
+                fwrite(band, 1, 256 / 8 * 8 * font->y, font->null);
+            }
+            return fflush(font->null);
+
+        case STREAM:
+            data = font->file + 2;
+            if (openoutput(&output, font->nullfd, NULL, font->imagesize) != 0)
+            {
+                return -1;
+            }
+            rc = outputheader(&output, 256,
+                              pbmheight(font->x, font->y, font->chars));
+            if (0 == rc)
+            {
+                rc = streambandstimed(font->x, font->y, data, font->chars,
+                                      NULL, &output, NULL);
+            }
+            if (closeoutput(&output) != 0) rc = -1;
+            syscalls += output.syscalls;
+            return rc;
+    }
+    return -1;
+}
+
+/*
+ * Time a stage, repeating it until mintime has passed, and print one
+ * JSON line. Throughput is for the input file for the read stage, and
+ * for the PBM for the others.
+ */
+static int measure(enum stage stage, struct font *font)
+{
+    double start, elapsed;
+    long iterations = 0, batch = 1;
+    size_t bytes = READ == stage ? font->filesize : font->imagesize;
+
+    syscalls = 0;
+    start = now();
+    do
+    {
+        long i;
+
+        for (i = 0; i < batch; ++ i)
+        {
+            if (runstage(stage, font) != 0)
+            {
+                fprintf(stderr, "benchsuite: %s failed for %dx%d %d: %s\n",
+                        stagenames[stage], font->x, font->y, font->chars,
+                        strerror(errno));
+                return -1;
+            }
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = now() - start;
+    }
+    while (elapsed < mintime);
+
+    printf("{\"stage\":\"%s\",\"mode\":\"%dx%d\",\"chars\":%d,"
+           "\"bytes\":%lu,\"iterations\":%ld,\"ns_per_glyph\":%.3f,"
+           "\"mb_per_s\":%.2f",
+           stagenames[stage], font->x, font->y, font->chars,
+           (unsigned long) bytes, iterations,
+           elapsed * 1e9 / ((double) iterations * font->chars),
+           (double) bytes * iterations / elapsed / 1e6);
+    if (stage >= STDIO)
+    {
+        printf(",\"syscalls_per_conversion\":%.2f",
+               (double) syscalls / iterations);
+    }
+    printf("}\n");
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/font2pbm-bench.XXXXXX", outpath[4096];
+    int m, c, rc = 0;
+
+    if (argc > 1 && (sscanf(argv[1], "%lf", &mintime) != 1 || mintime <= 0))
+    {
+        fprintf(stderr, "Usage: %s [seconds per measurement]\n", argv[0]);
+        return 1;
+    }
+
+    if (!mkdtemp(dir))
+    {
+        perror("benchsuite: mkdtemp");
+        return 1;
+    }
+    snprintf(outpath, sizeof outpath, "%s/out.pbm", dir);
+
+    for (m = 0; m < 4 && !rc; ++ m)
+    {
+        for (c = 0; c < NUMCOUNTS && !rc; ++ c)
+        {
+            struct font font;
+            enum stage stage;
+
+            font.x = modes[m][0];
+            font.y = modes[m][1];
+            font.chars = counts[c];
+            font.filesize = 2 + (size_t) font.chars * font.x * font.y * 8;
+            font.imagesize = pbmsize(font.x, font.y, font.chars);
+            font.file = malloc(font.filesize);
+            font.image = malloc(font.imagesize);
+            snprintf(font.path, sizeof font.path, "%s/font%dx%d-%d.prg",
+                     dir, font.x, font.y, font.chars);
+            strcpy(font.outpath, outpath);
+            if (!font.file || !font.image)
+            {
+                fprintf(stderr, "benchsuite: Out of memory\n");
+                return 1;
+            }
+
+            generate(font.file, font.filesize, m * 1000 + c);
+            font.outfd = open(font.outpath, O_WRONLY | O_CREAT | O_TRUNC,
+                              0666);
+            font.nullfd = open("/dev/null", O_WRONLY);
+            font.null = countingstream(&font.nullfd);
+            if (writefile(font.path, font.file, font.filesize) != 0 ||
+                font.outfd < 0 || font.nullfd < 0 || !font.null)
+            {
+                perror("benchsuite: Can't create corpus");
+                rc = 1;
+            }
+
+            for (stage = READ; stage <= STREAM && !rc; ++ stage)
+            {
+                if (measure(stage, &font) != 0) rc = 1;
+            }
+
+            if (font.outfd >= 0) close(font.outfd);
+            if (font.null) fclose(font.null);
+            if (font.nullfd >= 0) close(font.nullfd);
+            unlink(font.path);
+            free(font.file);
+            free(font.image);
+        }
+    }
+
+    unlink(outpath);
+    rmdir(dir);
+    return rc;
+}
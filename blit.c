@@ -0,0 +1,175 @@
+/*
+ * font2pbm
+ * Glyph blit kernels: scalar, SSE2 and AVX2, selected at run time.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "blit.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+static int always(void)
+{
+    return 1;
+}
+
+/* Portable version, one byte at a time */
+static void blitscalar(const char *const *src, char *dst, size_t stride)
+{
+    int line, k;
+
+    for (line = 0; line < 8; ++ line)
+    {
+        for (k = 0; k < 32; ++ k)
+        {
+            dst[k] = src[k][line];
+        }
+        dst += stride;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * Transpose sixteen 8-byte glyphs into eight 16-byte rows using three
+ * rounds of unpacking: bytes of glyph pairs, then 16-bit, 32-bit and
+ * 64-bit groups. The same sequence works for AVX2, where the unpack
+ * instructions operate on each 128-bit lane separately; the low lanes
+ * carry glyphs 0-15 and the high lanes glyphs 16-31.
+ */
+#define TRANSPOSE(T, P, g, r) \
+    do { \
+        T b0 = P##_unpacklo_epi8(g[0], g[1]); \
+        T b1 = P##_unpacklo_epi8(g[2], g[3]); \
+        T b2 = P##_unpacklo_epi8(g[4], g[5]); \
+        T b3 = P##_unpacklo_epi8(g[6], g[7]); \
+        T b4 = P##_unpacklo_epi8(g[8], g[9]); \
+        T b5 = P##_unpacklo_epi8(g[10], g[11]); \
+        T b6 = P##_unpacklo_epi8(g[12], g[13]); \
+        T b7 = P##_unpacklo_epi8(g[14], g[15]); \
+        T c0 = P##_unpacklo_epi16(b0, b1), c1 = P##_unpackhi_epi16(b0, b1); \
+        T c2 = P##_unpacklo_epi16(b2, b3), c3 = P##_unpackhi_epi16(b2, b3); \
+        T c4 = P##_unpacklo_epi16(b4, b5), c5 = P##_unpackhi_epi16(b4, b5); \
+        T c6 = P##_unpacklo_epi16(b6, b7), c7 = P##_unpackhi_epi16(b6, b7); \
+        T d0 = P##_unpacklo_epi32(c0, c2), d1 = P##_unpackhi_epi32(c0, c2); \
+        T d2 = P##_unpacklo_epi32(c1, c3), d3 = P##_unpackhi_epi32(c1, c3); \
+        T e0 = P##_unpacklo_epi32(c4, c6), e1 = P##_unpackhi_epi32(c4, c6); \
+        T e2 = P##_unpacklo_epi32(c5, c7), e3 = P##_unpackhi_epi32(c5, c7); \
+        r[0] = P##_unpacklo_epi64(d0, e0); r[1] = P##_unpackhi_epi64(d0, e0); \
+        r[2] = P##_unpacklo_epi64(d1, e1); r[3] = P##_unpackhi_epi64(d1, e1); \
+        r[4] = P##_unpacklo_epi64(d2, e2); r[5] = P##_unpackhi_epi64(d2, e2); \
+        r[6] = P##_unpacklo_epi64(d3, e3); r[7] = P##_unpackhi_epi64(d3, e3); \
+    } while (0)
+
+static int hassse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void blitsse2(const char *const *src, char *dst, size_t stride)
+{
+    int half, k, line;
+
+    for (half = 0; half < 32; half += 16)
+    {
+        __m128i g[16], r[8];
+
+        for (k = 0; k < 16; ++ k)
+        {
+            g[k] = _mm_loadl_epi64((const __m128i *) src[half + k]);
+        }
+        TRANSPOSE(__m128i, _mm, g, r);
+        for (line = 0; line < 8; ++ line)
+        {
+            _mm_storeu_si128((__m128i *) (dst + line * stride + half),
+                             r[line]);
+        }
+    }
+}
+
+static int hasavx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void blitavx2(const char *const *src, char *dst, size_t stride)
+{
+    __m256i g[16], r[8];
+    int k, line;
+
+    for (k = 0; k < 16; ++ k)
+    {
+        __m128i lo = _mm_loadl_epi64((const __m128i *) src[k]);
+        __m128i hi = _mm_loadl_epi64((const __m128i *) src[k + 16]);
+        g[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    }
+    TRANSPOSE(__m256i, _mm256, g, r);
+    for (line = 0; line < 8; ++ line)
+    {
+        _mm256_storeu_si256((__m256i *) (dst + line * stride), r[line]);
+    }
+}
+#endif
+
+const struct blitkernel blitkernels[] =
+{
+#ifdef HAVE_X86_KERNELS
+    { "avx2", blitavx2, hasavx2 },
+    { "sse2", blitsse2, hassse2 },
+#endif
+    { "scalar", blitscalar, always },
+    { NULL, NULL, NULL }
+};
+
+static blitfunc selected;
+static pthread_once_t selectonce = PTHREAD_ONCE_INIT;
+
+static void selectblit(void)
+{
+    const char *want = getenv("FONT2PBM_BLIT");
+    const struct blitkernel *kernel;
+
+    /* Requested kernel, if any, otherwise the first supported one */
+    for (kernel = blitkernels; want && kernel->name; ++ kernel)
+    {
+        if (strcmp(want, kernel->name) == 0 && kernel->supported())
+        {
+            selected = kernel->blit;
+            return;
+        }
+    }
+    for (kernel = blitkernels; kernel->name; ++ kernel)
+    {
+        if (kernel->supported())
+        {
+            selected = kernel->blit;
+            return;
+        }
+    }
+}
+
+blitfunc getblit(void)
+{
+    pthread_once(&selectonce, selectblit);
+    return selected;
+}
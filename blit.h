@@ -0,0 +1,48 @@
+/*
+ * font2pbm
+ * Glyph blit kernels: scalar, SSE2 and AVX2, selected at run time.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <stddef.h>
+
+/*
+ * A blit kernel gathers scanline N of 32 glyphs and stores it as output
+ * row N: dst[line * stride + k] = src[k][line] for line 0..7 and k 0..31.
+ * Each src[k] points to the eight bytes of one 8x8 glyph cell.
+ */
+typedef void (*blitfunc)(const char *const *src, char *dst, size_t stride);
+
+struct blitkernel
+{
+    const char *name;
+    blitfunc blit;
+    int (*supported)(void);
+};
+
+/* All kernels built into this binary, best first, ending with NULL name */
+extern const struct blitkernel blitkernels[];
+
+/*
+ * The best kernel supported by this CPU. The FONT2PBM_BLIT environment
+ * variable can name a kernel to use instead, if it is supported.
+ */
+blitfunc getblit(void);
+
+#endif
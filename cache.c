@@ -0,0 +1,559 @@
+/*
+ * font2pbm
+ * Content-addressed cache of converted fonts.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "font2pbm.h"
+#include "cache.h"
+
+/* Temporary files older than this are left over from a crash */
+#define STALETEMP 3600
+
+/* Eviction trims the cache to this fraction of its limit, in percent */
+#define LOWWATER 75
+
+/* A SHA-256 digest being worked out */
+struct sha256
+{
+    uint32_t state[8];
+    unsigned char block[64];
+    size_t used;                /* Bytes in block */
+    unsigned long long length;  /* Bytes so far */
+};
+
+/* One file in the cache directory, for eviction */
+struct entry
+{
+    char *name;
+    struct timespec atime;
+    unsigned long long size;
+};
+
+static int evict(struct cache *, unsigned long long);
+static int compareentries(const void *, const void *);
+static void imagekey(char [CACHEKEYLENGTH + 1], enum format, int, int,
+                     const char *, int, const struct layout *);
+static char *entrypath(const struct cache *, const char *);
+static void sha256init(struct sha256 *);
+static void sha256update(struct sha256 *, const void *, size_t);
+static void sha256final(struct sha256 *, unsigned char [32]);
+static void sha256block(uint32_t [8], const unsigned char *);
+
+int opencache(struct cache *cache, const char *dir,
+              unsigned long long maxbytes)
+{
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return -1;
+
+    cache->dir = strdup(dir);
+    if (!cache->dir) return -1;
+    cache->maxbytes = maxbytes;
+    cache->total = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    /* Find out how much is there already, trimming it if needed */
+    if (evict(cache, maxbytes) != 0)
+    {
+        int saved = errno;
+
+        closecache(cache);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+void closecache(struct cache *cache)
+{
+    free(cache->dir);
+    cache->dir = NULL;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/*
+ * The SHA-256 digest of the parameters, a zero byte and the data. Entries
+ * are served on the strength of the key alone, so it has to be a hash
+ * nobody can find collisions for: several clients of one daemon share
+ * the cache, and a font made to collide with someone else's would
+ * otherwise give them its image.
+ */
+void cachekey(char key[CACHEKEYLENGTH + 1], const char *params,
+              const char *data, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char digest[32];
+    struct sha256 sha;
+    int i;
+
+    sha256init(&sha);
+    sha256update(&sha, params, strlen(params) + 1);
+    sha256update(&sha, data, length);
+    sha256final(&sha, digest);
+    for (i = 0; i < 32; ++ i)
+    {
+        key[2 * i] = hex[digest[i] >> 4];
+        key[2 * i + 1] = hex[digest[i] & 15];
+    }
+    key[CACHEKEYLENGTH] = 0;
+}
+
+int cacheopen(struct cache *cache, const char *key, size_t *size)
+{
+    static const struct timespec touch[2] =
+    {
+        { 0, UTIME_NOW }, { 0, UTIME_OMIT }
+    };
+    char *path = entrypath(cache, key);
+    struct stat st;
+    int fd;
+
+    if (!path) return -1;
+    fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) != 0 || (*size && (size_t) st.st_size != *size))
+    {
+        close(fd);
+        return -1;
+    }
+    *size = st.st_size;
+
+    /* Most file systems no longer update the access time on every read */
+    futimens(fd, touch);
+    return fd;
+}
+
+int cacheget(struct cache *cache, const char *key, char *buffer, size_t size)
+{
+    size_t done = 0;
+    int fd = cacheopen(cache, key, &size);
+
+    if (fd < 0) return -1;
+    while (done < size)
+    {
+        ssize_t got = read(fd, buffer + done, size - done);
+
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        done += got;
+    }
+    close(fd);
+    return 0;
+}
+
+int cacheput(struct cache *cache, const char *key, const char *data,
+             size_t size)
+{
+    char *path = entrypath(cache, key), *temp;
+    size_t done = 0;
+    int fd, rc = 0;
+
+    if (!path) return -1;
+    temp = malloc(strlen(cache->dir) + CACHEKEYLENGTH + 10);
+    if (!temp)
+    {
+        free(path);
+        return -1;
+    }
+    sprintf(temp, "%s/.%s.XXXXXX", cache->dir, key);
+
+    /* Write under a temporary name and rename it into place */
+    fd = mkstemp(temp);
+    if (fd < 0)
+    {
+        free(temp);
+        free(path);
+        return -1;
+    }
+    fchmod(fd, 0644);
+    while (done < size)
+    {
+        ssize_t wrote = write(fd, data + done, size - done);
+
+        if (wrote < 0 && EINTR == errno) continue;
+        if (wrote < 0)
+        {
+            rc = -1;
+            break;
+        }
+        done += wrote;
+    }
+    if (close(fd) != 0) rc = -1;
+    if (0 == rc && rename(temp, path) != 0) rc = -1;
+    if (rc != 0)
+    {
+        int saved = errno;
+
+        unlink(temp);
+        errno = saved;
+    }
+    free(temp);
+    free(path);
+
+    if (0 == rc)
+    {
+        pthread_mutex_lock(&cache->lock);
+        cache->total += size;
+        if (cache->total > cache->maxbytes)
+        {
+            evict(cache, cache->maxbytes / 100 * LOWWATER);
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return rc;
+}
+
+size_t cachedformatpbm(struct cache *cache, struct stats *stats,
+                       int x, int y, const char *data, int numchars,
+                       const struct layout *layout, char *out, size_t size)
+{
+    char key[CACHEKEYLENGTH + 1];
+    size_t total = layoutsize(x, y, numchars, layout);
+
+    if (!total || size < total) return 0;
+
+    imagekey(key, FORMAT_PBM, x, y, data, numchars, layout);
+    if (cacheget(cache, key, out, total) == 0)
+    {
+        if (stats) ++ stats->cachehits;
+        return total;
+    }
+
+    if (stats) ++ stats->cachemisses;
+    total = formatlayout(x, y, data, numchars, layout, out, total);
+    if (total) cacheput(cache, key, out, total);
+    return total;
+}
+
+int cachedoutput(struct cache *cache, struct stats *stats,
+                 enum format format, int x, int y, const char *data,
+                 int numchars, const struct layout *layout,
+                 struct output *out, size_t *size)
+{
+    char key[CACHEKEYLENGTH + 1], *image, *allocated = NULL;
+    size_t total = layoutsize(x, y, numchars, layout);
+    int fd, rc;
+
+    if (!total)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* The size of a PNG file is only known once it is in the cache */
+    imagekey(key, format, x, y, data, numchars, layout);
+    if (FORMAT_PBM != format) total = 0;
+    fd = cacheopen(cache, key, &total);
+    if (fd >= 0)
+    {
+        if (stats) ++ stats->cachehits;
+        rc = outputfrom(out, fd, total);
+        close(fd);
+        *size = total;
+        return rc;
+    }
+
+    if (stats) ++ stats->cachemisses;
+    if (FORMAT_PBM != format)
+    {
+        if (layoutpng(x, y, data, numchars, layout,
+                      FORMAT_PNGFAST == format, &allocated, &total) != 0)
+        {
+            return -1;
+        }
+        image = NULL;
+    }
+    else
+    {
+        /* Images that fit are rendered straight into the output buffer */
+        image = total <= out->size ? outputreserve(out, total) : NULL;
+        if (!image && out->error) return -1;
+        if (!image && !(allocated = malloc(total))) return -1;
+        formatlayout(x, y, data, numchars, layout,
+                     image ? image : allocated, total);
+    }
+    cacheput(cache, key, image ? image : allocated, total);
+    *size = total;
+    if (allocated)
+    {
+        rc = outputwrite(out, allocated, total);
+        free(allocated);
+        return rc;
+    }
+    outputcommit(out, total);
+    return 0;
+}
+
+static int evict(struct cache *cache, unsigned long long target)
+{
+    struct entry *entries = NULL;
+    int numentries = 0, maxentries = 0, i;
+    unsigned long long total = 0;
+    struct dirent *de;
+    time_t now = time(NULL);
+    DIR *dir;
+
+    dir = opendir(cache->dir);
+    if (!dir) return -1;
+    while ((de = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        char *path;
+
+        if ('.' == de->d_name[0] && strlen(de->d_name) <= 2) continue;
+        path = entrypath(cache, de->d_name);
+        if (!path) break;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            free(path);
+            continue;
+        }
+
+        /* Clean up after writers that died before renaming */
+        if ('.' == de->d_name[0])
+        {
+            if (now - st.st_mtime > STALETEMP) unlink(path);
+            free(path);
+            continue;
+        }
+
+        if (numentries == maxentries)
+        {
+            int newmax = maxentries ? maxentries * 2 : 256;
+            struct entry *grown =
+                realloc(entries, newmax * sizeof (struct entry));
+
+            if (!grown)
+            {
+                free(path);
+                break;
+            }
+            entries = grown;
+            maxentries = newmax;
+        }
+        entries[numentries].name = path;
+        entries[numentries].atime = st.st_atim;
+        entries[numentries].size = st.st_size;
+        total += st.st_size;
+        ++ numentries;
+    }
+    closedir(dir);
+
+    if (total > target)
+    {
+        qsort(entries, numentries, sizeof (struct entry), compareentries);
+        for (i = 0; i < numentries && total > target; ++ i)
+        {
+            if (unlink(entries[i].name) == 0 || ENOENT == errno)
+            {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    for (i = 0; i < numentries; ++ i)
+    {
+        free(entries[i].name);
+    }
+    free(entries);
+    cache->total = total;
+    return 0;
+}
+
+/* The key for a conversion to an image format */
+static void imagekey(char key[CACHEKEYLENGTH + 1], enum format format,
+                     int x, int y, const char *data, int numchars,
+                     const struct layout *layout)
+{
+    static const char *const names[] = { "pbm", "png", "png-fast" };
+    char params[64];
+
+    /* Only the font data that is converted counts, not the load address */
+    snprintf(params, sizeof params, "%s %dx%d %d %d %d %d %d %d",
+             names[format], x, y, numchars, layout ? layout->perrow : 0,
+             layout ? layout->padding : 0, layout ? layout->columnmajor : 0,
+             layout ? layout->cellheight : 0, layout ? layout->cellbytes : 0);
+    cachekey(key, params, data, fontdatasize(x, y, numchars, layout));
+}
+
+/* Oldest access first */
+static int compareentries(const void *a, const void *b)
+{
+    const struct timespec *x = &((const struct entry *) a)->atime;
+    const struct timespec *y = &((const struct entry *) b)->atime;
+
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return x->tv_nsec < y->tv_nsec ? -1 : x->tv_nsec > y->tv_nsec;
+}
+
+static char *entrypath(const struct cache *cache, const char *name)
+{
+    char *path = malloc(strlen(cache->dir) + strlen(name) + 2);
+
+    if (path) sprintf(path, "%s/%s", cache->dir, name);
+    return path;
+}
+
+static void sha256init(struct sha256 *sha)
+{
+    static const uint32_t initial[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(sha->state, initial, sizeof initial);
+    sha->used = 0;
+    sha->length = 0;
+}
+
+static void sha256update(struct sha256 *sha, const void *data,
+                         size_t length)
+{
+    const unsigned char *p = data;
+
+    sha->length += length;
+    while (length)
+    {
+        size_t n = 64 - sha->used < length ? 64 - sha->used : length;
+
+        memcpy(sha->block + sha->used, p, n);
+        sha->used += n;
+        p += n;
+        length -= n;
+        if (64 == sha->used)
+        {
+            sha256block(sha->state, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+/* Pad with a one bit and the length in bits, big endian */
+static void sha256final(struct sha256 *sha, unsigned char digest[32])
+{
+    unsigned long long bits = sha->length * 8;
+    int i;
+
+    sha->block[sha->used ++] = 0x80;
+    if (sha->used > 56)
+    {
+        memset(sha->block + sha->used, 0, 64 - sha->used);
+        sha256block(sha->state, sha->block);
+        sha->used = 0;
+    }
+    memset(sha->block + sha->used, 0, 56 - sha->used);
+    for (i = 0; i < 8; ++ i)
+    {
+        sha->block[56 + i] = (unsigned char) (bits >> (56 - 8 * i));
+    }
+    sha256block(sha->state, sha->block);
+    for (i = 0; i < 32; ++ i)
+    {
+        digest[i] = (unsigned char) (sha->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+#define ROTR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+/* Compress one 64 byte block into the state, as in FIPS 180-4 */
+static void sha256block(uint32_t state[8], const unsigned char *block)
+{
+    static const uint32_t k[64] =
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+        0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+        0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+        0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+        0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+        0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; ++ i)
+    {
+        w[i] = (uint32_t) block[4 * i] << 24 |
+               (uint32_t) block[4 * i + 1] << 16 |
+               (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (i = 16; i < 64; ++ i)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^
+                      w[i - 15] >> 3;
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^
+                      w[i - 2] >> 10;
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+    for (i = 0; i < 64; ++ i)
+    {
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+             ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
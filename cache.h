@@ -0,0 +1,111 @@
+/*
+ * font2pbm
+ * Content-addressed cache of converted fonts.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "font2pbm.h"
+#include "stats.h"
+#include "output.h"
+
+/*
+ * Converted files are stored in a directory, named by a hash of the font
+ * data and the conversion parameters, so the same charset is only
+ * rendered once however many times and under whatever name it is seen.
+ * Entries are written to a temporary file and renamed into place, so
+ * several processes can share a directory. When the directory grows
+ * past its size limit the least recently used entries, by access time,
+ * are removed.
+ *
+ * The key is a SHA-256 digest, so clients of a daemon sharing the cache
+ * can't make their fonts collide with others'. The cache directory must
+ * still only be writable by trusted users.
+ */
+struct cache
+{
+    char *dir;
+    unsigned long long maxbytes;
+    unsigned long long total;   /* Bytes in the directory, as far as known */
+    pthread_mutex_t lock;
+};
+
+/* Length of a key, not counting the terminating zero */
+#define CACHEKEYLENGTH 64
+
+/* Size limit used unless another is given */
+#define CACHEDEFAULTSIZE (64ULL * 1024 * 1024)
+
+/*
+ * Set up a cache in dir, creating the directory if needed, and trim it
+ * to maxbytes. Returns 0, or -1 with errno set.
+ */
+int opencache(struct cache *, const char *dir, unsigned long long maxbytes);
+
+/* Release the cache structure; the directory is left as it is */
+void closecache(struct cache *);
+
+/*
+ * Compute the key for a conversion, the SHA-256 digest in hex. params
+ * describes everything besides the font data that the output depends
+ * on, such as "pbm 1x1 64".
+ */
+void cachekey(char key[CACHEKEYLENGTH + 1], const char *params,
+              const char *data, size_t length);
+
+/*
+ * Look up a key. On a hit the entry, which must be exactly *size bytes
+ * unless *size is 0, is marked as used, its size stored in *size and a
+ * descriptor for it returned. Returns -1 on a miss.
+ */
+int cacheopen(struct cache *, const char *key, size_t *size);
+
+/*
+ * Look up a key. On a hit the entry, which must be exactly size bytes,
+ * is read into buffer, marked as used and 0 returned. Returns -1 on a
+ * miss.
+ */
+int cacheget(struct cache *, const char *key, char *buffer, size_t size);
+
+/*
+ * Store an entry, evicting old ones if the cache is over its limit.
+ * Returns 0, or -1 with errno set; the caller can carry on either way.
+ */
+int cacheput(struct cache *, const char *key, const char *data, size_t size);
+
+/*
+ * Fill out with the PBM file for a font, as formatlayout() does, taking
+ * it from the cache if it is there and storing it if not. Hits and
+ * misses are counted in stats unless it is NULL.
+ */
+size_t cachedformatpbm(struct cache *, struct stats *, int x, int y,
+                       const char *data, int numchars,
+                       const struct layout *, char *out, size_t size);
+
+/*
+ * The same for any format, adding the file to an output and storing its
+ * size in *size. Hits are copied from the cache file by the kernel.
+ * Returns 0, or -1 with errno set.
+ */
+int cachedoutput(struct cache *, struct stats *, enum format, int x, int y,
+                 const char *data, int numchars, const struct layout *,
+                 struct output *, size_t *size);
+
+#endif
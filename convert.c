@@ -0,0 +1,655 @@
+/*
+ * font2pbm
+ * Conversion of font data to a portable bitmap.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convert.h"
+
+static int validmode(int, int, int);
+
+/*
+ * Work out and check the dimensions of the image for a font. The last
+ * row of characters is padded with blank ones, so any number of
+ * characters can be laid out. Returns 0, or -1 if the size mode or
+ * layout is invalid or the image would be too large to address.
+ */
+int getgeometry(int x, int y, int numchars, const struct layout *layout,
+                struct geometry *geometry)
+{
+    long long height;
+
+    if (!validmode(x, y, numchars) ||
+        (layout && (layout->perrow < 0 ||
+                    layout->perrow > LAYOUT_MAXPERROW ||
+                    layout->padding < 0 ||
+                    layout->padding > LAYOUT_MAXPADDING ||
+                    layout->cellheight < 0 ||
+                    layout->cellheight > LAYOUT_MAXCELLHEIGHT ||
+                    layout->cellbytes < 0 ||
+                    layout->cellbytes > LAYOUT_MAXCELLBYTES)))
+    {
+        return -1;
+    }
+
+    /* Cells are eight bytes of eight scanlines unless set otherwise */
+    geometry->cellheight = layout && layout->cellheight ? layout->cellheight
+                                                        : 8;
+    geometry->cellbytes = layout && layout->cellbytes ? layout->cellbytes
+                                                      : geometry->cellheight;
+    if (geometry->cellbytes < geometry->cellheight) return -1;
+
+    /* The default fills 256 pixels */
+    geometry->perrow = layout && layout->perrow ? layout->perrow : 32 / x;
+    geometry->padding = layout ? layout->padding : 0;
+    geometry->columnmajor = layout ? layout->columnmajor : 0;
+    geometry->rows = numchars / geometry->perrow +
+                     (numchars % geometry->perrow != 0);
+
+    geometry->width = geometry->perrow * 8 * x +
+                      (geometry->perrow - 1) * geometry->padding;
+    height = geometry->rows ? (long long) geometry->rows *
+                              (geometry->cellheight * y + geometry->padding) -
+                              geometry->padding
+                            : 0;
+    geometry->stride = (geometry->width + 7) / 8;
+    if (height > 0x7fffffff ||
+        (unsigned long long) height * geometry->stride > (size_t) -1 / 2)
+    {
+        return -1;
+    }
+    geometry->height = (int) height;
+    geometry->bandsize = (size_t) geometry->cellheight * y * geometry->stride;
+    geometry->gap = (size_t) geometry->padding * geometry->stride;
+    geometry->datasize = (size_t) geometry->height * geometry->stride;
+
+    /*
+     * The original layout has specialised converters for the rows that
+     * are full, with the common kinds of cell; a short last row and
+     * anything else goes through layoutband().
+     */
+    geometry->convert = NULL;
+    geometry->fullrows = 0;
+    if (geometry->perrow == 32 / x && !geometry->padding &&
+        !geometry->columnmajor)
+    {
+        geometry->convert = getbandfunc(x, y, geometry->cellheight,
+                                        geometry->cellbytes);
+    }
+    if (geometry->convert) geometry->fullrows = numchars / geometry->perrow;
+    return 0;
+}
+
+int layoutwidth(int x, const struct layout *layout)
+{
+    struct geometry geometry;
+
+    return getgeometry(x, 1, 0, layout, &geometry) == 0 ? geometry.width : 0;
+}
+
+int layoutheight(int x, int y, int numchars, const struct layout *layout)
+{
+    struct geometry geometry;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0) return 0;
+    return geometry.height;
+}
+
+/*
+ * Height in pixels of the image for a font in the original layout, the
+ * last row padded with blank characters.
+ */
+int pbmheight(int x, int y, int numchars)
+{
+    return layoutheight(x, y, numchars, NULL);
+}
+
+/*
+ * Convert one row of characters into band, which receives 8 * y scanlines
+ * of 256 / 8 bytes each, using the best blit kernel for this CPU.
+ */
+void createband(int x, int y, const char *data, int numchars, int row,
+                char *band)
+{
+    getbandfunc(x, y, 8, 8)(getblit(), data, numchars, row, band);
+}
+
+/*
+ * As createband(), with a given blit kernel. This is the generic version
+ * for any size mode; conversions use the specialised ones below.
+ */
+void blitband(blitfunc blit, int x, int y, const char *data, int numchars,
+              int row, char *band)
+{
+    const char *src[32];
+    int charsperline, column, ychar;
+
+    /*
+     * Output characters, one by one. With 256 pixels width, we can output
+     * 32 11 or 12 characters in a line, or 16 21 or 22 characters.
+     * Each byte column of the band comes from one 88 part of a character,
+     * so a band is y rows of 32 parts, and each row is blitted in one go.
+     */
+    charsperline = 32 / x;
+
+    for (ychar = 0; ychar < y; ++ ychar)
+    {
+        for (column = 0; column < 32; ++ column)
+        {
+            int i, xchar;
+
+            i = row * charsperline + column / x;
+            xchar = column % x;
+
+            /* Calculate index in font data for this part of the character */
+            src[column] =
+                data + (i + xchar * numchars + ychar * numchars * x) * 8;
+        }
+        blit(src, band + 8 * ychar * 256 / 8, 256 / 8);
+    }
+}
+
+/*
+ * Band converters specialised for each size mode and the common kinds of
+ * cell: H scanlines stored in B bytes. With all of them known at compile
+ * time, the divisions and multiplications fold into constants and the
+ * pointer setup unrolls completely. A 16 line cell is blitted as two 8
+ * line halves.
+ */
+#define SPECIALISE(NAME, X, Y, H, B) \
+static void NAME(blitfunc blit, const char *data, int numchars, int row, \
+                 char *band) \
+{ \
+    const char *src[32]; \
+    const char *first = data + row * (32 / X) * B; \
+    size_t part = (size_t) numchars * B; \
+    int column, ychar, half; \
+\
+    for (ychar = 0; ychar < Y; ++ ychar) \
+    { \
+        for (half = 0; half < H / 8; ++ half) \
+        { \
+            _Pragma("GCC unroll 32") \
+            for (column = 0; column < 32; ++ column) \
+            { \
+                src[column] = first + (column / X) * B + \
+                              (column % X + ychar * X) * part + half * 8; \
+            } \
+            blit(src, band + (ychar * H + half * 8) * 256 / 8, 256 / 8); \
+        } \
+    } \
+}
+
+/* 8x8 cells, as on the VIC-II */
+SPECIALISE(band1x1, 1, 1, 8, 8)
+SPECIALISE(band1x2, 1, 2, 8, 8)
+SPECIALISE(band2x1, 2, 1, 8, 8)
+SPECIALISE(band2x2, 2, 2, 8, 8)
+
+/* 8x8 cells padded to 16 bytes, as in C128 VDC character memory */
+SPECIALISE(band1x1padded, 1, 1, 8, 16)
+SPECIALISE(band1x2padded, 1, 2, 8, 16)
+SPECIALISE(band2x1padded, 2, 1, 8, 16)
+SPECIALISE(band2x2padded, 2, 2, 8, 16)
+
+/* 8x16 cells of 16 bytes, the tall VDC characters */
+SPECIALISE(band1x1tall, 1, 1, 16, 16)
+SPECIALISE(band1x2tall, 1, 2, 16, 16)
+SPECIALISE(band2x1tall, 2, 1, 16, 16)
+SPECIALISE(band2x2tall, 2, 2, 16, 16)
+
+static const bandfunc bandfuncs[3][2][2] =
+{
+    { { band1x1, band1x2 }, { band2x1, band2x2 } },
+    { { band1x1padded, band1x2padded }, { band2x1padded, band2x2padded } },
+    { { band1x1tall, band1x2tall }, { band2x1tall, band2x2tall } }
+};
+
+/*
+ * The band converter for a size mode, x and y in 1..2, and a kind of
+ * cell, or NULL if there is no specialised one
+ */
+bandfunc getbandfunc(int x, int y, int cellheight, int cellbytes)
+{
+    int kind;
+
+    if (8 == cellheight && 8 == cellbytes)
+    {
+        kind = 0;
+    }
+    else if (8 == cellheight && 16 == cellbytes)
+    {
+        kind = 1;
+    }
+    else if (16 == cellheight && 16 == cellbytes)
+    {
+        kind = 2;
+    }
+    else
+    {
+        return NULL;
+    }
+    return bandfuncs[kind][x - 1][y - 1];
+}
+
+/*
+ * Convert one row of characters for any layout into band, which receives
+ * cellheight * y scanlines. Without padding the cells of a scanline are
+ * adjacent bytes and the blit kernel gathers them 32 at a time, eight
+ * scanlines at a time; with padding, or cells that are not a multiple of
+ * eight scanlines high, each cell is shifted into place at its bit
+ * offset. Characters past the end of the font are left blank.
+ */
+void layoutband(blitfunc blit, int x, int y, const char *data, int numchars,
+                const struct geometry *geometry, int row, char *band)
+{
+    static const char blank[LAYOUT_MAXCELLBYTES];
+    const char *src[32];
+    char tail[8 * 32];
+    int stride = geometry->stride, cells = geometry->perrow * x;
+    int height = geometry->cellheight, bytes = geometry->cellbytes;
+    int shifted = geometry->padding || height % 8;
+    int ychar, cell, i, line, part;
+
+    for (ychar = 0; ychar < y; ++ ychar)
+    {
+        char *dst = band + ychar * height * stride;
+
+        if (shifted) memset(dst, 0, height * stride);
+        for (cell = 0; cell < cells; cell += 32)
+        {
+            int count = cells - cell < 32 ? cells - cell : 32;
+
+            for (i = 0; i < count; ++ i)
+            {
+                int column = (cell + i) / x, xchar = (cell + i) % x;
+                int index = geometry->columnmajor
+                    ? column * geometry->rows + row
+                    : row * geometry->perrow + column;
+
+                src[i] = index < numchars
+                    ? data + (index + (xchar + ychar * x) *
+                              (size_t) numchars) * bytes
+                    : blank;
+            }
+
+            if (shifted)
+            {
+                for (i = 0; i < count; ++ i)
+                {
+                    const unsigned char *p = (const unsigned char *) src[i];
+                    int bit = (cell + i) / x * (8 * x + geometry->padding) +
+                              (cell + i) % x * 8;
+                    unsigned char *d = (unsigned char *) dst + bit / 8;
+                    int shift = bit % 8;
+
+                    for (line = 0; line < height; ++ line, d += stride)
+                    {
+                        d[0] |= p[line] >> shift;
+                        if (shift) d[1] |= p[line] << (8 - shift);
+                    }
+                }
+            }
+            else
+            {
+                for (i = count; i < 32; ++ i) src[i] = blank;
+                for (part = 0; part < height; part += 8)
+                {
+                    char *to = dst + part * stride + cell;
+
+                    if (32 == count)
+                    {
+                        blit(src, to, stride);
+                    }
+                    else
+                    {
+                        blit(src, tail, 32);
+                        for (line = 0; line < 8; ++ line)
+                        {
+                            memcpy(to + line * stride, tail + line * 32,
+                                   count);
+                        }
+                    }
+
+                    /* On to the next eight scanlines of every cell */
+                    for (i = 0; i < 32; ++ i) src[i] += 8;
+                }
+            }
+        }
+    }
+}
+
+/* Convert row of characters with the best converter for it */
+static void convertrow(blitfunc blit, int x, int y, const char *data,
+                       int numchars, const struct geometry *geometry,
+                       int row, char *band)
+{
+    if (row < geometry->fullrows)
+    {
+        geometry->convert(blit, data, numchars, row, band);
+    }
+    else
+    {
+        layoutband(blit, x, y, data, numchars, geometry, row, band);
+    }
+}
+
+struct pbm createpbm(int x, int y, const char *data, int numchars)
+{
+    struct pbm output;
+
+    /*
+     * The created image is 256 pixels wide and 64 pixels high, which is 8
+     * characters in 11 or 21, or 4 characters in 12 or 22.
+     * The height of the output image depends on the number of characters
+     * in the font.
+     */
+    output.x = 256;
+    output.y = pbmheight(x, y, numchars);
+
+    /* Allocate the data for the bitmap */
+    output.data = malloc(256 / 8 * output.y);
+    if (!output.data) return output;
+
+    /* Convert characters */
+    renderpbm(x, y, data, numchars, output.data, 256 / 8 * output.y);
+
+    return output;
+}
+
+/*
+ * Length of the PBM header for an image of the given size; the header is
+ * the same whether printed or formatted into a buffer.
+ */
+#define PBMHEADER "P4\n# Commodore 64 font converted by font2pbm\n%d %d\n"
+
+int pbmheaderlength(int x, int y)
+{
+    return snprintf(NULL, 0, PBMHEADER, x, y);
+}
+
+void printheader(int x, int y, FILE *out)
+{
+    /* PBM header */
+    fprintf(out, PBMHEADER, x, y);
+}
+
+/* The same for an output. Returns 0, or -1 with errno set */
+int outputheader(struct output *out, int x, int y)
+{
+    int length = pbmheaderlength(x, y);
+    char *header = outputreserve(out, length + 1);
+
+    if (!header) return -1;
+    sprintf(header, PBMHEADER, x, y);
+    outputcommit(out, length);
+    return 0;
+}
+
+/* Header and data go out together, in one write for most fonts */
+void printpbm(struct pbm pbm, FILE *out)
+{
+    struct output output;
+    size_t size = 256 / 8 * pbm.y;
+
+    if (openoutput(&output, -1, out, pbmheaderlength(pbm.x, pbm.y) + size)
+        != 0)
+    {
+        return;
+    }
+    outputheader(&output, pbm.x, pbm.y);
+
+    /* Image data */
+    outputwrite(&output, pbm.data, size);
+    closeoutput(&output);
+}
+
+/*
+ * Write the image data for a font without building the whole bitmap:
+ * each row of characters is converted straight into the output buffer,
+ * which is written out whenever it fills up. Returns 0 on success, or -1
+ * on a write error.
+ */
+int streambands(int x, int y, const char *data, int numchars, FILE *out)
+{
+    struct output output;
+    int rc;
+
+    if (openoutput(&output, -1, out, pbmdatasize(x, y, numchars)) != 0)
+    {
+        return -1;
+    }
+    rc = streambandstimed(x, y, data, numchars, NULL, &output, NULL);
+    if (closeoutput(&output) != 0) rc = -1;
+    return rc;
+}
+
+/*
+ * As streambands(), for any layout and an output that the caller
+ * flushes, adding the time spent converting and writing, the glyphs
+ * converted and the bytes written to stats if it is not NULL.
+ */
+int streambandstimed(int x, int y, const char *data, int numchars,
+                     const struct layout *layout, struct output *out,
+                     struct stats *stats)
+{
+    blitfunc blit = getblit();
+    struct geometry geometry;
+    char *spare = NULL;
+    int row, rc = 0;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0) return -1;
+
+    /* A band too big for the buffer is converted aside and written out */
+    if (geometry.bandsize > out->size)
+    {
+        spare = malloc(geometry.bandsize);
+        if (!spare) return -1;
+    }
+
+    for (row = 0; row < geometry.rows && 0 == rc; ++ row)
+    {
+        unsigned long long start = 0, reserved = 0, converted = 0;
+        int last = row == geometry.rows - 1;
+        char *band;
+
+        /* Reserving room is where a full buffer gets written */
+        if (stats) start = nanotime();
+        band = spare ? spare : outputreserve(out, geometry.bandsize);
+        if (stats) reserved = nanotime();
+        if (!band)
+        {
+            rc = -1;
+            break;
+        }
+        convertrow(blit, x, y, data, numchars, &geometry, row, band);
+        if (stats) converted = nanotime();
+        if (!spare)
+        {
+            outputcommit(out, geometry.bandsize);
+        }
+        else if (outputwrite(out, spare, geometry.bandsize) != 0)
+        {
+            rc = -1;
+        }
+
+        /* Padding between rows of characters */
+        if (!last && outputfill(out, 0, geometry.gap) != 0)
+        {
+            rc = -1;
+        }
+        if (stats)
+        {
+            stats->convertns += converted - reserved;
+            stats->writens += reserved - start + nanotime() - converted;
+            stats->bytesout += geometry.bandsize;
+            if (!last) stats->bytesout += geometry.gap;
+        }
+    }
+
+    free(spare);
+    if (stats && 0 == rc) stats->glyphs += numchars;
+    return rc;
+}
+
+/* Write a complete PBM for a font using streambands() */
+int streampbm(int x, int y, const char *data, int numchars, FILE *out)
+{
+    return streamlayout(x, y, data, numchars, NULL, out);
+}
+
+/* The same for any layout */
+int streamlayout(int x, int y, const char *data, int numchars,
+                 const struct layout *layout, FILE *out)
+{
+    struct output output;
+    int rc;
+
+    if (openoutput(&output, -1, out, layoutsize(x, y, numchars, layout))
+        != 0)
+    {
+        return -1;
+    }
+    rc = outputheader(&output, layoutwidth(x, layout),
+                      layoutheight(x, y, numchars, layout));
+    if (0 == rc)
+    {
+        rc = streambandstimed(x, y, data, numchars, layout, &output, NULL);
+    }
+    if (closeoutput(&output) != 0) rc = -1;
+    return rc;
+}
+
+/* Size modes are 1x1, 1x2, 2x1 or 2x2 */
+static int validmode(int x, int y, int numchars)
+{
+    return x >= 1 && x <= 2 && y >= 1 && y <= 2 && numchars >= 0;
+}
+
+size_t pbmdatasize(int x, int y, int numchars)
+{
+    struct geometry geometry;
+
+    if (getgeometry(x, y, numchars, NULL, &geometry) != 0) return 0;
+    return geometry.datasize;
+}
+
+size_t fontdatasize(int x, int y, int numchars, const struct layout *layout)
+{
+    struct geometry geometry;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0) return 0;
+    return (size_t) numchars * x * y * geometry.cellbytes;
+}
+
+size_t pbmsize(int x, int y, int numchars)
+{
+    return layoutsize(x, y, numchars, NULL);
+}
+
+size_t layoutsize(int x, int y, int numchars, const struct layout *layout)
+{
+    struct geometry geometry;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0) return 0;
+    return pbmheaderlength(geometry.width, geometry.height) +
+           geometry.datasize;
+}
+
+const char *readfont(const char *file, size_t length, int x, int y,
+                     int numchars, unsigned *loadaddress)
+{
+    if (!validmode(x, y, numchars) ||
+        length < 2 + (size_t) numchars * x * y * 8)
+    {
+        return NULL;
+    }
+
+    if (loadaddress)
+    {
+        *loadaddress = (unsigned char) file[0] |
+                       ((unsigned char) file[1] << 8);
+    }
+    return file + 2;
+}
+
+int renderpbm(int x, int y, const char *data, int numchars,
+              char *out, size_t size)
+{
+    return renderlayout(x, y, data, numchars, NULL, out, size);
+}
+
+int renderlayout(int x, int y, const char *data, int numchars,
+                 const struct layout *layout, char *out, size_t size)
+{
+    struct geometry geometry;
+    blitfunc blit = getblit();
+    int row;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0 ||
+        size < geometry.datasize)
+    {
+        return -1;
+    }
+
+    for (row = 0; row < geometry.rows; ++ row)
+    {
+        convertrow(blit, x, y, data, numchars, &geometry, row, out);
+        out += geometry.bandsize;
+        if (row < geometry.rows - 1)
+        {
+            memset(out, 0, geometry.gap);
+            out += geometry.gap;
+        }
+    }
+    return 0;
+}
+
+size_t formatpbm(int x, int y, const char *data, int numchars,
+                 char *out, size_t size)
+{
+    return formatlayout(x, y, data, numchars, NULL, out, size);
+}
+
+size_t formatlayout(int x, int y, const char *data, int numchars,
+                    const struct layout *layout, char *out, size_t size)
+{
+    size_t total = layoutsize(x, y, numchars, layout);
+    int width, height, header;
+
+    if (!total || size < total) return 0;
+
+    /* snprintf needs room for the terminator, which the data overwrites */
+    width = layoutwidth(x, layout);
+    height = layoutheight(x, y, numchars, layout);
+    header = pbmheaderlength(width, height);
+    if (size > (size_t) header)
+    {
+        snprintf(out, header + 1, PBMHEADER, width, height);
+    }
+    else
+    {
+        char buffer[64];
+        snprintf(buffer, sizeof buffer, PBMHEADER, width, height);
+        memcpy(out, buffer, header);
+    }
+
+    renderlayout(x, y, data, numchars, layout, out + header, size - header);
+    return total;
+}
@@ -0,0 +1,61 @@
+/*
+ * font2pbm
+ * Internals of the conversion engine.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include "font2pbm.h"
+#include "blit.h"
+#include "stats.h"
+#include "output.h"
+
+/* Converts one band for a given size mode, see getbandfunc() */
+typedef void (*bandfunc)(blitfunc, const char *data, int numchars, int row,
+                         char *band);
+
+void blitband(blitfunc, int, int, const char *, int, int, char *);
+/*
+ * Dimensions of the image for a font and layout, worked out and checked
+ * once by getgeometry() so the converters can rely on them.
+ */
+struct geometry
+{
+    int perrow, rows;           /* Characters per row, rows of characters */
+    int width, height;          /* Image size in pixels */
+    int stride;                 /* Bytes per scanline */
+    int padding, columnmajor;   /* From the layout */
+    int cellheight, cellbytes;  /* The same, with the defaults filled in */
+    size_t bandsize;            /* One row of characters */
+    size_t gap;                 /* Padding between rows of characters */
+    size_t datasize;            /* The whole image */
+    bandfunc convert;           /* Specialised converter, or NULL */
+    int fullrows;               /* Rows that can use it */
+};
+
+void layoutband(blitfunc, int, int, const char *, int,
+                const struct geometry *, int, char *);
+bandfunc getbandfunc(int, int, int, int);
+int getgeometry(int, int, int, const struct layout *, struct geometry *);
+int pbmheaderlength(int, int);
+int outputheader(struct output *, int, int);
+int writepng(struct output *, const char *, int, int, int);
+int streambandstimed(int, int, const char *, int, const struct layout *,
+                     struct output *, struct stats *);
+
+#endif
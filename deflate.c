@@ -0,0 +1,963 @@
+/*
+ * font2pbm
+ * Deflate encoder for PNG output.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+
+#define WINDOWSIZE 32768
+#define HASHBITS 15
+#define HASHSIZE (1 << HASHBITS)
+#define MINMATCH 3
+#define MAXMATCH 258
+
+/* Search effort at the best level */
+#define MAXCHAIN 256            /* Candidates tried per position */
+#define NICEMATCH 128           /* Long enough to stop looking */
+
+/* Tokens collected before a block is written */
+#define BLOCKTOKENS 16384
+
+/* Alphabets */
+#define LITLENCODES 286
+#define DISTANCECODES 30
+#define CODELENGTHCODES 19
+#define MAXBITS 15
+#define MAXCODELENGTHBITS 7
+#define ENDOFBLOCK 256
+
+/* A literal byte, with distance 0, or a match */
+struct token
+{
+    unsigned short length;
+    unsigned short distance;
+};
+
+/* State for compressing one chunk */
+struct matcher
+{
+    const unsigned char *base;  /* Start of the dictionary */
+    unsigned *head, *prev;      /* Hash chains of positions plus one */
+    struct token *tokens;
+    int count;
+    size_t blockstart;          /* First byte covered by the tokens */
+};
+
+/* A symbol and its frequency, for building codes */
+struct symbol
+{
+    unsigned long frequency;
+    int value;
+};
+
+static const unsigned short lengthbase[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lengthextra[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distancebase[30] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289,
+    16385, 24577
+};
+static const unsigned char distanceextra[30] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/* Order in which the code length code lengths are sent */
+static const unsigned char codelengthorder[CODELENGTHCODES] =
+{
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* Length code for each match length from 3 up */
+static const unsigned char lengthcode[256] =
+{
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+    16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
+    18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19,
+    20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+    21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+    22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+    23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+    25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+    26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+    26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+    27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+    27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 28
+};
+
+/*
+ * Distance code for each distance, indexed by distance - 1 up to 256 and
+ * by 256 + (distance - 1) / 128 above that
+ */
+static const unsigned char distancecode[512] =
+{
+     0,  1,  2,  3,  4,  4,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,
+     8,  8,  8,  8,  8,  8,  8,  8,  9,  9,  9,  9,  9,  9,  9,  9,
+    10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+     0,  0, 16, 17, 18, 18, 19, 19, 20, 20, 20, 20, 21, 21, 21, 21,
+    22, 22, 22, 22, 22, 22, 22, 22, 23, 23, 23, 23, 23, 23, 23, 23,
+    24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+    25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25, 25,
+    26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+    26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26, 26,
+    27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+    27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27, 27,
+    28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29,
+    29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29, 29
+};
+
+static int compressfast(struct deflatestream *, struct matcher *, size_t,
+                        size_t, size_t);
+static int compressbest(struct deflatestream *, struct matcher *, size_t,
+                        size_t);
+static unsigned longestmatch(const struct matcher *, size_t, size_t,
+                             unsigned *);
+static void insert(struct matcher *, size_t);
+static unsigned matchlength(const unsigned char *, const unsigned char *,
+                            unsigned);
+static int addtoken(struct deflatestream *, struct matcher *, unsigned,
+                    unsigned, size_t);
+static int writeblock(struct deflatestream *, const struct token *, int,
+                      const unsigned char *, size_t, int);
+static int runlengths(const unsigned char *, int, unsigned char *,
+                      unsigned char *);
+static void buildlengths(const unsigned long *, int, int, unsigned char *);
+static void buildcodes(const unsigned char *, int, unsigned short *);
+static int comparesymbols(const void *, const void *);
+static int reserve(struct deflatestream *, size_t);
+static void putbits(struct deflatestream *, unsigned, int);
+static void alignbits(struct deflatestream *);
+
+void initdeflate(struct deflatestream *s)
+{
+    s->data = NULL;
+    s->length = s->allocated = 0;
+    s->bits = 0;
+    s->count = 0;
+    s->failed = 0;
+}
+
+void freedeflate(struct deflatestream *s)
+{
+    free(s->data);
+    initdeflate(s);
+}
+
+int deflateraw(struct deflatestream *s, const void *data, size_t size)
+{
+    if (reserve(s, size) != 0) return -1;
+    alignbits(s);
+    memcpy(s->data + s->length, data, size);
+    s->length += size;
+    return 0;
+}
+
+int deflatechunk(struct deflatestream *s, const unsigned char *data,
+                 size_t dictsize, size_t size, int level, size_t rowlength,
+                 int last)
+{
+    struct matcher m;
+    size_t start = dictsize, end = dictsize + size;
+    int rc;
+
+    m.base = data - dictsize;
+    m.count = 0;
+    m.blockstart = start;
+    m.head = m.prev = NULL;
+    m.tokens = malloc(BLOCKTOKENS * sizeof (struct token));
+    if (DEFLATE_BEST == level)
+    {
+        m.head = calloc(HASHSIZE, sizeof (unsigned));
+        m.prev = malloc(WINDOWSIZE * sizeof (unsigned));
+    }
+    if (!m.tokens || (DEFLATE_BEST == level && (!m.head || !m.prev)))
+    {
+        rc = -1;
+    }
+    else if (DEFLATE_BEST == level)
+    {
+        rc = compressbest(s, &m, start, end);
+    }
+    else
+    {
+        rc = compressfast(s, &m, start, end, rowlength);
+    }
+
+    /* The rest of the tokens, then the end of the chunk */
+    if (0 == rc && (m.count || last))
+    {
+        rc = writeblock(s, m.tokens, m.count, m.base + m.blockstart,
+                        end - m.blockstart, last);
+    }
+    if (0 == rc && reserve(s, 8) != 0) rc = -1;
+    if (0 == rc && !last)
+    {
+        /* Empty stored block */
+        putbits(s, 0, 3);
+        alignbits(s);
+        memcpy(s->data + s->length, "\0\0\377\377", 4);
+        s->length += 4;
+    }
+    else if (0 == rc)
+    {
+        alignbits(s);
+    }
+
+    free(m.tokens);
+    free(m.head);
+    free(m.prev);
+    if (rc != 0) s->failed = 1;
+    return rc;
+}
+
+unsigned long adler32(unsigned long adler, const unsigned char *data,
+                      size_t size)
+{
+    unsigned long a = adler & 0xffff, b = adler >> 16;
+
+    while (size)
+    {
+        /* The most bytes before b can overflow 32 bits */
+        size_t n = size < 5552 ? size : 5552;
+
+        size -= n;
+        while (n --)
+        {
+            a += *data ++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+unsigned long adler32combine(unsigned long first, unsigned long second,
+                             size_t length)
+{
+    unsigned long rem = length % 65521;
+    unsigned long a = (first & 0xffff) + (second & 0xffff) + 65521 - 1;
+    unsigned long b = rem * (first & 0xffff) % 65521;
+
+    /* b gains a of the first piece once for every byte of the second */
+    b += (first >> 16) + (second >> 16) + 65521 - rem;
+    a %= 65521;
+    b %= 65521;
+    return b << 16 | a;
+}
+
+/*
+ * Fast level: at each position take the longer of a run continuing the
+ * previous byte and a repeat of the previous scanline, if either is long
+ * enough to be a match.
+ */
+static int compressfast(struct deflatestream *s, struct matcher *m,
+                        size_t pos, size_t end, size_t rowlength)
+{
+    const unsigned char *base = m->base;
+
+    if (rowlength > WINDOWSIZE) rowlength = 0;
+    while (pos < end)
+    {
+        unsigned max = end - pos < MAXMATCH ? end - pos : MAXMATCH;
+        unsigned length = 0, distance = 0;
+
+        if (max >= MINMATCH && pos >= 1)
+        {
+            length = matchlength(base + pos, base + pos - 1, max);
+            distance = 1;
+        }
+        if (max >= MINMATCH && rowlength && pos >= rowlength &&
+            length < max)
+        {
+            unsigned row = matchlength(base + pos, base + pos - rowlength,
+                                       max);
+            if (row > length)
+            {
+                length = row;
+                distance = rowlength;
+            }
+        }
+
+        if (length >= MINMATCH)
+        {
+            if (addtoken(s, m, length, distance, pos + length) != 0)
+            {
+                return -1;
+            }
+            pos += length;
+        }
+        else
+        {
+            if (addtoken(s, m, base[pos], 0, pos + 1) != 0) return -1;
+            ++ pos;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Best level: hash chains with lazy matching, so a match is only taken
+ * if the next position does not start a longer one.
+ */
+static int compressbest(struct deflatestream *s, struct matcher *m,
+                        size_t pos, size_t end)
+{
+    unsigned prevlength = 0, prevdistance = 0;
+    int available = 0;
+    size_t p;
+
+    /* The end of the dictionary can be matched */
+    for (p = pos > WINDOWSIZE ? pos - WINDOWSIZE : 0; p < pos; ++ p)
+    {
+        if (end - p >= MINMATCH) insert(m, p);
+    }
+
+    while (pos < end)
+    {
+        unsigned length = 0, distance = 0;
+
+        if (end - pos >= MINMATCH)
+        {
+            if (prevlength < NICEMATCH)
+            {
+                length = longestmatch(m, pos, end, &distance);
+            }
+            insert(m, pos);
+        }
+
+        if (prevlength >= MINMATCH && length <= prevlength)
+        {
+            /* The match from the previous position wins */
+            if (addtoken(s, m, prevlength, prevdistance,
+                         pos - 1 + prevlength) != 0)
+            {
+                return -1;
+            }
+            for (p = pos + 1; p < pos - 1 + prevlength; ++ p)
+            {
+                if (end - p >= MINMATCH) insert(m, p);
+            }
+            pos += prevlength - 1;
+            prevlength = 0;
+            available = 0;
+        }
+        else
+        {
+            if (available &&
+                addtoken(s, m, m->base[pos - 1], 0, pos) != 0)
+            {
+                return -1;
+            }
+            prevlength = length;
+            prevdistance = distance;
+            available = 1;
+            ++ pos;
+        }
+    }
+
+    if (available)
+    {
+        if (prevlength >= MINMATCH)
+        {
+            return addtoken(s, m, prevlength, prevdistance,
+                            pos - 1 + prevlength);
+        }
+        return addtoken(s, m, m->base[pos - 1], 0, pos);
+    }
+    return 0;
+}
+
+/* Hash of the three bytes at a position */
+#define HASH(p) \
+    ((((unsigned) (p)[0] | (unsigned) (p)[1] << 8 | \
+       (unsigned) (p)[2] << 16) * 2654435761U) >> (32 - HASHBITS))
+
+/*
+ * Find the longest earlier match for the bytes at pos, which must not be
+ * inserted yet. Returns its length, 0 if shorter than MINMATCH.
+ */
+static unsigned longestmatch(const struct matcher *m, size_t pos,
+                             size_t end, unsigned *distance)
+{
+    const unsigned char *here = m->base + pos;
+    unsigned max = end - pos < MAXMATCH ? end - pos : MAXMATCH;
+    unsigned best = MINMATCH - 1, candidate = m->head[HASH(here)];
+    int chain = MAXCHAIN;
+
+    while (candidate && chain --)
+    {
+        size_t c = candidate - 1;
+        unsigned length;
+
+        if (pos - c > WINDOWSIZE) break;
+        if (m->base[c + best] == here[best] && m->base[c] == here[0])
+        {
+            length = matchlength(here, m->base + c, max);
+            if (length > best)
+            {
+                best = length;
+                *distance = pos - c;
+                if (length >= NICEMATCH || length == max) break;
+            }
+        }
+
+        /* Chains only go back; anything else is a stale entry */
+        candidate = m->prev[c & (WINDOWSIZE - 1)];
+        if (candidate > c) break;
+    }
+    return best >= MINMATCH ? best : 0;
+}
+
+/* Add a position to the hash chains */
+static void insert(struct matcher *m, size_t pos)
+{
+    unsigned hash = HASH(m->base + pos);
+
+    m->prev[pos & (WINDOWSIZE - 1)] = m->head[hash];
+    m->head[hash] = pos + 1;
+}
+
+/* Number of equal bytes at a and b, up to max */
+static unsigned matchlength(const unsigned char *a, const unsigned char *b,
+                            unsigned max)
+{
+    unsigned n = 0;
+
+    while (n + 8 <= max)
+    {
+        unsigned long long x, y;
+
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) break;
+        n += 8;
+    }
+    while (n < max && a[n] == b[n]) ++ n;
+    return n;
+}
+
+/*
+ * Add a literal or a match ending before next, writing a block when the
+ * token buffer is full. Returns 0 or -1.
+ */
+static int addtoken(struct deflatestream *s, struct matcher *m,
+                    unsigned length, unsigned distance, size_t next)
+{
+    m->tokens[m->count].length = length;
+    m->tokens[m->count].distance = distance;
+    if (++ m->count < BLOCKTOKENS) return 0;
+
+    if (writeblock(s, m->tokens, m->count, m->base + m->blockstart,
+                   next - m->blockstart, 0) != 0)
+    {
+        return -1;
+    }
+    m->count = 0;
+    m->blockstart = next;
+    return 0;
+}
+
+/*
+ * Write a block of tokens, which stand for the raw bytes given, with
+ * whichever coding is smallest. Returns 0 or -1.
+ */
+static int writeblock(struct deflatestream *s, const struct token *tokens,
+                      int count, const unsigned char *raw, size_t rawlength,
+                      int final)
+{
+    unsigned long litfreq[LITLENCODES], distfreq[DISTANCECODES];
+    unsigned long clfreq[CODELENGTHCODES];
+    unsigned char litlen[288], distlen[DISTANCECODES];
+    unsigned char cllen[CODELENGTHCODES];
+    unsigned short litcode[288], distcode[DISTANCECODES];
+    unsigned short clcode[CODELENGTHCODES];
+    unsigned char lengths[LITLENCODES + DISTANCECODES];
+    unsigned char runs[LITLENCODES + DISTANCECODES];
+    unsigned char runextra[LITLENCODES + DISTANCECODES];
+    unsigned long long extrabits = 0, dynamic, fixed, stored, cost;
+    int i, hlit, hdist, hclen, numruns;
+    size_t pieces;
+
+    /* Count the symbols */
+    memset(litfreq, 0, sizeof litfreq);
+    memset(distfreq, 0, sizeof distfreq);
+    memset(clfreq, 0, sizeof clfreq);
+    for (i = 0; i < count; ++ i)
+    {
+        unsigned length = tokens[i].length, distance = tokens[i].distance;
+
+        if (distance)
+        {
+            int lc = lengthcode[length - MINMATCH];
+            int dc = distance <= 256 ? distancecode[distance - 1]
+                                     : distancecode[256 +
+                                                    ((distance - 1) >> 7)];
+
+            ++ litfreq[257 + lc];
+            ++ distfreq[dc];
+            extrabits += lengthextra[lc] + distanceextra[dc];
+        }
+        else
+        {
+            ++ litfreq[length];
+        }
+    }
+    litfreq[ENDOFBLOCK] = 1;
+
+    /* Dynamic codes and their description */
+    buildlengths(litfreq, LITLENCODES, MAXBITS, litlen);
+    litlen[286] = litlen[287] = 0;
+    buildlengths(distfreq, DISTANCECODES, MAXBITS, distlen);
+    for (hlit = LITLENCODES; hlit > 257 && !litlen[hlit - 1]; -- hlit) ;
+    for (hdist = DISTANCECODES; hdist > 1 && !distlen[hdist - 1]; -- hdist) ;
+    memcpy(lengths, litlen, hlit);
+    memcpy(lengths + hlit, distlen, hdist);
+    numruns = runlengths(lengths, hlit + hdist, runs, runextra);
+    for (i = 0; i < numruns; ++ i) ++ clfreq[runs[i]];
+    buildlengths(clfreq, CODELENGTHCODES, MAXCODELENGTHBITS, cllen);
+    for (hclen = CODELENGTHCODES;
+         hclen > 4 && !cllen[codelengthorder[hclen - 1]]; -- hclen) ;
+
+    /* Cost of each coding in bits */
+    dynamic = 3 + 5 + 5 + 4 + 3 * hclen + extrabits;
+    fixed = 3 + extrabits;
+    for (i = 0; i < numruns; ++ i)
+    {
+        dynamic += cllen[runs[i]];
+        dynamic += 16 == runs[i] ? 2 : 17 == runs[i] ? 3 :
+                   18 == runs[i] ? 7 : 0;
+    }
+    for (i = 0; i < LITLENCODES; ++ i)
+    {
+        dynamic += (unsigned long long) litfreq[i] * litlen[i];
+        fixed += (unsigned long long) litfreq[i] *
+                 (i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+    }
+    for (i = 0; i < DISTANCECODES; ++ i)
+    {
+        dynamic += (unsigned long long) distfreq[i] * distlen[i];
+        fixed += (unsigned long long) distfreq[i] * 5;
+    }
+    pieces = rawlength ? (rawlength + 65534) / 65535 : 1;
+    stored = pieces * (3 + 7 + 32) + 8 * (unsigned long long) rawlength;
+
+    cost = dynamic < fixed ? dynamic : fixed;
+    if (stored < cost) cost = stored;
+    if (reserve(s, cost / 8 + 16) != 0) return -1;
+
+    if (stored == cost)
+    {
+        do
+        {
+            size_t piece = rawlength < 65535 ? rawlength : 65535;
+
+            putbits(s, final && piece == rawlength, 1);
+            putbits(s, 0, 2);
+            alignbits(s);
+            s->data[s->length ++] = piece & 0xff;
+            s->data[s->length ++] = piece >> 8;
+            s->data[s->length ++] = ~piece & 0xff;
+            s->data[s->length ++] = (~piece >> 8) & 0xff;
+            memcpy(s->data + s->length, raw, piece);
+            s->length += piece;
+            raw += piece;
+            rawlength -= piece;
+        }
+        while (rawlength);
+        return 0;
+    }
+
+    if (dynamic == cost)
+    {
+        putbits(s, final, 1);
+        putbits(s, 2, 2);
+        putbits(s, hlit - 257, 5);
+        putbits(s, hdist - 1, 5);
+        putbits(s, hclen - 4, 4);
+        for (i = 0; i < hclen; ++ i)
+        {
+            putbits(s, cllen[codelengthorder[i]], 3);
+        }
+        buildcodes(cllen, CODELENGTHCODES, clcode);
+        for (i = 0; i < numruns; ++ i)
+        {
+            putbits(s, clcode[runs[i]], cllen[runs[i]]);
+            if (runs[i] >= 16)
+            {
+                putbits(s, runextra[i], 16 == runs[i] ? 2 :
+                                        17 == runs[i] ? 3 : 7);
+            }
+        }
+    }
+    else
+    {
+        putbits(s, final, 1);
+        putbits(s, 1, 2);
+        for (i = 0; i < 288; ++ i)
+        {
+            litlen[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        }
+        for (i = 0; i < DISTANCECODES; ++ i) distlen[i] = 5;
+    }
+    buildcodes(litlen, 288, litcode);
+    buildcodes(distlen, DISTANCECODES, distcode);
+
+    /* The data */
+    for (i = 0; i < count; ++ i)
+    {
+        unsigned length = tokens[i].length, distance = tokens[i].distance;
+
+        if (distance)
+        {
+            int lc = lengthcode[length - MINMATCH];
+            int dc = distance <= 256 ? distancecode[distance - 1]
+                                     : distancecode[256 +
+                                                    ((distance - 1) >> 7)];
+
+            putbits(s, litcode[257 + lc], litlen[257 + lc]);
+            putbits(s, length - lengthbase[lc], lengthextra[lc]);
+            putbits(s, distcode[dc], distlen[dc]);
+            putbits(s, distance - distancebase[dc], distanceextra[dc]);
+        }
+        else
+        {
+            putbits(s, litcode[length], litlen[length]);
+        }
+    }
+    putbits(s, litcode[ENDOFBLOCK], litlen[ENDOFBLOCK]);
+    return 0;
+}
+
+/*
+ * Describe a list of code lengths with the code length alphabet: 16
+ * repeats the previous length 3 to 6 times, 17 and 18 give 3 to 10 and
+ * 11 to 138 zeros. Returns the number of symbols, with the values of
+ * their extra bits in extra.
+ */
+static int runlengths(const unsigned char *lengths, int count,
+                      unsigned char *runs, unsigned char *extra)
+{
+    int i = 0, n = 0;
+
+    while (i < count)
+    {
+        int length = lengths[i], run = 1;
+
+        while (i + run < count && lengths[i + run] == length) ++ run;
+        i += run;
+
+        if (0 == length)
+        {
+            while (run >= 11)
+            {
+                int chunk = run < 138 ? run : 138;
+
+                runs[n] = 18;
+                extra[n ++] = chunk - 11;
+                run -= chunk;
+            }
+            if (run >= 3)
+            {
+                runs[n] = 17;
+                extra[n ++] = run - 3;
+                run = 0;
+            }
+        }
+        else
+        {
+            runs[n] = length;
+            extra[n ++] = 0;
+            -- run;
+            while (run >= 3)
+            {
+                int chunk = run < 6 ? run : 6;
+
+                runs[n] = 16;
+                extra[n ++] = chunk - 3;
+                run -= chunk;
+            }
+        }
+        while (run --)
+        {
+            runs[n] = length;
+            extra[n ++] = 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * Work out the code lengths of a length-limited Huffman code for the
+ * given frequencies. At least two symbols get a code, so that the code
+ * is complete as inflaters expect.
+ */
+static void buildlengths(const unsigned long *frequencies, int count,
+                         int maxbits, unsigned char *lengths)
+{
+    struct symbol symbols[LITLENCODES];
+    unsigned long depth[LITLENCODES];
+    int perlength[MAXBITS + 2];
+    int i, used = 0, root, leaf, next, available, depthnow, atdepth;
+    unsigned long total;
+
+    for (i = 0; i < count; ++ i)
+    {
+        lengths[i] = 0;
+        if (frequencies[i])
+        {
+            symbols[used].frequency = frequencies[i];
+            symbols[used ++].value = i;
+        }
+    }
+    for (i = 0; used < 2; ++ i)
+    {
+        if (!frequencies[i])
+        {
+            symbols[used].frequency = 1;
+            symbols[used ++].value = i;
+        }
+    }
+    qsort(symbols, used, sizeof symbols[0], comparesymbols);
+
+    /*
+     * Code lengths in place, after Moffat and Katajainen: the first pass
+     * builds the tree with parent pointers, the second turns them into
+     * depths of internal nodes and the third into depths of the leaves,
+     * longest first.
+     */
+    for (i = 0; i < used; ++ i) depth[i] = symbols[i].frequency;
+    depth[0] += depth[1];
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < used - 1; ++ next)
+    {
+        if (leaf >= used || depth[root] < depth[leaf])
+        {
+            depth[next] = depth[root];
+            depth[root ++] = next;
+        }
+        else
+        {
+            depth[next] = depth[leaf ++];
+        }
+        if (leaf >= used || (root < next && depth[root] < depth[leaf]))
+        {
+            depth[next] += depth[root];
+            depth[root ++] = next;
+        }
+        else
+        {
+            depth[next] += depth[leaf ++];
+        }
+    }
+    depth[used - 2] = 0;
+    for (next = used - 3; next >= 0; -- next)
+    {
+        depth[next] = depth[depth[next]] + 1;
+    }
+    available = 1;
+    atdepth = depthnow = 0;
+    root = used - 2;
+    next = used - 1;
+    while (available > 0)
+    {
+        while (root >= 0 && (int) depth[root] == depthnow)
+        {
+            ++ atdepth;
+            -- root;
+        }
+        while (available > atdepth)
+        {
+            depth[next --] = depthnow;
+            -- available;
+        }
+        available = 2 * atdepth;
+        ++ depthnow;
+        atdepth = 0;
+    }
+
+    /* Move codes that are too long up, then fix the Kraft sum */
+    memset(perlength, 0, sizeof perlength);
+    for (i = 0; i < used; ++ i)
+    {
+        unsigned long length = depth[i];
+
+        if (length > (unsigned long) maxbits) length = maxbits;
+        ++ perlength[length];
+    }
+    total = 0;
+    for (i = 1; i <= maxbits; ++ i)
+    {
+        total += (unsigned long) perlength[i] << (maxbits - i);
+    }
+    while (total > 1UL << maxbits)
+    {
+        -- perlength[maxbits];
+        for (i = maxbits - 1; i > 0; -- i)
+        {
+            if (perlength[i])
+            {
+                -- perlength[i];
+                perlength[i + 1] += 2;
+                break;
+            }
+        }
+        -- total;
+    }
+
+    /* The most frequent symbols get the shortest codes */
+    next = used - 1;
+    for (i = 1; i <= maxbits; ++ i)
+    {
+        while (perlength[i] --)
+        {
+            lengths[symbols[next --].value] = i;
+        }
+    }
+}
+
+/* Canonical codes for a set of lengths, bit reversed for writing */
+static void buildcodes(const unsigned char *lengths, int count,
+                       unsigned short *codes)
+{
+    unsigned short perlength[MAXBITS + 1], next[MAXBITS + 1];
+    unsigned code = 0;
+    int i, bits;
+
+    memset(perlength, 0, sizeof perlength);
+    for (i = 0; i < count; ++ i) ++ perlength[lengths[i]];
+    perlength[0] = 0;
+    for (bits = 1; bits <= MAXBITS; ++ bits)
+    {
+        code = (code + perlength[bits - 1]) << 1;
+        next[bits] = code;
+    }
+    for (i = 0; i < count; ++ i)
+    {
+        unsigned value, reversed = 0;
+
+        if (!lengths[i]) continue;
+        value = next[lengths[i]] ++;
+        for (bits = 0; bits < lengths[i]; ++ bits)
+        {
+            reversed = reversed << 1 | (value & 1);
+            value >>= 1;
+        }
+        codes[i] = reversed;
+    }
+}
+
+/* Least frequent first; ties by value, so the output is deterministic */
+static int comparesymbols(const void *a, const void *b)
+{
+    const struct symbol *x = a, *y = b;
+
+    if (x->frequency != y->frequency)
+    {
+        return x->frequency < y->frequency ? -1 : 1;
+    }
+    return x->value - y->value;
+}
+
+/* Make room for size more bytes, plus any bits still held */
+static int reserve(struct deflatestream *s, size_t size)
+{
+    size_t needed = s->length + size + 8;
+
+    if (s->failed) return -1;
+    if (needed > s->allocated)
+    {
+        size_t allocated = s->allocated ? s->allocated : 4096;
+        unsigned char *data;
+
+        while (allocated < needed) allocated *= 2;
+        data = realloc(s->data, allocated);
+        if (!data)
+        {
+            s->failed = 1;
+            return -1;
+        }
+        s->data = data;
+        s->allocated = allocated;
+    }
+    return 0;
+}
+
+/* Add bits, least significant first; room must have been reserved */
+static void putbits(struct deflatestream *s, unsigned value, int count)
+{
+    s->bits |= (unsigned long long) value << s->count;
+    s->count += count;
+    if (s->count >= 32)
+    {
+        s->data[s->length ++] = s->bits & 0xff;
+        s->data[s->length ++] = (s->bits >> 8) & 0xff;
+        s->data[s->length ++] = (s->bits >> 16) & 0xff;
+        s->data[s->length ++] = (s->bits >> 24) & 0xff;
+        s->bits >>= 32;
+        s->count -= 32;
+    }
+}
+
+/* Write out the bits held, padding to a byte boundary */
+static void alignbits(struct deflatestream *s)
+{
+    while (s->count > 0)
+    {
+        s->data[s->length ++] = s->bits & 0xff;
+        s->bits >>= 8;
+        s->count -= 8;
+    }
+    s->bits = 0;
+    s->count = 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * font2pbm
+ * Deflate encoder for PNG output.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <stddef.h>
+
+/*
+ * A small deflate (RFC 1951) encoder, enough for bitmaps. The fast level
+ * only looks for runs of the same byte and for repeats of the previous
+ * scanline, which is most of what a font sheet contains. The best level
+ * searches hash chains with lazy matching. Both pick dynamic, fixed or
+ * stored coding for each block, whichever is smallest.
+ */
+#define DEFLATE_FAST 0
+#define DEFLATE_BEST 1
+
+/* Compressed data, in a buffer that grows as needed */
+struct deflatestream
+{
+    unsigned char *data;
+    size_t length, allocated;
+    unsigned long long bits;    /* Not yet written, least significant first */
+    int count;                  /* Number of bits in bits */
+    int failed;                 /* Out of memory */
+};
+
+/* Set up an empty stream */
+void initdeflate(struct deflatestream *);
+
+/* Release the buffer of a stream */
+void freedeflate(struct deflatestream *);
+
+/* Add bytes to a stream, such as a zlib header. Returns 0 or -1 */
+int deflateraw(struct deflatestream *, const void *, size_t);
+
+/*
+ * Compress size bytes of data into the stream. Matches may reach back
+ * into the dictsize bytes before data, which must be readable. rowlength
+ * is the length of a scanline for the fast level, or 0. The last chunk
+ * of a stream ends with the final block; any other ends with a sync
+ * flush, an empty stored block, so that chunks compressed separately
+ * can be joined. Either way the chunk ends on a byte boundary. Returns
+ * 0, or -1 if out of memory.
+ */
+int deflatechunk(struct deflatestream *, const unsigned char *data,
+                 size_t dictsize, size_t size, int level, size_t rowlength,
+                 int last);
+
+/* Running Adler-32 checksum, starting from 1 */
+unsigned long adler32(unsigned long, const unsigned char *, size_t);
+
+/*
+ * Checksum of two pieces of data joined, from the checksums of each and
+ * the length of the second
+ */
+unsigned long adler32combine(unsigned long, unsigned long, size_t);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * font2pbm
+ * Detection of the size mode and character count of a font file.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stddef.h>
+#include "font2pbm.h"
+
+/*
+ * The idea: strokes in a glyph are continuous, so in a real multi-cell
+ * font the pixels along the seam between two cells of a character agree
+ * about as often as neighbouring pixels inside a cell do. Pairing cells
+ * that do not belong together (because the layout guess is wrong) gives
+ * seams that agree much less often. Agreement is measured as the number
+ * of pixel pairs that are both set over the number where either is set.
+ */
+
+/* Agreement counters */
+struct agree
+{
+    unsigned long both, either;
+};
+
+/* A doubled dimension must join at least this well to beat a single one */
+#define SINGLE 0.6
+
+/*
+ * Neighbouring pixels in random data with a fraction p of them set agree
+ * p / (2 - p) of the time. Glyphs are made of strokes, so in a font they
+ * agree more often than that by at least this factor.
+ */
+#define NOISE 1.15
+
+static int popcount8(unsigned char v)
+{
+    return __builtin_popcount(v);
+}
+
+/* Neighbouring pixels inside the first cells cells of the font */
+static void internal(const unsigned char *data, size_t cells,
+                     struct agree *horizontal, struct agree *vertical)
+{
+    size_t i;
+    int line;
+
+    for (i = 0; i < cells; ++ i)
+    {
+        const unsigned char *cell = data + i * 8;
+
+        for (line = 0; line < 8; ++ line)
+        {
+            unsigned char v = cell[line];
+
+            horizontal->both += popcount8(v & (v >> 1) & 0x7f);
+            horizontal->either += popcount8((v | (v >> 1)) & 0x7f);
+            if (line < 7)
+            {
+                vertical->both += popcount8(v & cell[line + 1]);
+                vertical->either += popcount8(v | cell[line + 1]);
+            }
+        }
+    }
+}
+
+/* Right edge of cell a against left edge of cell b */
+static void seamh(const unsigned char *a, const unsigned char *b,
+                  struct agree *agree)
+{
+    int line;
+
+    for (line = 0; line < 8; ++ line)
+    {
+        int left = a[line] & 1, right = b[line] >> 7;
+
+        agree->both += left & right;
+        agree->either += left | right;
+    }
+}
+
+/* Bottom row of cell a against top row of cell b */
+static void seamv(const unsigned char *a, const unsigned char *b,
+                  struct agree *agree)
+{
+    agree->both += popcount8(a[7] & b[0]);
+    agree->either += popcount8(a[7] | b[0]);
+}
+
+static double ratio(const struct agree *seam, const struct agree *inside)
+{
+    double in, across;
+
+    if (!seam->either || !inside->either || !inside->both) return 0;
+    in = (double) inside->both / inside->either;
+    across = (double) seam->both / seam->either;
+    return across / in > 1 ? 1 : across / in;
+}
+
+/* Score one candidate layout; higher is more likely */
+static double score(const unsigned char *data, int x, int y, int n,
+                    double prior)
+{
+    struct agree inh = { 0, 0 }, inv = { 0, 0 };
+    struct agree seamx = { 0, 0 }, seamy = { 0, 0 };
+    double result = prior;
+    int i, c, blank = 1;
+
+    internal(data, (size_t) n * x * y, &inh, &inv);
+    for (i = 0; i < n; ++ i)
+    {
+        for (c = 0; x == 2 && c < y; ++ c)
+        {
+            seamh(data + (i + c * n * x) * 8,
+                  data + (i + n + c * n * x) * 8, &seamx);
+        }
+        for (c = 0; y == 2 && c < x; ++ c)
+        {
+            seamv(data + (i + c * n) * 8,
+                  data + (i + c * n + n * x) * 8, &seamy);
+        }
+    }
+
+    result *= 2 == x ? ratio(&seamx, &inh) : SINGLE;
+    result *= 2 == y ? ratio(&seamy, &inv) : SINGLE;
+
+    /* Screen code 32 is a space in every C64 charset */
+    if (n > 32)
+    {
+        for (c = 0; c < x * y && blank; ++ c)
+        {
+            const unsigned char *cell = data + (32 + c * n) * 8;
+            for (i = 0; i < 8; ++ i)
+            {
+                if (cell[i]) blank = 0;
+            }
+        }
+        if (blank) result *= 1.1;
+    }
+    return result;
+}
+
+int detectfont(const char *file, size_t length, struct detection *result)
+{
+    if (length < 2) return -1;
+    return detectdata(file + 2, length - 2,
+                      (unsigned char) file[0] |
+                      ((unsigned char) file[1] << 8), result);
+}
+
+int detectdata(const char *font, size_t datalength, unsigned loadaddress,
+               struct detection *result)
+{
+    static const int common[3] = { 64, 128, 256 };
+    const unsigned char *data = (const unsigned char *) font;
+    struct agree horizontal = { 0, 0 }, vertical = { 0, 0 };
+    double best = 0, total = 0, density;
+    unsigned long set = 0;
+    size_t cells = datalength / 8, j;
+    int x, y, i;
+
+    if (datalength < 8) return -1;
+
+    result->x = result->y = 1;
+    result->numchars = 0;
+    result->loadaddress = loadaddress;
+    result->confidence = 0;
+
+    /* Blank data and noise are no font in any layout */
+    internal(data, cells, &horizontal, &vertical);
+    for (j = 0; j < cells * 8; ++ j) set += popcount8(data[j]);
+    density = (double) set / (cells * 64);
+    if (!set || horizontal.both + vertical.both <
+                NOISE * density / (2 - density) *
+                (horizontal.either + vertical.either))
+    {
+        return -1;
+    }
+
+    for (x = 1; x <= 2; ++ x)
+    {
+        for (y = 1; y <= 2; ++ y)
+        {
+            size_t charsize = (size_t) 8 * x * y;
+
+            /* The whole file, favouring the usual character counts */
+            if (0 == datalength % charsize && datalength / charsize <= 65536)
+            {
+                int n = (int) (datalength / charsize);
+                double prior = 0.8, s;
+
+                for (i = 0; i < 3; ++ i)
+                {
+                    if (common[i] == n) prior = 1;
+                }
+                s = score(data, x, y, n, prior);
+                total += s;
+                if (s > best)
+                {
+                    best = s;
+                    result->x = x;
+                    result->y = y;
+                    result->numchars = n;
+                }
+            }
+
+            /*
+             * Otherwise a common size followed by something else, the
+             * more of the file it covers the better
+             */
+            for (i = 0; i < 3 && datalength % charsize; ++ i)
+            {
+                double s;
+
+                if ((size_t) common[i] * charsize >= datalength) continue;
+                s = score(data, x, y, common[i],
+                          0.3 * common[i] * charsize / datalength);
+                total += s;
+                if (s > best)
+                {
+                    best = s;
+                    result->x = x;
+                    result->y = y;
+                    result->numchars = common[i];
+                }
+            }
+        }
+    }
+
+    /*
+     * No layout fits the length, or none looks anything like glyphs, so
+     * there is nothing to be confident about
+     */
+    if (!result->numchars) return -1;
+
+    /*
+     * Charsets live on 2K boundaries for the VIC-II, so other load
+     * addresses make it less likely that this is a font at all.
+     */
+    result->confidence = total > 0 ? best / total : 0;
+    if (result->loadaddress & 0x7ff)
+    {
+        result->confidence *= 0.8;
+    }
+    return 0;
+}
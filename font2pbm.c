@@ -21,193 +21,2376 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <limits.h>
+#include "convert.h"
+#include "arena.h"
+#include "input.h"
+#include "archive.h"
+#include "stats.h"
+#include "pool.h"
+#include "server.h"
+#include "cache.h"
 
-/* Holder structure for a portable bitmap */
-struct pbm
+/* Long options without a short equivalent */
+enum
 {
-    int x, y;
-    char *data;
+    OPT_STATS = 256,
+    OPT_CACHE,
+    OPT_CACHESIZE,
+    OPT_HFLIP,
+    OPT_VFLIP,
+    OPT_ROTATE,
+    OPT_INVERT,
+    OPT_SHIFT,
+    OPT_PERROW,
+    OPT_PADDING,
+    OPT_COLUMNMAJOR,
+    OPT_CELLHEIGHT,
+    OPT_CELLBYTES,
+    OPT_FORMAT,
+    OPT_COMPRESSION,
+    OPT_SCANSTEP,
+    OPT_HITS,
+    OPT_NAME
 };
 
-char *readfile(FILE *, int);
-struct pbm createpbm(int, int, const char *, int chars);
-void printpbm(struct pbm);
+/* Initial size of the per-worker arenas, enough for any 2x2 font */
+#define ARENASIZE 65536
 
-int main(int argc, char *argv[])
+/* Most charsets looked for in one file when scanning */
+#define MAXHITS 100
+
+/* Output names for manifest entries unless given */
+#define DEFAULTNAME "%f-%o"
+
+/*
+ * How to convert each font, from the command line: transforms applied in
+ * the order given, then the layout and format of the image.
+ */
+#define MAXTRANSFORMS 32
+struct conversion
+{
+    struct transform transforms[MAXTRANSFORMS];
+    int numtransforms;
+    struct layout layout;
+    enum format format;
+};
+
+/* One file to convert in batch mode */
+struct job
 {
+    char *filename;
     int xsize, ysize, chars;
-    FILE *file;
-    char *data;
-    struct pbm pbm;
+    int failed;
+    char error[256];
+
+    /* Font data at an offset into a source, for manifest entries */
+    int source;
+    size_t offset;
+    int line;
+
+    /* A file in an image opened by addfile(), shared by its files */
+    struct archive *archive;
+    struct archivefile member;
+    int ownsarchive;            /* Closed with this job */
+
+    char *outname;              /* Set by nameoutputs() */
+};
+
+/* A file listed in a manifest, opened once for all its entries */
+struct source
+{
+    struct input input;
+    int error;                  /* errno if it couldn't be opened */
+};
+
+/* Shared state for the batch worker threads */
+struct batch
+{
+    const char *outdir;
+    struct job *jobs;
+    struct stats *stats;
+    struct arena *arenas;
+    struct output *outputs;
+    struct cache *cache;
+    const struct conversion *conversion;
+    struct source *sources;     /* For manifests */
+    const char *nametemplate;
+};
+
+/* Shared state for the scan worker threads */
+struct scan
+{
+    const char *outdir;
+    struct job *jobs;
+    struct scanhit *hits;       /* maxhits for each job */
+    int *found;
+    unsigned *loadaddresses;
+    int maxhits;
+    size_t step;
+    struct stats *stats;
+    struct arena *arenas;
+    const struct conversion *conversion;
+};
+
+int convertfile(const char *, FILE *, int, int, int,
+                const struct conversion *, struct stats *,
+                struct cache *, char *, size_t);
+int writefont(const char *, FILE *, int, int, int,
+              const struct conversion *, struct stats *, struct cache *);
+int convertimage(const char *, struct output *, int, int, int,
+                 const struct conversion *, struct stats *, struct cache *);
+int collectjobs(char **, int, int, int, int, const struct layout *,
+                struct job **, int *);
+void freejobs(struct job *, int);
+int batch(const char *, const char *, char **, int, int, int, int, int,
+          const struct conversion *, struct stats *, struct cache *);
+int manifest(const char *, const char *, const char *, const char *, int,
+             const struct conversion *, struct stats *, struct cache *);
+int runbatch(const char *, struct batch *, int, int, struct stats *,
+             unsigned long long);
+int readmanifest(const char *, const char *, struct job **, int *);
+int comparejobs(const void *, const void *);
+char *lastword(char *);
+int checktemplate(const char *);
+int contactsheet(const char *, char **, int, int, int, int, int,
+                 const struct conversion *, struct stats *);
+int detectfiles(const char *, char **, int);
+int scanfiles(const char *, const char *, char **, int, size_t, int, int,
+              const struct conversion *, struct stats *);
+int detectinput(const struct input *, int *, int *, int *);
+int parsesize(const char *, int *, int *);
+int parsebytes(const char *, unsigned long long *);
+int parseoffset(const char *, unsigned long long *);
+int addtransform(struct conversion *, int, const char *);
+int addfile(struct job **, int *, int *, const char *, int, int, int,
+            const struct layout *);
+int addjob(struct job **, int *, int *, const char *, int, int, int);
+int openjob(struct input *, const struct job *, struct arena *);
+void batchtask(void *, int, int);
+void manifesttask(void *, int, int);
+void writejob(struct batch *, int, struct job *, const char *, size_t,
+              const char *, unsigned long long);
+void scantask(void *, int, int);
+int writehit(const struct scan *, struct arena *, struct job *,
+             const char *, size_t, struct stats *);
+int nameoutputs(struct job *, int, const char *, const char *,
+                enum format);
+int compareoutnames(const void *, const void *);
+int findoutname(const void *, const void *);
+char *outputname(struct arena *, const char *, const char *, enum format);
+char *templatename(struct arena *, const char *, const char *,
+                   const struct job *, enum format);
+size_t namestem(char *, const char *);
+
+int main(int argc, char *argv[])
+{
+    static const struct option longopts[] =
+    {
+        { "stats", no_argument, NULL, OPT_STATS },
+        { "cache", required_argument, NULL, OPT_CACHE },
+        { "cache-size", required_argument, NULL, OPT_CACHESIZE },
+        { "hflip", no_argument, NULL, OPT_HFLIP },
+        { "vflip", no_argument, NULL, OPT_VFLIP },
+        { "rotate", required_argument, NULL, OPT_ROTATE },
+        { "invert", no_argument, NULL, OPT_INVERT },
+        { "shift", required_argument, NULL, OPT_SHIFT },
+        { "per-row", required_argument, NULL, OPT_PERROW },
+        { "padding", required_argument, NULL, OPT_PADDING },
+        { "column-major", no_argument, NULL, OPT_COLUMNMAJOR },
+        { "cell-height", required_argument, NULL, OPT_CELLHEIGHT },
+        { "cell-bytes", required_argument, NULL, OPT_CELLBYTES },
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "compression", required_argument, NULL, OPT_COMPRESSION },
+        { "scan-step", required_argument, NULL, OPT_SCANSTEP },
+        { "hits", required_argument, NULL, OPT_HITS },
+        { "name", required_argument, NULL, OPT_NAME },
+        { NULL, 0, NULL, 0 }
+    };
+    int xsize = 0, ysize = 0, chars = 0, opt, threads = 1, contact = 0;
+    int wantstats = 0, autodetect = 0, detectonly = 0, params, numfiles, rc;
+    int png = 0, fast = 0, scan = 0, maxhits = 3;
+    unsigned long scanstep = 1;
+    const char *outdir = NULL, *socketpath = NULL, *cachedir = NULL;
+    const char *manifestpath = NULL, *nametemplate = DEFAULTNAME;
+    unsigned long long cachesize = CACHEDEFAULTSIZE;
+    struct cache cache;
+    struct conversion conversion;
+    char **files;
+    unsigned long long start = nanotime();
+    struct stats stats;
+    char error[256];
+
+    /* Options */
+    memset(&conversion, 0, sizeof conversion);
+    while ((opt = getopt_long(argc, argv, "o:j:m:cadsS:", longopts,
+                              NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case OPT_STATS:
+                wantstats = 1;
+                break;
+
+            case OPT_CACHE:
+                cachedir = optarg;
+                break;
+
+            case OPT_CACHESIZE:
+                if (parsebytes(optarg, &cachesize) != 0)
+                {
+                    fprintf(stderr, "%s: Illegal cache size \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_HFLIP:
+            case OPT_VFLIP:
+            case OPT_ROTATE:
+            case OPT_INVERT:
+            case OPT_SHIFT:
+                if (MAXTRANSFORMS == conversion.numtransforms)
+                {
+                    fprintf(stderr, "%s: Too many transforms\n", argv[0]);
+                    return 1;
+                }
+                if (addtransform(&conversion, opt, optarg) != 0)
+                {
+                    fprintf(stderr, "%s: Illegal %s \"%s\"\n", argv[0],
+                            OPT_ROTATE == opt ? "rotation" : "shift", optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_PERROW:
+                if (sscanf(optarg, "%d", &conversion.layout.perrow) != 1 ||
+                    conversion.layout.perrow < 1 ||
+                    conversion.layout.perrow > LAYOUT_MAXPERROW)
+                {
+                    fprintf(stderr, "%s: Illegal characters per row \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_PADDING:
+                if (sscanf(optarg, "%d", &conversion.layout.padding) != 1 ||
+                    conversion.layout.padding < 0 ||
+                    conversion.layout.padding > LAYOUT_MAXPADDING)
+                {
+                    fprintf(stderr, "%s: Illegal padding \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_COLUMNMAJOR:
+                conversion.layout.columnmajor = 1;
+                break;
+
+            case OPT_CELLHEIGHT:
+                if (sscanf(optarg, "%d", &conversion.layout.cellheight) != 1 ||
+                    conversion.layout.cellheight < 1 ||
+                    conversion.layout.cellheight > LAYOUT_MAXCELLHEIGHT)
+                {
+                    fprintf(stderr, "%s: Illegal cell height \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_CELLBYTES:
+                if (sscanf(optarg, "%d", &conversion.layout.cellbytes) != 1 ||
+                    conversion.layout.cellbytes < 1 ||
+                    conversion.layout.cellbytes > LAYOUT_MAXCELLBYTES)
+                {
+                    fprintf(stderr, "%s: Illegal cell size \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_FORMAT:
+                if (strcmp(optarg, "pbm") != 0 && strcmp(optarg, "png") != 0)
+                {
+                    fprintf(stderr, "%s: Illegal format \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                png = 0 == strcmp(optarg, "png");
+                break;
+
+            case OPT_COMPRESSION:
+                if (strcmp(optarg, "fast") != 0 && strcmp(optarg, "best") != 0)
+                {
+                    fprintf(stderr, "%s: Illegal compression \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                fast = 0 == strcmp(optarg, "fast");
+                break;
+
+            case OPT_SCANSTEP:
+                if (sscanf(optarg, "%lu", &scanstep) != 1 || !scanstep)
+                {
+                    fprintf(stderr, "%s: Illegal scan step \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_HITS:
+                if (sscanf(optarg, "%d", &maxhits) != 1 || maxhits < 1 ||
+                    maxhits > MAXHITS)
+                {
+                    fprintf(stderr, "%s: Illegal number of hits \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                break;
+
+            case OPT_NAME:
+                if (checktemplate(optarg) != 0)
+                {
+                    fprintf(stderr, "%s: Illegal name template \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                nametemplate = optarg;
+                break;
+
+            case 'o':
+                outdir = optarg;
+                break;
+
+            case 'm':
+                manifestpath = optarg;
+                break;
+
+            case 'S':
+                socketpath = optarg;
+                break;
+
+            case 'c':
+                contact = 1;
+                break;
+
+            case 'a':
+                autodetect = 1;
+                break;
+
+            case 'd':
+                detectonly = 1;
+                break;
+
+            case 's':
+                scan = 1;
+                break;
+
+            case 'j':
+                if (sscanf(optarg, "%d", &threads) != 1 || threads < 0)
+                {
+                    fprintf(stderr, "%s: Illegal number of threads \"%s\"\n",
+                            argv[0], optarg);
+                    return 1;
+                }
+                if (0 == threads) threads = numcpus();
+                break;
+
+            default:
+                return 1;
+        }
+    }
+
+    conversion.format = !png ? FORMAT_PBM : fast ? FORMAT_PNGFAST : FORMAT_PNG;
+
+    /* Size and count are positional unless they are to be detected */
+    params = autodetect || detectonly || scan || socketpath ||
+             manifestpath ? 0 : 2;
+    files = argv + optind + params;
+    numfiles = argc - optind - params;
 
     /* Help screen */
-    if (argc < 3 || argc > 5)
+    if (numfiles < 0 || (outdir && contact) ||
+        (detectonly && (outdir || contact || autodetect)) ||
+        (scan && (contact || autodetect || detectonly)) ||
+        (socketpath && (outdir || contact || autodetect || detectonly ||
+                        scan || numfiles)) ||
+        (manifestpath && (!outdir || autodetect || detectonly || scan ||
+                          socketpath || numfiles)) ||
+        (!outdir && !contact && !detectonly && !scan && numfiles > 1))
     {
-        printf("Usage: %s size num [filename]\n\n"
+        printf("Usage: %s [-o dir | -c] [-j N] [options] size num "
+               "[filename...]\n"
+               "       %s [-o dir | -c] [-j N] [options] -a [filename...]\n"
+               "       %s -d [filename...]\n"
+               "       %s -s [-o dir] [-j N] [options] [filename...]\n"
+               "       %s -m manifest -o dir [-j N] [options]\n"
+               "       %s -S socket [-j N] [options]\n\n"
+               "  -o dir:    Batch mode, write one PBM per input file to dir.\n"
+               "             File names are read from stdin if none given,\n"
+               "             as \"[size num] filename\" per line. Files\n"
+               "             that would get the same output name have\n"
+               "             -2, -3 and so on added after the first\n"
+               "  -c:        Contact sheet, stack all input files into one\n"
+               "             PBM on stdout. File names as for -o\n"
+               "  -j N:      Number of threads in batch mode and for PNG\n"
+               "             contact sheets, 0 for all cores\n"
+               "  --stats:   Print timings and counters to stderr as JSON\n"
+               "  --cache dir:\n"
+               "             Keep converted fonts in dir and reuse them\n"
+               "             when the same font is converted again. Not\n"
+               "             used for contact sheets and scans\n"
+               "  --cache-size N:\n"
+               "             Limit the cache to N bytes, with an optional\n"
+               "             k, M or G suffix. Default 64M\n"
+               "  --hflip, --vflip:\n"
+               "             Mirror every character left to right or top\n"
+               "             to bottom\n"
+               "  --rotate D:\n"
+               "             Rotate every character D degrees clockwise,\n"
+               "             90, 180 or 270. 1x2 and 2x1 characters swap\n"
+               "             shape\n"
+               "  --invert:  Invert every character\n"
+               "  --shift X,Y:\n"
+               "             Move every character X pixels right and Y\n"
+               "             down, -7 to 7, negative for left and up\n"
+               "             The transforms are applied in the order given\n"
+               "  --per-row N:\n"
+               "             Characters per row of the image, 1 to 256.\n"
+               "             The default fills 256 pixels\n"
+               "  --padding N:\n"
+               "             Blank pixels between characters, up to 64\n"
+               "  --column-major:\n"
+               "             Fill the image a column at a time\n"
+               "  --cell-height N:\n"
+               "             Scanlines per 8 pixel wide cell, 1 to 32.\n"
+               "             Default 8, 16 for C128 VDC 8x16 fonts\n"
+               "  --cell-bytes N:\n"
+               "             Bytes per cell in the font data, from the\n"
+               "             cell height to 32. Default the cell height,\n"
+               "             16 for C128 VDC 8x8 fonts\n"
+               "  --format F:\n"
+               "             Write pbm (the default) or png files. PNG\n"
+               "             files are 1-bit grayscale\n"
+               "  --compression C:\n"
+               "             PNG compression, fast (runs and repeated\n"
+               "             scanlines only) or best (the default)\n"
+               "  -a:        Detect size and number of characters for each\n"
+               "             file, instead of giving them\n"
+               "  -d:        Only print the detected size, number of\n"
+               "             characters, load address and confidence\n"
+               "  -s:        Scan programs and memory dumps for 256\n"
+               "             character 1x1 charsets at any offset and\n"
+               "             print where they are, or with -o write each\n"
+               "             one to dir, named after the file and offset\n"
+               "  --scan-step N:\n"
+               "             Only try offsets that load to a multiple of\n"
+               "             N, such as 2048 for where the VIC-II can\n"
+               "             see a charset. Default 1, every offset\n"
+               "  --hits N:  Charsets to find per file, up to 100.\n"
+               "             Default 3\n"
+               "  -m manifest:\n"
+               "             Convert the fonts listed in the manifest, or\n"
+               "             stdin for -, into the -o directory. Each\n"
+               "             line is \"filename offset size num\", the\n"
+               "             offset in decimal, 0x or $ hex counting from\n"
+               "             the start of the file with its load address.\n"
+               "             Each file is opened once for all its fonts\n"
+               "  --name T:  Output file names for -m, with %%f for the\n"
+               "             file name, %%o the offset in hex, %%s the size,\n"
+               "             %%c num, %%n the manifest line and %%%% for %%.\n"
+               "             Slashes become underscores. Default %%f-%%o\n"
+               "  -S socket: Run as a daemon, converting fonts sent to the\n"
+               "             Unix domain socket until interrupted. -j sets\n"
+               "             the number of worker threads, see server.h\n"
+               "             for the protocol. Fonts are converted to PBM\n"
+               "             as they are, without --format, transforms or\n"
+               "             layout options\n"
                "  size:      1x1, 1x2, 2x1 or 2x2\n"
                "  num:       Number of characters in font\n"
-               "  filename:  Name of file to read\n",
-               argv[0]);
+               "  filename:  Name of file to read. IMAGE.D64:NAME reads a\n"
+               "             file from a D64 disk image, with ? and * as\n"
+               "             wildcards; likewise .T64 for tape images and\n"
+               "             .CRT for cartridges, whose chips are named as\n"
+               "             BANK0-8000. With -o, -c and -d, an image on\n"
+               "             its own stands for every font-sized file in it.\n"
+               "             A VICE snapshot of x64 stands for the 2048\n"
+               "             byte charset the VIC-II was showing\n",
+               argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         return 0;
     }
 
-    /* Check parameters */
-    if (sscanf(argv[1], "%dx%d", &xsize, &ysize) != 2 ||
-        xsize < 1 || xsize > 2 ||
-        ysize < 1 || ysize > 2)
+    /* Check parameters; a size of 0 means detect it */
+    if (params && parsesize(argv[optind], &xsize, &ysize) != 0)
     {
         fprintf(stderr, "%s: Illegal size specification \"%s\"\n",
-                argv[0], argv[1]);
+                argv[0], argv[optind]);
         return 1;
     }
 
-    if (sscanf(argv[2], "%d", &chars) != 1)
+    if (params && sscanf(argv[optind + 1], "%d", &chars) != 1)
     {
         fprintf(stderr, "%s: Illegal number of chars \"%s\"\n",
-                argv[0], argv[2]);
+                argv[0], argv[optind + 1]);
         return 1;
     }
 
-    if (4 == argc)
+    /* Cells other than 8x8 must hold their scanlines and be given */
+    if (conversion.layout.cellheight || conversion.layout.cellbytes)
     {
-        file = fopen(argv[3], "rb");
-        if (!file)
+        if (!layoutwidth(1, &conversion.layout))
         {
-            fprintf(stderr, "%s: Can't open \"%s\": %s\n",
-                    argv[0], argv[3], strerror(errno));
+            fprintf(stderr, "%s: Cells of %d bytes can't hold %d scanlines\n",
+                    argv[0], conversion.layout.cellbytes,
+                    conversion.layout.cellheight ? conversion.layout.cellheight
+                                                 : 8);
+            return 1;
+        }
+        if (conversion.numtransforms || autodetect || scan)
+        {
+            fprintf(stderr, "%s: %s only work with 8x8 cells\n", argv[0],
+                    autodetect || scan ? "Detected sizes" : "Transforms");
+            return 1;
+        }
+    }
+
+    /* The protocol has no room for conversion options, see server.h */
+    if (socketpath &&
+        (png || conversion.numtransforms || conversion.layout.perrow ||
+         conversion.layout.padding || conversion.layout.columnmajor ||
+         conversion.layout.cellheight || conversion.layout.cellbytes))
+    {
+        fprintf(stderr, "%s: -S only converts to PBM without transforms or "
+                "layout options\n", argv[0]);
+        return 1;
+    }
+
+    /* The cache is used for single files, batches and the daemon */
+    if (cachedir && !detectonly && !contact && !scan)
+    {
+        if (opencache(&cache, cachedir, cachesize) != 0)
+        {
+            fprintf(stderr, "%s: Can't use cache \"%s\": %s\n",
+                    argv[0], cachedir, strerror(errno));
             return 1;
         }
     }
     else
     {
-        file = stdin;
+        cachedir = NULL;
+    }
+
+    memset(&stats, 0, sizeof stats);
+    if (socketpath)
+    {
+        rc = runserver(argv[0], socketpath, threads, &stats,
+                       cachedir ? &cache : NULL);
+    }
+    else if (detectonly)
+    {
+        rc = detectfiles(argv[0], files, numfiles);
+    }
+    else if (scan)
+    {
+        rc = scanfiles(argv[0], outdir, files, numfiles, scanstep, maxhits,
+                       threads, &conversion, &stats);
+    }
+    else if (manifestpath)
+    {
+        rc = manifest(argv[0], outdir, manifestpath, nametemplate, threads,
+                      &conversion, &stats, cachedir ? &cache : NULL);
+    }
+    else if (outdir)
+    {
+        rc = batch(argv[0], outdir, files, numfiles,
+                   xsize, ysize, chars, threads, &conversion, &stats,
+                   cachedir ? &cache : NULL);
+    }
+    else if (contact)
+    {
+        rc = contactsheet(argv[0], files, numfiles, xsize, ysize, chars,
+                          threads, &conversion, wantstats ? &stats : NULL);
+    }
+    else
+    {
+        rc = convertfile(numfiles ? files[0] : NULL,
+                         stdout, xsize, ysize, chars, &conversion,
+                         wantstats ? &stats : NULL,
+                         cachedir ? &cache : NULL, error, sizeof error);
+        if (rc != 0)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0], error);
+        }
+    }
+
+    if (cachedir) closecache(&cache);
+    if (wantstats)
+    {
+        fflush(stdout);
+        printstats(stderr, &stats, nanotime() - start);
     }
+    return rc;
+}
 
-    /* Read data */
-    data = readfile(file, chars * xsize * ysize * 8);
-    if (4 == argc)
+/* Parse a size specification, "1x1", "1x2", "2x1" or "2x2" */
+int parsesize(const char *spec, int *xsize, int *ysize)
+{
+    if (sscanf(spec, "%dx%d", xsize, ysize) != 2 ||
+        *xsize < 1 || *xsize > 2 ||
+        *ysize < 1 || *ysize > 2)
     {
-        fclose(file);
+        return -1;
     }
+    return 0;
+}
 
-    if (!data)
+/*
+ * Parse a byte count with an optional k, M or G suffix. Counts that are
+ * negative or too big to hold are refused rather than wrapped around.
+ */
+int parsebytes(const char *spec, unsigned long long *bytes)
+{
+    char *end;
+    int shifts;
+
+    if (!isdigit((unsigned char) spec[0])) return -1;
+    errno = 0;
+    *bytes = strtoull(spec, &end, 10);
+    if (ERANGE == errno) return -1;
+    switch (*end)
+    {
+        case 'G': case 'g':
+            shifts = 3;
+            break;
+
+        case 'M': case 'm':
+            shifts = 2;
+            break;
+
+        case 'K': case 'k':
+            shifts = 1;
+            break;
+
+        case 0:
+            return 0;
+
+        default:
+            return -1;
+    }
+    if (end[1]) return -1;
+    while (shifts --)
+    {
+        if (*bytes > ULLONG_MAX / 1024) return -1;
+        *bytes *= 1024;
+    }
+    return 0;
+}
+
+/* Parse an offset into a file, in decimal or hex with 0x or $ first */
+int parseoffset(const char *spec, unsigned long long *offset)
+{
+    char *end;
+    int base = 10;
+
+    if ('$' == spec[0])
+    {
+        spec += 1;
+        base = 16;
+    }
+    else if ('0' == spec[0] && ('x' == spec[1] || 'X' == spec[1]))
+    {
+        spec += 2;
+        base = 16;
+    }
+    if (!isxdigit((unsigned char) spec[0])) return -1;
+    errno = 0;
+    *offset = strtoull(spec, &end, base);
+    if (*end || ERANGE == errno || *offset != (size_t) *offset) return -1;
+    return 0;
+}
+
+/*
+ * Add a transform option to the list: a rotation in degrees is made into
+ * quarter turns and a shift is given as "x,y". Returns 0, or -1 if the
+ * argument is invalid or the list is full.
+ */
+int addtransform(struct conversion *conversion, int opt, const char *arg)
+{
+    struct transform transform;
+    int degrees, turns = 1;
+    char extra;
+
+    transform.dx = transform.dy = 0;
+    switch (opt)
+    {
+        case OPT_HFLIP:
+            transform.op = TRANSFORM_HFLIP;
+            break;
+
+        case OPT_VFLIP:
+            transform.op = TRANSFORM_VFLIP;
+            break;
+
+        case OPT_INVERT:
+            transform.op = TRANSFORM_INVERT;
+            break;
+
+        case OPT_ROTATE:
+            if (sscanf(arg, "%d%c", &degrees, &extra) != 1 ||
+                degrees % 90 != 0)
+            {
+                return -1;
+            }
+            transform.op = TRANSFORM_ROTATE;
+            turns = ((degrees / 90) % 4 + 4) % 4;
+            break;
+
+        case OPT_SHIFT:
+            if (sscanf(arg, "%d,%d%c", &transform.dx, &transform.dy,
+                       &extra) != 2 ||
+                transform.dx < -7 || transform.dx > 7 ||
+                transform.dy < -7 || transform.dy > 7)
+            {
+                return -1;
+            }
+            transform.op = TRANSFORM_SHIFT;
+            break;
+
+        default:
+            return -1;
+    }
+
+    while (turns --)
+    {
+        if (MAXTRANSFORMS == conversion->numtransforms) return -1;
+        conversion->transforms[conversion->numtransforms ++] = transform;
+    }
+    return 0;
+}
+
+/*
+ * Convert one font file (or stdin if filename is NULL) and write the
+ * resulting PBM to out, after applying the transforms to every character.
+ * Counters and timings are added to stats if it is not NULL. If a cache
+ * is given the whole PBM is looked up or stored there, otherwise it is
+ * converted and written a band at a time.
+ * Returns 0 on success, or 1 with a description of the problem in error.
+ */
+int convertfile(const char *filename, FILE *out,
+                int xsize, int ysize, int chars,
+                const struct conversion *conversion, struct stats *stats,
+                struct cache *cache, char *error, size_t errlen)
+{
+    struct input input;
+    size_t bytes;
+    const char *data;
+    char *transformed = NULL;
+    unsigned long long start = stats ? nanotime() : 0;
+    int rc;
+
+    if (stats) ++ stats->files;
+
+    /* Map or read data */
+    if (openinput(&input, filename, NULL) != 0)
+    {
+        if (EINVAL == errno)
+        {
+            snprintf(error, errlen, "Invalid input from \"%s\"",
+                     filename ? filename : "stdin");
+        }
+        else
+        {
+            snprintf(error, errlen, "Can't open \"%s\": %s",
+                     filename ? filename : "stdin", strerror(errno));
+        }
+        if (stats) ++ stats->failed;
+        return 1;
+    }
+
+    if (!xsize && detectinput(&input, &xsize, &ysize, &chars) != 0)
     {
-        fprintf(stderr, "%s: Invalid input from \"%s\"\n",
-                argv[0], argv[3]);
+        snprintf(error, errlen, "Can't detect font layout of \"%s\"",
+                 filename ? filename : "stdin");
+        closeinput(&input);
+        if (stats) ++ stats->failed;
         return 1;
     }
 
-    /* Convert to PBM */
-    pbm = createpbm(xsize, ysize, data, chars);
-    if (!pbm.data)
+    bytes = fontdatasize(xsize, ysize, chars, &conversion->layout);
+    if (input.length < bytes)
     {
-        fprintf(stderr, "%s: Out of memroy\n", argv[0]);
+        snprintf(error, errlen, "Invalid input from \"%s\"",
+                 filename ? filename : "stdin");
+        closeinput(&input);
+        if (stats) ++ stats->failed;
         return 1;
     }
 
-    /* Output the image */
-    printpbm(pbm);
+    if (stats)
+    {
+        stats->readns += nanotime() - start;
+        stats->bytesin += 2 + input.length;
+    }
+
+    /* Flip, rotate and so on before the layout, in a copy */
+    data = input.data;
+    if (conversion->numtransforms)
+    {
+        start = stats ? nanotime() : 0;
+        transformed = malloc(bytes ? bytes : 1);
+        if (!transformed)
+        {
+            snprintf(error, errlen, "Out of memroy");
+            closeinput(&input);
+            if (stats) ++ stats->failed;
+            return 1;
+        }
+        transformfont(&xsize, &ysize, input.data, chars,
+                      conversion->transforms, conversion->numtransforms,
+                      transformed);
+        data = transformed;
+        if (stats) stats->convertns += nanotime() - start;
+    }
 
-    /* Clean up */
-    free(data);
-    free(pbm.data);
+    rc = writefont(data, out, xsize, ysize, chars, conversion, stats, cache);
+    closeinput(&input);
+    free(transformed);
+    if (rc != 0)
+    {
+        snprintf(error, errlen, "Can't write output: %s", strerror(errno));
+        if (stats) ++ stats->failed;
+        return 1;
+    }
     return 0;
 }
 
-char *readfile(FILE *file, int bytes)
+/*
+ * Write a font, already transformed, as an image to out: through the
+ * cache or as a PNG if asked for, otherwise as a PBM a band at a time.
+ * Returns 0, or -1 with errno set.
+ */
+int writefont(const char *data, FILE *out, int xsize, int ysize, int chars,
+              const struct conversion *conversion, struct stats *stats,
+              struct cache *cache)
 {
-    char *buffer;
-    size_t length;
-
-    /* Skip load address */
-    fgetc(file);
-    fgetc(file);
+    struct output output;
+    size_t size;
+    int rc;
 
-    /* Slurp everything */
-    buffer = (char *) malloc(2048);
-    if (buffer)
+    /* Everything goes out through one buffer sized for the image */
+    output.buffer = NULL;
+    size = layoutsize(xsize, ysize, chars, &conversion->layout);
+    if (fflush(out) != 0 ||
+        openoutput(&output, fileno(out), NULL, size) != 0)
+    {
+        rc = -1;
+    }
+    else if (cache || conversion->format != FORMAT_PBM)
     {
-        length = fread(buffer, 1, bytes, file);
-        if (length != bytes)
+        rc = convertimage(data, &output, xsize, ysize, chars, conversion,
+                          stats, cache);
+    }
+    else
+    {
+        /* Convert to PBM, one row of characters at a time */
+        int width = layoutwidth(xsize, &conversion->layout);
+        int height = layoutheight(xsize, ysize, chars, &conversion->layout);
+
+        if (stats) stats->bytesout += pbmheaderlength(width, height);
+        rc = outputheader(&output, width, height);
+        if (0 == rc)
         {
-            free(buffer);
-            buffer = NULL;
+            rc = streambandstimed(xsize, ysize, data, chars,
+                                  &conversion->layout, &output, stats);
         }
     }
+    if (output.buffer)
+    {
+        unsigned long long flushed = stats ? nanotime() : 0;
+        int saved = errno;
 
-    return buffer;
+        if (closeoutput(&output) != 0) rc = -1;
+        else if (rc != 0) errno = saved;
+        if (stats) stats->writens += nanotime() - flushed;
+    }
+    return rc;
 }
 
-struct pbm createpbm(int x, int y, const char *data, int numchars)
+/*
+ * The whole-file path of convertfile(), for the cache and for PNG: the
+ * file is taken from the cache or made in memory, then added to the
+ * output. Returns 0, or -1 with errno set.
+ */
+int convertimage(const char *data, struct output *out,
+                 int xsize, int ysize, int chars,
+                 const struct conversion *conversion, struct stats *stats,
+                 struct cache *cache)
 {
-    int charsperline, i;
-    struct pbm output;
+    unsigned long long start = nanotime();
+    size_t size;
+    char *png;
+    int rc;
 
-    /*
-     * Output characters, one by one. With 256 pixels width, we can output
-     * 32 11 or 12 characters in a line, or 16 21 or 22 characters.
-     * The created image is 64 pixels high, which is 8 characters in 11 or
-     * 21, or 4 characters in 12 or 22.
-     */
-    output.x = 256;
-    charsperline = 32 / x;
+    if (cache)
+    {
+        rc = cachedoutput(cache, stats, conversion->format, xsize, ysize,
+                          data, chars, &conversion->layout, out, &size);
+    }
+    else
+    {
+        rc = layoutpng(xsize, ysize, data, chars, &conversion->layout,
+                       FORMAT_PNGFAST == conversion->format, &png, &size);
+        if (0 == rc)
+        {
+            rc = outputwrite(out, png, size);
+            free(png);
+        }
+    }
+    if (rc != 0) return -1;
 
-    /*
-     * The height of the output image depends on the number of characters
-     * in the font.
-     */
-    output.y = numchars / charsperline * 8 * y;
+    if (stats)
+    {
+        stats->bytesout += size;
+        stats->glyphs += chars;
+        stats->convertns += nanotime() - start;
+    }
+    return 0;
+}
 
-    /* Allocate the data for the bitmap */
-    output.data = malloc(256 / 8 * output.y);
-    if (!output.data) return output;
+/*
+ * Convert a list of font files, writing each one to a PBM or PNG file in
+ * outdir. The list is built as described for collectjobs(). The files are
+ * spread over the given number of threads; error messages and the
+ * throughput summary on stderr come out in input order whatever the
+ * thread count.
+ */
+int batch(const char *progname, const char *outdir, char **files, int count,
+          int xsize, int ysize, int chars, int threads,
+          const struct conversion *conversion, struct stats *total,
+          struct cache *cache)
+{
+    struct batch state;
+    struct job *jobs;
+    unsigned long long start = nanotime();
+    int numjobs, rc;
 
-    /* Convert characters */
-    for (i = 0; i < numchars; ++ i)
+    if (collectjobs(files, count, xsize, ysize, chars,
+                    &conversion->layout, &jobs, &numjobs) != 0)
     {
-        int xchar, ychar;
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
 
-        /*
-         * Calculate (x,y) coordinate in bitmap where this character is to
-         * be written.
-         */
+    state.outdir = outdir;
+    state.jobs = jobs;
+    state.cache = cache;
+    state.conversion = conversion;
+    state.sources = NULL;
+    state.nametemplate = NULL;
+    rc = runbatch(progname, &state, numjobs, threads, total, start);
+    freejobs(jobs, numjobs);
+    return rc;
+}
+
+/*
+ * Convert the fonts listed in a manifest. The entries are sorted by file
+ * and offset and every file is opened once, so a worker, which takes a
+ * run of neighbouring entries, cuts its fonts from one mapping and close
+ * together.
+ */
+int manifest(const char *progname, const char *outdir, const char *path,
+             const char *nametemplate, int threads,
+             const struct conversion *conversion, struct stats *total,
+             struct cache *cache)
+{
+    struct batch state;
+    struct job *jobs;
+    struct source *sources;
+    unsigned long long start = nanotime();
+    int i, numjobs, numsources = 0, rc;
 
-        for (xchar = 0; xchar < x; ++ xchar)
+    if (readmanifest(progname, path, &jobs, &numjobs) != 0) return 1;
+    if (numjobs) qsort(jobs, numjobs, sizeof (struct job), comparejobs);
+    sources = calloc(numjobs ? numjobs : 1, sizeof (struct source));
+    if (!sources)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        freejobs(jobs, numjobs);
+        return 1;
+    }
+    for (i = 0; i < numjobs; ++ i)
+    {
+        if (i && 0 == strcmp(jobs[i].filename, jobs[i - 1].filename))
         {
-            int xpos;
-            xpos = (i % charsperline) * 8 * x + xchar * 8;
-            for (ychar = 0; ychar < y; ++ ychar)
-            {
-                int fontofs, pbmofs, line, ypos;
-
-                ypos = (i / charsperline) * 8 * y + 8 * ychar;
-                /* Calculate index in font data for this character */
-                fontofs = (i + xchar * numchars + ychar * numchars * x) * 8;
-
-                /*
-                 * Calculate first byte offset in bitmap for this part of the
-                 * character.
-                 */
-                pbmofs = ypos * 256 / 8 + xpos / 8;
-                for (line = 0; line < 8; ++ line)
-                {
-                    /* Font data has eight consecutive scan lines */
-                    output.data[pbmofs + line * 256 / 8] = data[fontofs + line];
-                }
-            }
+            jobs[i].source = jobs[i - 1].source;
+            continue;
+        }
+        jobs[i].source = numsources;
+        if (openrawinput(&sources[numsources].input, jobs[i].filename,
+                         NULL) != 0)
+        {
+            sources[numsources].error = errno ? errno : EINVAL;
         }
+        ++ numsources;
     }
 
-    return output;
+    state.outdir = outdir;
+    state.jobs = jobs;
+    state.cache = cache;
+    state.conversion = conversion;
+    state.sources = sources;
+    state.nametemplate = nametemplate;
+    rc = runbatch(progname, &state, numjobs, threads, total, start);
+    for (i = 0; i < numsources; ++ i)
+    {
+        if (!sources[i].error) closeinput(&sources[i].input);
+    }
+    free(sources);
+    freejobs(jobs, numjobs);
+    return rc;
 }
 
-void printpbm(struct pbm pbm)
-{     
-    /* PBM header */
-    printf("P4\n"
-           "# Commodore 64 font converted by font2pbm\n"
-           "%d %d\n", pbm.x, pbm.y);
+/*
+ * Convert the jobs of a batch on the given number of threads, then report
+ * the failures and a summary. Returns the exit code.
+ */
+int runbatch(const char *progname, struct batch *state, int numjobs,
+             int threads, struct stats *total, unsigned long long start)
+{
+    struct job *jobs = state->jobs;
+    size_t highwater = 0;
+    double seconds;
+    int i, rc = 0;
+
+    if (threads > numjobs) threads = numjobs > 0 ? numjobs : 1;
+    state->stats = calloc(threads, sizeof (struct stats));
+    state->arenas = calloc(threads, sizeof (struct arena));
+    state->outputs = calloc(threads, sizeof (struct output));
+    for (i = 0; state->arenas && state->outputs && i < threads; ++ i)
+    {
+        if (initarena(&state->arenas[i], ARENASIZE) != 0 ||
+            openoutput(&state->outputs[i], -1, NULL, ARENASIZE) != 0)
+        {
+            rc = -1;
+        }
+    }
+    if (!state->stats || !state->arenas || !state->outputs || rc != 0 ||
+        nameoutputs(jobs, numjobs, state->outdir, state->nametemplate,
+                    state->conversion->format) != 0 ||
+        runpool(threads, numjobs,
+                state->sources ? manifesttask : batchtask, state) != 0)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
 
-    /* Image data */
-    fwrite(pbm.data, 1, 256 / 8 * pbm.y, stdout);
+    /* Report, in input order */
+    for (i = 0; i < threads; ++ i)
+    {
+        addstats(total, &state->stats[i]);
+        if (state->arenas[i].highwater > highwater)
+        {
+            highwater = state->arenas[i].highwater;
+        }
+        freearena(&state->arenas[i]);
+        closeoutput(&state->outputs[i]);
+    }
+    for (i = 0; i < numjobs; ++ i)
+    {
+        if (jobs[i].failed)
+        {
+            fprintf(stderr, "%s: %s\n", progname, jobs[i].error);
+        }
+    }
+    free(state->stats);
+    free(state->arenas);
+    free(state->outputs);
+
+    /* Throughput summary */
+    seconds = (nanotime() - start) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+    fprintf(stderr, "%s: %lu files (%lu failed), %llu bytes in, "
+            "%llu bytes out in %.3f s: %.1f files/s, %.2f MB/s, "
+            "arena high water %lu bytes\n",
+            progname, total->files, total->failed, total->bytesin,
+            total->bytesout, seconds, total->files / seconds,
+            (total->bytesin + total->bytesout) / seconds / 1e6,
+            (unsigned long) highwater);
+
+    return total->failed ? 1 : 0;
+}
+
+/*
+ * Stack all the fonts in a file list into one tall PBM on stdout. They
+ * must all come out the same width, which they do unless the layout sets
+ * the characters per row. The height of every font is known from its
+ * parameters, so the header can be written up front and each font
+ * streamed out as soon as it is converted; only one row of characters is
+ * held in memory at any time. A PNG sheet is built in memory instead and
+ * compressed at the end, on the given number of threads. Fonts that fail
+ * to load are left blank so the image keeps its announced size.
+ */
+int contactsheet(const char *progname, char **files, int count,
+                 int xsize, int ysize, int chars, int threads,
+                 const struct conversion *conversion, struct stats *stats)
+{
+    const struct layout *layout = &conversion->layout;
+    struct output output;
+    struct job *jobs;
+    long long height = 0;
+    int i, numjobs, x, y, width = 0, failed = 0;
+    size_t maxbytes = 0, offset = 0;
+    char *transformed = NULL, *sheet = NULL;
+
+    if (collectjobs(files, count, xsize, ysize, chars,
+                    &conversion->layout, &jobs, &numjobs) != 0)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
+
+    for (i = 0; i < numjobs; ++ i)
+    {
+        struct job *job = &jobs[i];
+
+        /* The height is needed up front, so detect layouts first */
+        if (!job->xsize)
+        {
+            struct input input;
+
+            if (openjob(&input, job, NULL) != 0 ||
+                detectinput(&input, &job->xsize, &job->ysize,
+                            &job->chars) != 0)
+            {
+                /* Reported below, in order */
+                job->xsize = job->ysize = 1;
+                job->chars = 0;
+                job->failed = 1;
+            }
+            closeinput(&input);
+        }
+        x = job->xsize;
+        y = job->ysize;
+        transformfont(&x, &y, NULL, 0, conversion->transforms,
+                      conversion->numtransforms, NULL);
+        height += layoutheight(x, y, job->chars, layout);
+        if (fontdatasize(job->xsize, job->ysize, job->chars, layout) >
+            maxbytes)
+        {
+            maxbytes = fontdatasize(job->xsize, job->ysize, job->chars,
+                                    layout);
+        }
+
+        /* A set number of characters per row gives each size its width */
+        if (!job->failed && width && layoutwidth(x, layout) != width)
+        {
+            fprintf(stderr, "%s: Fonts in a contact sheet must have the "
+                            "same width\n", progname);
+            freejobs(jobs, numjobs);
+            return 1;
+        }
+        if (!job->failed) width = layoutwidth(x, layout);
+    }
+    if (height > 0x7fffffff)
+    {
+        fprintf(stderr, "%s: Contact sheet too large\n", progname);
+        freejobs(jobs, numjobs);
+        return 1;
+    }
+    if (!width) width = layoutwidth(1, layout);
+
+    /* One buffer for the transformed fonts, big enough for all of them */
+    if (conversion->numtransforms &&
+        !(transformed = malloc(maxbytes ? maxbytes : 1)))
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        freejobs(jobs, numjobs);
+        return 1;
+    }
+
+    if (conversion->format != FORMAT_PBM &&
+        !(sheet = calloc(height ? height : 1, (width + 7) / 8)))
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        freejobs(jobs, numjobs);
+        free(transformed);
+        return 1;
+    }
+
+    /* The whole sheet goes out through one buffer */
+    if (fflush(stdout) != 0 ||
+        openoutput(&output, STDOUT_FILENO, NULL,
+                   (size_t) height * ((width + 7) / 8)) != 0)
+    {
+        fprintf(stderr, "%s: Can't write output: %s\n",
+                progname, strerror(errno));
+        freejobs(jobs, numjobs);
+        free(transformed);
+        free(sheet);
+        return 1;
+    }
+    if (!sheet)
+    {
+        outputheader(&output, width, (int) height);
+        if (stats) stats->bytesout += pbmheaderlength(width, (int) height);
+    }
+    for (i = 0; i < numjobs; ++ i)
+    {
+        struct job *job = &jobs[i];
+        struct input input;
+        size_t bytes = fontdatasize(job->xsize, job->ysize, job->chars,
+                                    layout);
+        unsigned long long start = stats ? nanotime() : 0;
+        size_t blankbytes;
+
+        x = job->xsize;
+        y = job->ysize;
+        transformfont(&x, &y, NULL, 0, conversion->transforms,
+                      conversion->numtransforms, NULL);
+        blankbytes = (size_t) layoutheight(x, y, job->chars, layout) *
+                     ((width + 7) / 8);
+        offset += blankbytes;
+
+        if (stats) ++ stats->files;
+        if (job->failed)
+        {
+            fprintf(stderr, "%s: Can't detect font layout of \"%s\"\n",
+                    progname, job->filename);
+        }
+        else if (openjob(&input, job, NULL) != 0)
+        {
+            if (EINVAL == errno)
+            {
+                fprintf(stderr, "%s: Invalid input from \"%s\"\n",
+                        progname, job->filename);
+            }
+            else
+            {
+                fprintf(stderr, "%s: Can't open \"%s\": %s\n",
+                        progname, job->filename, strerror(errno));
+            }
+        }
+        else if (input.length < bytes)
+        {
+            fprintf(stderr, "%s: Invalid input from \"%s\"\n",
+                    progname, job->filename);
+            closeinput(&input);
+        }
+        else
+        {
+            const char *data = input.data;
+
+            if (stats)
+            {
+                stats->readns += nanotime() - start;
+                stats->bytesin += 2 + input.length;
+            }
+            x = job->xsize;
+            y = job->ysize;
+            if (conversion->numtransforms)
+            {
+                start = stats ? nanotime() : 0;
+                transformfont(&x, &y, input.data, job->chars,
+                              conversion->transforms,
+                              conversion->numtransforms, transformed);
+                data = transformed;
+                if (stats) stats->convertns += nanotime() - start;
+            }
+            if (sheet)
+            {
+                start = stats ? nanotime() : 0;
+                renderlayout(x, y, data, job->chars, layout,
+                             sheet + offset - blankbytes, blankbytes);
+                if (stats)
+                {
+                    stats->convertns += nanotime() - start;
+                    stats->glyphs += job->chars;
+                }
+            }
+            else
+            {
+                streambandstimed(x, y, data, job->chars, layout, &output,
+                                 stats);
+            }
+            closeinput(&input);
+            continue;
+        }
+
+        /* Keep the layout intact */
+        ++ failed;
+        if (stats) ++ stats->failed;
+        if (!sheet)
+        {
+            if (stats) stats->bytesout += blankbytes;
+            outputfill(&output, 0, blankbytes);
+        }
+    }
+    freejobs(jobs, numjobs);
+    free(transformed);
+
+    if (sheet)
+    {
+        unsigned long long start = stats ? nanotime() : 0;
+        size_t size;
+        char *png;
+
+        if (formatpngparallel(sheet, width, (int) height,
+                              FORMAT_PNGFAST == conversion->format, threads,
+                              &png, &size) != 0)
+        {
+            output.error = errno;
+        }
+        else
+        {
+            outputwrite(&output, png, size);
+            free(png);
+            if (stats)
+            {
+                stats->bytesout += size;
+                stats->convertns += nanotime() - start;
+            }
+        }
+        free(sheet);
+    }
+
+    if (closeoutput(&output) != 0)
+    {
+        fprintf(stderr, "%s: Can't write output: %s\n",
+                progname, strerror(errno));
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
+
+/*
+ * Print the detected layout of each file in a list, built as for
+ * collectjobs(), on stdout.
+ */
+int detectfiles(const char *progname, char **files, int count)
+{
+    struct job *jobs;
+    int i, numjobs, failed = 0;
+
+    if (collectjobs(files, count, 0, 0, 0, NULL, &jobs, &numjobs) != 0)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
+
+    for (i = 0; i < numjobs; ++ i)
+    {
+        struct input input;
+        struct detection detection;
+
+        if (openjob(&input, &jobs[i], NULL) != 0)
+        {
+            fprintf(stderr, "%s: Can't open \"%s\": %s\n",
+                    progname, jobs[i].filename, strerror(errno));
+            ++ failed;
+            continue;
+        }
+        if (detectdata(input.data, input.length, input.loadaddress,
+                       &detection) != 0)
+        {
+            printf("%s: not a font\n", jobs[i].filename);
+            ++ failed;
+        }
+        else
+        {
+            printf("%s: %dx%d %d load $%04x confidence %.2f\n",
+                   jobs[i].filename, detection.x, detection.y,
+                   detection.numchars, detection.loadaddress,
+                   detection.confidence);
+        }
+        closeinput(&input);
+    }
+    freejobs(jobs, numjobs);
+    return failed ? 1 : 0;
+}
+
+/*
+ * Scan a list of files for charsets, built as described for
+ * collectjobs(), over the given number of threads. The places found are
+ * printed on stdout in input order, with the offset in the file and the
+ * address it loads to, or with an output directory written there as
+ * images of their own.
+ */
+int scanfiles(const char *progname, const char *outdir, char **files,
+              int count, size_t step, int maxhits, int threads,
+              const struct conversion *conversion, struct stats *total)
+{
+    struct scan state;
+    struct job *jobs;
+    int i, k, numjobs, rc = 0;
+
+    if (collectjobs(files, count, 0, 0, 0, NULL, &jobs, &numjobs) != 0)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
+
+    state.outdir = outdir;
+    state.jobs = jobs;
+    state.maxhits = maxhits;
+    state.step = step;
+    state.conversion = conversion;
+    if (threads > numjobs) threads = numjobs > 0 ? numjobs : 1;
+    state.hits = calloc(numjobs ? numjobs : 1,
+                        maxhits * sizeof (struct scanhit));
+    state.found = calloc(numjobs ? numjobs : 1, sizeof (int));
+    state.loadaddresses = calloc(numjobs ? numjobs : 1, sizeof (unsigned));
+    state.stats = calloc(threads, sizeof (struct stats));
+    state.arenas = calloc(threads, sizeof (struct arena));
+    for (i = 0; state.arenas && i < threads; ++ i)
+    {
+        if (initarena(&state.arenas[i], ARENASIZE) != 0) rc = -1;
+    }
+    if (!state.hits || !state.found || !state.loadaddresses ||
+        !state.stats || !state.arenas || rc != 0 ||
+        (outdir && nameoutputs(jobs, numjobs, outdir, NULL,
+                               conversion->format) != 0) ||
+        runpool(threads, numjobs, scantask, &state) != 0)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        return 1;
+    }
+
+    /* Report, in input order */
+    for (i = 0; i < threads; ++ i)
+    {
+        addstats(total, &state.stats[i]);
+        freearena(&state.arenas[i]);
+    }
+    for (i = 0; i < numjobs; ++ i)
+    {
+        const struct scanhit *hits = state.hits + (size_t) i * maxhits;
+
+        if (jobs[i].failed)
+        {
+            fprintf(stderr, "%s: %s\n", progname, jobs[i].error);
+            continue;
+        }
+        if (!state.found[i])
+        {
+            printf("%s: no charset\n", jobs[i].filename);
+        }
+        for (k = 0; k < state.found[i]; ++ k)
+        {
+            printf("%s: offset %lu load $%04x score %.2f\n",
+                   jobs[i].filename, (unsigned long) hits[k].offset,
+                   (unsigned) ((state.loadaddresses[i] + hits[k].offset) &
+                               0xffff),
+                   hits[k].score);
+        }
+    }
+    freejobs(jobs, numjobs);
+    free(state.hits);
+    free(state.found);
+    free(state.loadaddresses);
+    free(state.stats);
+    free(state.arenas);
+    return total->failed ? 1 : 0;
+}
+
+/* Scan one file, and write what is found if asked to */
+void scantask(void *context, int index, int worker)
+{
+    struct scan *state = context;
+    struct job *job = &state->jobs[index];
+    struct stats *stats = &state->stats[worker];
+    struct arena *arena = &state->arenas[worker];
+    struct scanhit *hits = state->hits + (size_t) index * state->maxhits;
+    struct input input;
+    unsigned long long start = nanotime(), scanned;
+    size_t skip;
+    int i, found;
+
+    ++ stats->files;
+    resetarena(arena);
+    if (openjob(&input, job, arena) != 0)
+    {
+        if (EINVAL == errno)
+        {
+            snprintf(job->error, sizeof job->error,
+                     "Invalid input from \"%s\"", job->filename);
+        }
+        else
+        {
+            snprintf(job->error, sizeof job->error, "Can't open \"%s\": %s",
+                     job->filename, strerror(errno));
+        }
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+
+    /* Steps count in memory, from where the file loads */
+    skip = (state->step - input.loadaddress % state->step) % state->step;
+    found = input.length > skip
+            ? scanfont(input.data + skip, input.length - skip, state->step,
+                       hits, state->maxhits)
+            : 0;
+    for (i = 0; i < found; ++ i)
+    {
+        hits[i].offset += skip;
+    }
+    state->found[index] = found;
+    state->loadaddresses[index] = input.loadaddress;
+    scanned = nanotime();
+    stats->bytesin += 2 + input.length;
+    stats->glyphs += 256 * found;
+    stats->convertns += scanned - start;
+
+    for (i = 0; state->outdir && i < found; ++ i)
+    {
+        if (writehit(state, arena, job, input.data + hits[i].offset,
+                     hits[i].offset, stats) != 0)
+        {
+            job->failed = 1;
+            ++ stats->failed;
+            break;
+        }
+    }
+    stats->writens += nanotime() - scanned;
+    closeinput(&input);
+}
+
+/*
+ * Write a charset found by scanning as an image of its own, named after
+ * the file and the offset in hex, "game.prg" giving "game-17ff.pbm".
+ * The file part is the job's output name, see nameoutputs(). Returns 0,
+ * or -1 with the problem in job->error.
+ */
+int writehit(const struct scan *state, struct arena *arena, struct job *job,
+             const char *data, size_t offset, struct stats *stats)
+{
+    const struct conversion *conversion = state->conversion;
+    const char *name = job->outname;
+    char *hitname, *transformed = NULL;
+    size_t length;
+    FILE *out;
+    int x = 1, y = 1, rc;
+
+    hitname = arenaalloc(arena, strlen(name) + 20);
+    if (hitname && conversion->numtransforms)
+    {
+        transformed = arenaalloc(arena, SCANWINDOW);
+    }
+    if (!hitname || (conversion->numtransforms && !transformed))
+    {
+        snprintf(job->error, sizeof job->error, "Out of memroy");
+        return -1;
+    }
+
+    /* The extension is ".pbm" or ".png" */
+    length = strlen(name) - 4;
+    sprintf(hitname, "%.*s-%lx%s", (int) length, name,
+            (unsigned long) offset, name + length);
+    if (transformed)
+    {
+        transformfont(&x, &y, data, 256, conversion->transforms,
+                      conversion->numtransforms, transformed);
+        data = transformed;
+    }
+
+    out = fopen(hitname, "wb");
+    if (!out)
+    {
+        snprintf(job->error, sizeof job->error, "Can't create \"%s\": %s",
+                 hitname, strerror(errno));
+        return -1;
+    }
+    rc = writefont(data, out, x, y, 256, conversion, stats, NULL);
+    if (fclose(out) != 0) rc = -1;
+    if (rc != 0)
+    {
+        snprintf(job->error, sizeof job->error, "Can't write \"%s\": %s",
+                 hitname, strerror(errno));
+        remove(hitname);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Detect the layout of an opened font file. Returns 0, or -1 if it can't
+ * be a font.
+ */
+int detectinput(const struct input *input, int *xsize, int *ysize,
+                int *chars)
+{
+    struct detection detection;
+
+    if (detectdata(input->data, input->length, input->loadaddress,
+                   &detection) != 0 || !detection.numchars)
+    {
+        return -1;
+    }
+    *xsize = detection.x;
+    *ysize = detection.y;
+    *chars = detection.numchars;
+    return 0;
+}
+
+/*
+ * Build the job list from the command line, or if it is empty, from stdin,
+ * one file name per line, optionally preceded by the size and number of
+ * characters for that file. A disk image stands for the fonts in it, see
+ * addfile().
+ */
+int collectjobs(char **files, int count, int xsize, int ysize, int chars,
+                const struct layout *layout, struct job **jobs, int *numjobs)
+{
+    char line[4096];
+    int i, maxjobs = 0;
+
+    *jobs = NULL;
+    *numjobs = 0;
+
+    for (i = 0; i < count; ++ i)
+    {
+        if (addfile(jobs, numjobs, &maxjobs, files[i],
+                    xsize, ysize, chars, layout) != 0)
+        {
+            freejobs(*jobs, *numjobs);
+            return -1;
+        }
+    }
+    if (count) return 0;
+
+    while (fgets(line, sizeof line, stdin))
+    {
+        int jx = xsize, jy = ysize, jchars = chars, skip = 0;
+        char spec[8];
+        size_t len;
+
+        len = strcspn(line, "\r\n");
+        line[len] = 0;
+        if (!len) continue;
+
+        /* Optional per-file size and count */
+        if (sscanf(line, "%7s %d %n", spec, &jchars, &skip) == 2 && skip &&
+            parsesize(spec, &jx, &jy) == 0)
+        {
+            if (!line[skip]) continue;
+        }
+        else
+        {
+            jx = xsize;
+            jy = ysize;
+            jchars = chars;
+            skip = 0;
+        }
+
+        if (addfile(jobs, numjobs, &maxjobs, line + skip,
+                    jx, jy, jchars, layout) != 0)
+        {
+            freejobs(*jobs, *numjobs);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void freejobs(struct job *jobs, int numjobs)
+{
+    int i;
+
+    for (i = 0; i < numjobs; ++ i)
+    {
+        free(jobs[i].filename);
+        free(jobs[i].outname);
+        if (jobs[i].ownsarchive)
+        {
+            closearchive(jobs[i].archive);
+            free(jobs[i].archive);
+        }
+    }
+    free(jobs);
+}
+
+/*
+ * Read the entries of a manifest, or stdin for "-", one per line as
+ * "filename offset size num", skipping blank lines and comments starting
+ * with #. The file name is everything before the last three words, so it
+ * may contain spaces. Returns 0, or -1 after reporting the problem.
+ */
+int readmanifest(const char *progname, const char *path,
+                 struct job **jobs, int *numjobs)
+{
+    FILE *in = strcmp(path, "-") != 0 ? fopen(path, "r") : stdin;
+    char line[4096];
+    int maxjobs = 0, lineno = 0, rc = 0;
+
+    *jobs = NULL;
+    *numjobs = 0;
+    if (!in)
+    {
+        fprintf(stderr, "%s: Can't open \"%s\": %s\n",
+                progname, path, strerror(errno));
+        return -1;
+    }
+
+    while (0 == rc && fgets(line, sizeof line, in))
+    {
+        char *name = line, *count, *size, *offset, *end;
+        unsigned long long at;
+        int x, y, chars;
+
+        ++ lineno;
+        line[strcspn(line, "\r\n")] = 0;
+        while (isspace((unsigned char) *name)) ++ name;
+        if (!*name || '#' == *name) continue;
+
+        count = lastword(name);
+        size = count ? lastword(name) : NULL;
+        offset = size ? lastword(name) : NULL;
+        end = name + strlen(name);
+        while (end > name && isspace((unsigned char) end[-1])) *-- end = 0;
+        if (!offset || parseoffset(offset, &at) != 0 ||
+            parsesize(size, &x, &y) != 0 ||
+            sscanf(count, "%d", &chars) != 1 || chars < 1)
+        {
+            fprintf(stderr, "%s: Illegal entry on line %d of \"%s\"\n",
+                    progname, lineno, path);
+            rc = -1;
+        }
+        else if (addjob(jobs, numjobs, &maxjobs, name, x, y, chars) != 0)
+        {
+            fprintf(stderr, "%s: Out of memroy\n", progname);
+            rc = -1;
+        }
+        else
+        {
+            (*jobs)[*numjobs - 1].offset = at;
+            (*jobs)[*numjobs - 1].line = lineno;
+        }
+    }
+    if (in != stdin) fclose(in);
+    if (rc != 0) freejobs(*jobs, *numjobs);
+    return rc;
+}
+
+/* Order manifest entries by file, then offset, then line */
+int comparejobs(const void *a, const void *b)
+{
+    const struct job *first = a, *second = b;
+    int order = strcmp(first->filename, second->filename);
+
+    if (order) return order;
+    if (first->offset != second->offset)
+    {
+        return first->offset < second->offset ? -1 : 1;
+    }
+    return first->line - second->line;
+}
+
+/*
+ * Cut the last word off a line and return it, or NULL if there is
+ * nothing before it to leave behind.
+ */
+char *lastword(char *line)
+{
+    char *end = line + strlen(line), *word;
+
+    while (end > line && isspace((unsigned char) end[-1])) -- end;
+    *end = 0;
+    word = end;
+    while (word > line && !isspace((unsigned char) word[-1])) -- word;
+    if (word == line || word == end) return NULL;
+    word[-1] = 0;
+    return word;
+}
+
+/*
+ * Append a file to the job list, or if it is an image, every program or
+ * cartridge chip in it that is the size of a font: exactly the size
+ * given, or when it is to be detected, a whole number of 512 bytes up to
+ * 16 kilobytes after the load address, which covers 64, 128 and 256
+ * characters in every size mode. An image that can't be read is added as
+ * a whole, so that opening it fails and is reported in its place. The
+ * image is opened once and kept open for all the jobs from it, which
+ * carry their directory entries, so that the workers don't open it and
+ * search its directory again for each file.
+ */
+int addfile(struct job **jobs, int *numjobs, int *maxjobs,
+            const char *filename, int xsize, int ysize, int chars,
+            const struct layout *layout)
+{
+    size_t fontsize = xsize ? fontdatasize(xsize, ysize, chars, layout) : 0;
+    struct archive *archive;
+    struct archivefile file;
+    char *name;
+    int rc = 0, owned = 0;
+
+    if (!isarchive(filename) || archivepath(filename))
+    {
+        return addjob(jobs, numjobs, maxjobs, filename, xsize, ysize, chars);
+    }
+    if (!(archive = malloc(sizeof (struct archive)))) return -1;
+    if (openarchive(archive, filename) != 0)
+    {
+        free(archive);
+        if (!(name = malloc(strlen(filename) + 3))) return -1;
+        sprintf(name, "%s:*", filename);
+        rc = addjob(jobs, numjobs, maxjobs, name, xsize, ysize, chars);
+        free(name);
+        return rc;
+    }
+
+    rewindarchive(&file);
+    while (0 == rc && nextarchivefile(archive, &file) > 0)
+    {
+        size_t length = file.length - 2;
+        struct job *job;
+
+        if ((file.type != ARCHIVE_PRG && file.type != ARCHIVE_ROM) ||
+            file.broken || file.length < 2 ||
+            (xsize ? length != fontsize
+                   : !length || length % 512 || length > 16384))
+        {
+            continue;
+        }
+        if (!(name = malloc(strlen(filename) + strlen(file.name) + 2)))
+        {
+            rc = -1;
+            break;
+        }
+        sprintf(name, "%s:%s", filename, file.name);
+        rc = addjob(jobs, numjobs, maxjobs, name, xsize, ysize, chars);
+        free(name);
+        if (0 == rc)
+        {
+            job = &(*jobs)[*numjobs - 1];
+            job->archive = archive;
+            job->member = file;
+            job->ownsarchive = !owned;
+            owned = 1;
+        }
+    }
+    if (!owned)
+    {
+        closearchive(archive);
+        free(archive);
+    }
+    return rc;
+}
+
+/* Append a file to the job list, growing it as needed */
+int addjob(struct job **jobs, int *numjobs, int *maxjobs, const char *filename,
+           int xsize, int ysize, int chars)
+{
+    struct job *job;
+
+    if (*numjobs == *maxjobs)
+    {
+        int newmax = *maxjobs ? *maxjobs * 2 : 256;
+        struct job *grown = realloc(*jobs, newmax * sizeof (struct job));
+        if (!grown) return -1;
+        *jobs = grown;
+        *maxjobs = newmax;
+    }
+
+    job = &(*jobs)[*numjobs];
+    job->filename = strdup(filename);
+    if (!job->filename) return -1;
+    job->xsize = xsize;
+    job->ysize = ysize;
+    job->chars = chars;
+    job->failed = 0;
+    job->error[0] = 0;
+    job->source = 0;
+    job->offset = 0;
+    job->line = 0;
+    job->archive = NULL;
+    job->ownsarchive = 0;
+    job->outname = NULL;
+    ++ *numjobs;
+    return 0;
+}
+
+/* Open the font of a job, from its image if addfile() opened one */
+int openjob(struct input *input, const struct job *job, struct arena *arena)
+{
+    if (job->archive)
+    {
+        return openmemberinput(input, job->archive, &job->member, arena);
+    }
+    return openinput(input, job->filename, arena);
+}
+
+/*
+ * Pool callback: convert one job into its output file. Everything the
+ * conversion needs comes from the worker's arena, which is reset for each
+ * job, and the finished file is written with a single write().
+ */
+void batchtask(void *context, int index, int worker)
+{
+    struct batch *state = context;
+    struct job *job = &state->jobs[index];
+    struct stats *stats = &state->stats[worker];
+    struct arena *arena = &state->arenas[worker];
+    struct input input;
+    unsigned long long start = nanotime();
+
+    ++ stats->files;
+    resetarena(arena);
+
+    /* Read */
+    if (openjob(&input, job, arena) != 0)
+    {
+        if (EINVAL == errno)
+        {
+            snprintf(job->error, sizeof job->error,
+                     "Invalid input from \"%s\"", job->filename);
+        }
+        else
+        {
+            snprintf(job->error, sizeof job->error, "Can't open \"%s\": %s",
+                     job->filename, strerror(errno));
+        }
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+    if (!job->xsize &&
+        detectinput(&input, &job->xsize, &job->ysize, &job->chars) != 0)
+    {
+        snprintf(job->error, sizeof job->error,
+                 "Can't detect font layout of \"%s\"", job->filename);
+        job->failed = 1;
+        ++ stats->failed;
+        closeinput(&input);
+        return;
+    }
+    writejob(state, worker, job, input.data, input.length, job->outname,
+             start);
+    if (!job->failed) stats->bytesin += 2 + input.length;
+    closeinput(&input);
+}
+
+/*
+ * Pool callback: convert one manifest entry, a slice of a source file
+ * opened beforehand, into the file its name template gives.
+ */
+void manifesttask(void *context, int index, int worker)
+{
+    struct batch *state = context;
+    struct job *job = &state->jobs[index];
+    struct stats *stats = &state->stats[worker];
+    struct arena *arena = &state->arenas[worker];
+    const struct source *source = &state->sources[job->source];
+    size_t bytes;
+    unsigned long long start = nanotime();
+
+    ++ stats->files;
+    resetarena(arena);
+
+    bytes = fontdatasize(job->xsize, job->ysize, job->chars,
+                         &state->conversion->layout);
+    if (source->error)
+    {
+        snprintf(job->error, sizeof job->error, "Can't open \"%s\": %s",
+                 job->filename, strerror(source->error));
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+    if (job->offset > source->input.length ||
+        source->input.length - job->offset < bytes)
+    {
+        snprintf(job->error, sizeof job->error,
+                 "Invalid input from \"%s\" at offset %lu",
+                 job->filename, (unsigned long) job->offset);
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+    writejob(state, worker, job, source->input.data + job->offset, bytes,
+             job->outname, start);
+    if (!job->failed) stats->bytesin += bytes;
+}
+
+/*
+ * Convert the font data of a job into outname. Everything the conversion
+ * needs comes from the worker's arena, and the finished file is written
+ * with a single write(). Failures are recorded in the job and counted;
+ * the timings count from start, and the caller adds the bytes read.
+ */
+void writejob(struct batch *state, int worker, struct job *job,
+              const char *font, size_t length, const char *outname,
+              unsigned long long start)
+{
+    struct stats *stats = &state->stats[worker];
+    struct arena *arena = &state->arenas[worker];
+    struct output *out = &state->outputs[worker];
+    size_t bytes, size;
+    char *transformed = NULL;
+    const char *data;
+    unsigned long long read, converted;
+    int fd, rc, xsize, ysize;
+
+    bytes = fontdatasize(job->xsize, job->ysize, job->chars,
+                         &state->conversion->layout);
+    /* Transforms can swap the width and height of the characters */
+    xsize = job->xsize;
+    ysize = job->ysize;
+    transformfont(&xsize, &ysize, NULL, 0, state->conversion->transforms,
+                  state->conversion->numtransforms, NULL);
+    size = layoutsize(xsize, ysize, job->chars, &state->conversion->layout);
+    if (length < bytes)
+    {
+        snprintf(job->error, sizeof job->error, "Invalid input from \"%s\"",
+                 job->filename);
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+
+    data = font;
+    if (state->conversion->numtransforms)
+    {
+        data = transformed = arenaalloc(arena, bytes ? bytes : 1);
+    }
+    if (!data)
+    {
+        snprintf(job->error, sizeof job->error, "Out of memroy");
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+    read = nanotime();
+    if (transformed)
+    {
+        transformfont(&job->xsize, &job->ysize, font, job->chars,
+                      state->conversion->transforms,
+                      state->conversion->numtransforms, transformed);
+    }
+
+    /*
+     * The file is created before converting so the image can be rendered
+     * straight into the output buffer and written with one call
+     */
+    fd = open(outname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        snprintf(job->error, sizeof job->error, "Can't create \"%s\": %s",
+                 outname, strerror(errno));
+        job->failed = 1;
+        ++ stats->failed;
+        return;
+    }
+    attachoutput(out, fd);
+    if (state->cache)
+    {
+        rc = cachedoutput(state->cache, stats, state->conversion->format,
+                          job->xsize, job->ysize, data, job->chars,
+                          &state->conversion->layout, out, &size);
+    }
+    else if (state->conversion->format != FORMAT_PBM)
+    {
+        char *png;
+
+        rc = layoutpng(job->xsize, job->ysize, data, job->chars,
+                       &state->conversion->layout,
+                       FORMAT_PNGFAST == state->conversion->format,
+                       &png, &size);
+        if (0 == rc)
+        {
+            rc = outputwrite(out, png, size);
+            free(png);
+        }
+    }
+    else
+    {
+        char *image = outputreserve(out, size);
+
+        rc = 0;
+        if (image)
+        {
+            formatlayout(job->xsize, job->ysize, data, job->chars,
+                         &state->conversion->layout, image, size);
+            outputcommit(out, size);
+        }
+        else if (!(image = arenaalloc(arena, size)))
+        {
+            errno = ENOMEM;
+            rc = -1;
+        }
+        else
+        {
+            /* Too big for the buffer */
+            formatlayout(job->xsize, job->ysize, data, job->chars,
+                         &state->conversion->layout, image, size);
+            rc = outputwrite(out, image, size);
+        }
+    }
+    converted = nanotime();
+
+    /* Write */
+    if (flushoutput(out) != 0) rc = -1;
+    if (close(fd) != 0) rc = -1;
+    if (rc != 0)
+    {
+        snprintf(job->error, sizeof job->error, "Can't write \"%s\": %s",
+                 outname, strerror(errno));
+        job->failed = 1;
+        remove(outname);
+    }
+
+    if (job->failed)
+    {
+        ++ stats->failed;
+    }
+    else
+    {
+        stats->bytesout += size;
+        stats->glyphs += job->chars;
+        stats->readns += read - start;
+        stats->convertns += converted - read;
+        stats->writens += nanotime() - converted;
+    }
+}
+
+/*
+ * Give every job the name of its output file in outdir, from the name
+ * template for manifest entries or else from outputname(). Different
+ * inputs can come out with the same name, such as a/x.prg and b/x.prg or
+ * disk image files with the same sanitized names, and the jobs would
+ * then overwrite or remove each other's files, so every job after the
+ * first with a name gets "-2", "-3" and so on added to it, skipping names
+ * that are taken. Returns 0, or -1 if out of memory.
+ */
+int nameoutputs(struct job *jobs, int numjobs, const char *outdir,
+                const char *nametemplate, enum format format)
+{
+    struct arena arena;
+    struct job **sorted;
+    char **renamed = NULL;
+    int i, n, rc = 0;
+
+    sorted = malloc((numjobs ? numjobs : 1) * sizeof (struct job *));
+    if (!sorted || initarena(&arena, ARENASIZE) != 0)
+    {
+        free(sorted);
+        return -1;
+    }
+    for (i = 0; 0 == rc && i < numjobs; ++ i)
+    {
+        char *name = nametemplate
+                     ? templatename(&arena, outdir, nametemplate, &jobs[i],
+                                    format)
+                     : outputname(&arena, outdir, jobs[i].filename, format);
+
+        free(jobs[i].outname);
+        jobs[i].outname = name ? strdup(name) : NULL;
+        if (!jobs[i].outname) rc = -1;
+        sorted[i] = &jobs[i];
+        resetarena(&arena);
+    }
+    freearena(&arena);
+
+    /*
+     * Equal names end up next to each other, in job order. The new names
+     * are only given out at the end, so that the sorted names can still
+     * be searched; a name and a number can only come out of one of them.
+     */
+    if (0 == rc && numjobs)
+    {
+        qsort(sorted, numjobs, sizeof (struct job *), compareoutnames);
+        if (!(renamed = calloc(numjobs, sizeof (char *)))) rc = -1;
+    }
+    for (i = 1, n = 1; 0 == rc && i < numjobs; ++ i)
+    {
+        const char *name = sorted[i]->outname;
+        size_t length = strlen(name) - 4;
+
+        if (strcmp(name, sorted[i - 1]->outname) != 0)
+        {
+            n = 1;
+            continue;
+        }
+        if (!(renamed[i] = malloc(length + 4 + 12)))
+        {
+            rc = -1;
+            break;
+        }
+        do
+        {
+            sprintf(renamed[i], "%.*s-%d%s", (int) length, name, ++ n,
+                    name + length);
+        }
+        while (bsearch(renamed[i], sorted, numjobs, sizeof (struct job *),
+                       findoutname));
+    }
+    for (i = 0; renamed && i < numjobs; ++ i)
+    {
+        if (!renamed[i]) continue;
+        if (0 == rc)
+        {
+            free(sorted[i]->outname);
+            sorted[i]->outname = renamed[i];
+        }
+        else
+        {
+            free(renamed[i]);
+        }
+    }
+    free(renamed);
+    free(sorted);
+    return rc;
+}
+
+/* Order jobs by output name, then by their place in the job list */
+int compareoutnames(const void *a, const void *b)
+{
+    const struct job *first = *(struct job *const *) a;
+    const struct job *second = *(struct job *const *) b;
+    int order = strcmp(first->outname, second->outname);
+
+    if (order) return order;
+    return first < second ? -1 : first > second;
+}
+
+/* Compare a name with the output name of a job, for bsearch() */
+int findoutname(const void *name, const void *job)
+{
+    return strcmp(name, (*(struct job *const *) job)->outname);
+}
+
+/*
+ * Build the output file name for an input file: its name stem, see
+ * namestem(), with ".pbm" or ".png" added, placed in outdir.
+ */
+char *outputname(struct arena *arena, const char *outdir,
+                 const char *filename, enum format format)
+{
+    char *name, *next;
+
+    name = arenaalloc(arena, strlen(outdir) + namestem(NULL, filename) + 6);
+    if (name)
+    {
+        next = name + sprintf(name, "%s/", outdir);
+        next += namestem(next, filename);
+        sprintf(next, ".%s", FORMAT_PBM == format ? "pbm" : "png");
+    }
+    return name;
+}
+
+/*
+ * Build the output file name for a manifest entry from a template, with
+ * %f for the name stem of its file, %o for the offset in hex, %s for the
+ * size, %c for the number of characters and %n for the manifest line,
+ * and ".pbm" or ".png" added, placed in outdir. Slashes in the template
+ * are made underscores, as in namestem(), so that "../name" can't write
+ * outside outdir.
+ */
+char *templatename(struct arena *arena, const char *outdir,
+                   const char *template, const struct job *job,
+                   enum format format)
+{
+    char *name, *next;
+
+    /* No number takes more than 20 characters */
+    name = arenaalloc(arena, strlen(outdir) + namestem(NULL, job->filename) +
+                             20 * strlen(template) + 6);
+    if (!name) return NULL;
+
+    next = name + sprintf(name, "%s/", outdir);
+    for (; *template; ++ template)
+    {
+        if (*template != '%')
+        {
+            *next ++ = '/' == *template ? '_' : *template;
+            continue;
+        }
+        switch (*++ template)
+        {
+            case 'f':
+                next += namestem(next, job->filename);
+                break;
+
+            case 'o':
+                next += sprintf(next, "%lx", (unsigned long) job->offset);
+                break;
+
+            case 's':
+                next += sprintf(next, "%dx%d", job->xsize, job->ysize);
+                break;
+
+            case 'c':
+                next += sprintf(next, "%d", job->chars);
+                break;
+
+            case 'n':
+                next += sprintf(next, "%d", job->line);
+                break;
+
+            default:
+                *next ++ = '%';
+                break;
+        }
+    }
+    sprintf(next, ".%s", FORMAT_PBM == format ? "pbm" : "png");
+    return name;
+}
+
+/*
+ * The part of an output file name that comes from the input file name:
+ * its base name without the extension. A file in a disk image is named
+ * after the image and the file, "fonts.d64:BIG FONT" giving
+ * "fonts-BIG_FONT", with anything but letters, digits, dots and dashes in
+ * the file name made underscores. The stem is written to dest, without
+ * a terminator, unless it is NULL. Returns its length.
+ */
+size_t namestem(char *dest, const char *filename)
+{
+    size_t pathlen = archivepath(filename), baselen, i;
+    const char *end, *base = filename, *dot = NULL, *member = NULL, *p;
+
+    if (pathlen) member = filename + pathlen + 1;
+    end = pathlen ? filename + pathlen : filename + strlen(filename);
+    for (p = filename; p < end; ++ p)
+    {
+        if ('/' == *p) base = p + 1;
+    }
+    for (p = base; p < end; ++ p)
+    {
+        if ('.' == *p) dot = p;
+    }
+    baselen = dot && dot != base ? (size_t) (dot - base)
+                                 : (size_t) (end - base);
+    if (!dest) return baselen + (member ? strlen(member) + 1 : 0);
+
+    memcpy(dest, base, baselen);
+    if (!member) return baselen;
+    dest[baselen] = '-';
+    for (i = 0; member[i]; ++ i)
+    {
+        dest[baselen + 1 + i] = isalnum((unsigned char) member[i]) ||
+                                '.' == member[i] || '-' == member[i]
+                                ? member[i] : '_';
+    }
+    return baselen + 1 + i;
+}
+
+/* Check that a name template is not empty and knows its placeholders */
+int checktemplate(const char *template)
+{
+    if (!*template) return -1;
+    while (*template)
+    {
+        if ('%' == *template ++)
+        {
+            if (!*template || !strchr("fosnc%", *template)) return -1;
+            ++ template;
+        }
+    }
+    return 0;
 }
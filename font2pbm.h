@@ -0,0 +1,232 @@
+/*
+ * font2pbm
+ * Convert Commodore 64 fonts to Portable Bitmap (PBM) images.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef FONT2PBM_H
+#define FONT2PBM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Size modes are given as x and y, the width and height of a character in
+ * 8x8 cells: 1x1, 1x2, 2x1 or 2x2. The font data for a multi-cell font
+ * is stored as all characters' first cell, then all second cells, and so
+ * on, as in the files written by the usual C64 font editors. A cell is
+ * eight bytes, one per scanline, unless the layout says otherwise: C128
+ * VDC character sets use 16 bytes per cell, either 16 scanlines or 8
+ * followed by 8 unused bytes.
+ */
+
+/* Holder structure for a portable bitmap */
+struct pbm
+{
+    int x, y;
+    char *data;
+};
+
+/*
+ * Arrangement of the characters in the font data and in the image. By
+ * default, or with a NULL layout, cells are 8x8 pixels in eight bytes and
+ * the image is 256 pixels wide with the characters packed row by row: 32
+ * characters per row in 1x1 and 1x2, 16 in 2x1 and 2x2.
+ */
+struct layout
+{
+    int perrow;                 /* Characters per row, 1..256, 0 default */
+    int padding;                /* Blank pixels between characters */
+    int columnmajor;            /* Fill each column top to bottom first */
+    int cellheight;             /* Scanlines per cell, 1..32, 0 for 8 */
+    int cellbytes;              /* Bytes per cell, at least cellheight */
+};
+
+#define LAYOUT_MAXPERROW 256
+#define LAYOUT_MAXPADDING 64
+#define LAYOUT_MAXCELLHEIGHT 32
+#define LAYOUT_MAXCELLBYTES 32
+
+/*
+ * Caller-owned buffer interface. None of these functions allocate memory,
+ * so they can be used on the hot path of a long-running server.
+ */
+
+/*
+ * Size of the buffer needed by formatpbm() for a font: the PBM header
+ * plus the image data. Returns 0 if the size mode or character count is
+ * invalid.
+ */
+size_t pbmsize(int x, int y, int numchars);
+
+/* Size of the image data alone, as written by renderpbm() */
+size_t pbmdatasize(int x, int y, int numchars);
+
+/*
+ * Check a font file already in memory. Returns a pointer to the font data
+ * just past the two byte load address, or NULL if the file is too short
+ * for the given size mode and character count. The load address is
+ * stored in *loadaddress unless it is NULL.
+ */
+const char *readfont(const char *file, size_t length, int x, int y,
+                     int numchars, unsigned *loadaddress);
+
+/*
+ * Convert font data into the image data of a PBM, in the caller's buffer
+ * of the given size. Returns 0 on success, or -1 if the parameters are
+ * invalid or the buffer is smaller than pbmdatasize().
+ */
+int renderpbm(int x, int y, const char *data, int numchars,
+              char *out, size_t size);
+
+/*
+ * Write a complete PBM file, header and image data, into the caller's
+ * buffer. Returns the number of bytes written, or 0 if the parameters are
+ * invalid or the buffer is smaller than pbmsize().
+ */
+size_t formatpbm(int x, int y, const char *data, int numchars,
+                 char *out, size_t size);
+
+/*
+ * The same for any layout. The image is layoutwidth() by layoutheight()
+ * pixels, each scanline padded to whole bytes; renderlayout() needs a
+ * buffer of at least layoutheight() * ((layoutwidth() + 7) / 8) bytes.
+ * The functions fail as above if the layout is invalid.
+ */
+int layoutwidth(int x, const struct layout *);
+int layoutheight(int x, int y, int numchars, const struct layout *);
+size_t layoutsize(int x, int y, int numchars, const struct layout *);
+
+/* Bytes of font data for a layout's cells, 0 if the layout is invalid */
+size_t fontdatasize(int x, int y, int numchars, const struct layout *);
+
+int renderlayout(int x, int y, const char *data, int numchars,
+                 const struct layout *, char *out, size_t size);
+size_t formatlayout(int x, int y, const char *data, int numchars,
+                    const struct layout *, char *out, size_t size);
+
+/* Result of detectfont() */
+struct detection
+{
+    int x, y, numchars;
+    unsigned loadaddress;
+    double confidence;          /* 0..1 */
+};
+
+/*
+ * Guess the size mode and character count of a font file in memory, from
+ * its length, its load address and how well the cells of multi-cell
+ * characters join up. Returns 0 with the most likely layout in *result,
+ * or -1 if the file cannot hold a font at all, is blank or looks like
+ * random data, or no layout scores.
+ */
+int detectfont(const char *file, size_t length, struct detection *result);
+
+/* The same for font data kept apart from its load address */
+int detectdata(const char *data, size_t length, unsigned loadaddress,
+               struct detection *result);
+
+/* Result of scanfont(): where a charset seems to start, and how surely */
+struct scanhit
+{
+    size_t offset;
+    double score;               /* 0..1 */
+};
+
+/*
+ * Look for 256 character 1x1 charsets inside other data, such as programs
+ * and memory dumps. A SCANWINDOW byte window slides over the data and is
+ * scored at every offset that is a multiple of step, 1 to try them all,
+ * for looking like glyphs rather than code or tables, then for the traits
+ * of a charset such as a blank space. The running counts make this one
+ * pass over the data. The best max windows that score at least 0.5 and
+ * don't overlap are stored in hits, best first; returns how many were
+ * found.
+ */
+#define SCANWINDOW 2048
+int scanfont(const char *data, size_t length, size_t step,
+             struct scanhit *hits, int max);
+
+/* Transforms for transformfont() */
+enum transformop
+{
+    TRANSFORM_HFLIP,            /* Mirror left to right */
+    TRANSFORM_VFLIP,            /* Mirror top to bottom */
+    TRANSFORM_ROTATE,           /* Quarter turn clockwise */
+    TRANSFORM_INVERT,           /* Swap set and clear pixels */
+    TRANSFORM_SHIFT             /* Move by dx, dy pixels, -7..7 each */
+};
+
+struct transform
+{
+    enum transformop op;
+    int dx, dy;                 /* For TRANSFORM_SHIFT, right and down */
+};
+
+/*
+ * Apply a list of transforms in order to every character of a font with
+ * the default 8x8 cells, writing the result to out, which must hold
+ * numchars * x * y * 8 bytes and may be the same as data. Pixels shifted
+ * out of a character are lost. A quarter turn swaps the width and height
+ * of the characters, so *x and *y are updated; with numchars 0 that is
+ * all that is done. Returns 0, or -1 if the parameters are invalid.
+ */
+int transformfont(int *x, int *y, const char *data, int numchars,
+                  const struct transform *, int count, char *out);
+
+/*
+ * Image formats. PNG files are 1-bit grayscale, compressed by a built-in
+ * deflate encoder either quickly, looking only for runs and repeated
+ * scanlines, or as well as it can.
+ */
+enum format
+{
+    FORMAT_PBM,
+    FORMAT_PNG,
+    FORMAT_PNGFAST
+};
+
+/*
+ * Encode an image of width by height pixels, scanlines padded to whole
+ * bytes and set bits black as in the PBM data, as a PNG file. The file
+ * is returned in a buffer that the caller frees. formatpngparallel()
+ * compresses large images on the given number of threads, with the same
+ * result as formatpng(). layoutpng() does the same for a font in a
+ * layout. Return 0, or -1 with errno set.
+ */
+int formatpng(const char *bitmap, int width, int height, int fast,
+              char **png, size_t *size);
+int formatpngparallel(const char *bitmap, int width, int height, int fast,
+                      int threads, char **png, size_t *size);
+int layoutpng(int x, int y, const char *data, int numchars,
+              const struct layout *, int fast, char **png, size_t *size);
+
+/*
+ * Standard I/O interface. createpbm() allocates the bitmap, which the
+ * caller frees; the other functions convert into a buffer of up to 64
+ * kilobytes and pass it to the stream in as few writes as they can.
+ */
+int pbmheight(int, int, int);
+void createband(int, int, const char *, int, int, char *);
+struct pbm createpbm(int, int, const char *, int chars);
+void printheader(int, int, FILE *);
+void printpbm(struct pbm, FILE *);
+int printpng(struct pbm, int fast, FILE *);
+int streambands(int, int, const char *, int, FILE *);
+int streampbm(int, int, const char *, int, FILE *);
+int streamlayout(int, int, const char *, int, const struct layout *, FILE *);
+
+#endif
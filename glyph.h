@@ -0,0 +1,130 @@
+/*
+ * font2pbm
+ * 8x8 glyph cells packed into 64-bit words.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * One 8x8 cell in a word: row 0 in the most significant byte and the
+ * leftmost pixel in the most significant bit of each row, so the word
+ * reads like the eight bytes of the cell in the font file. Whole-cell
+ * operations then become a handful of shifts and masks.
+ */
+typedef uint64_t glyph;
+
+/* Each byte of the word set to b */
+#define GLYPHBYTES(b) (0x0101010101010101ULL * (uint8_t) (b))
+
+static inline glyph loadglyph(const char *cell)
+{
+    glyph g;
+
+    memcpy(&g, cell, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    g = __builtin_bswap64(g);
+#endif
+    return g;
+}
+
+static inline void storeglyph(char *cell, glyph g)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    g = __builtin_bswap64(g);
+#endif
+    memcpy(cell, &g, 8);
+}
+
+/* Mirror left to right, reversing the bits of every row */
+static inline glyph hflipglyph(glyph g)
+{
+    g = ((g >> 1) & GLYPHBYTES(0x55)) | ((g & GLYPHBYTES(0x55)) << 1);
+    g = ((g >> 2) & GLYPHBYTES(0x33)) | ((g & GLYPHBYTES(0x33)) << 2);
+    g = ((g >> 4) & GLYPHBYTES(0x0f)) | ((g & GLYPHBYTES(0x0f)) << 4);
+    return g;
+}
+
+/* Mirror top to bottom, reversing the rows */
+static inline glyph vflipglyph(glyph g)
+{
+    return __builtin_bswap64(g);
+}
+
+/*
+ * Swap rows and columns, mirroring the cell in its main diagonal. Three
+ * rounds of exchanging off-diagonal 1x1, 2x2 and 4x4 blocks.
+ */
+static inline glyph transposeglyph(glyph g)
+{
+    glyph t;
+
+    t = (g ^ (g >> 7)) & 0x00aa00aa00aa00aaULL;
+    g ^= t ^ (t << 7);
+    t = (g ^ (g >> 14)) & 0x0000cccc0000ccccULL;
+    g ^= t ^ (t << 14);
+    t = (g ^ (g >> 28)) & 0x00000000f0f0f0f0ULL;
+    g ^= t ^ (t << 28);
+    return g;
+}
+
+/* Quarter turn clockwise */
+static inline glyph rotateglyph(glyph g)
+{
+    return hflipglyph(transposeglyph(g));
+}
+
+/*
+ * Move the pixels n columns right, 1 <= n <= 7, filling in from the cell
+ * to the left, or n columns left filling in from the cell to the right.
+ */
+static inline glyph shiftrightglyph(glyph g, glyph left, int n)
+{
+    return ((g >> n) & GLYPHBYTES(0xff >> n)) |
+           ((left << (8 - n)) & GLYPHBYTES(0xff << (8 - n)));
+}
+
+static inline glyph shiftleftglyph(glyph g, glyph right, int n)
+{
+    return ((g << n) & GLYPHBYTES(0xff << n)) |
+           ((right >> (8 - n)) & GLYPHBYTES(0xff >> (8 - n)));
+}
+
+/* The same for rows, 1 <= n <= 7, filling in from the cell above or below */
+static inline glyph shiftdownglyph(glyph g, glyph above, int n)
+{
+    return (g >> (8 * n)) | (above << (64 - 8 * n));
+}
+
+static inline glyph shiftupglyph(glyph g, glyph below, int n)
+{
+    return (g << (8 * n)) | (below >> (64 - 8 * n));
+}
+
+/* Number of set pixels, adding up bits in ever wider fields */
+static inline int popcountglyph(glyph g)
+{
+    g -= (g >> 1) & GLYPHBYTES(0x55);
+    g = (g & GLYPHBYTES(0x33)) + ((g >> 2) & GLYPHBYTES(0x33));
+    g = (g + (g >> 4)) & GLYPHBYTES(0x0f);
+    return (int) ((g * GLYPHBYTES(1)) >> 56);
+}
+
+#endif
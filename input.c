@@ -0,0 +1,313 @@
+/*
+ * font2pbm
+ * Font file input, memory mapped where possible.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "archive.h"
+#include "snapshot.h"
+#include "input.h"
+
+static int readall(struct input *, int);
+static int readmember(struct input *, const char *);
+static int usemember(struct input *, const struct archive *,
+                     const struct archivefile *);
+static int setdata(struct input *, const char *, size_t);
+static int openfile(struct input *, const char *, struct arena *, int);
+static void initinput(struct input *, struct arena *, int);
+
+int openinput(struct input *input, const char *filename,
+              struct arena *arena)
+{
+    return openfile(input, filename, arena, 0);
+}
+
+int openrawinput(struct input *input, const char *filename,
+                 struct arena *arena)
+{
+    return openfile(input, filename, arena, 1);
+}
+
+int openmemberinput(struct input *input, const struct archive *archive,
+                    const struct archivefile *file, struct arena *arena)
+{
+    initinput(input, arena, 0);
+    return usemember(input, archive, file);
+}
+
+static int openfile(struct input *input, const char *filename,
+                    struct arena *arena, int raw)
+{
+    struct stat st;
+    int fd, rc;
+
+    initinput(input, arena, raw);
+    if (!filename)
+    {
+        return readall(input, STDIN_FILENO);
+    }
+    if (archivepath(filename))
+    {
+        return readmember(input, filename);
+    }
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    /* Map regular files, read everything else */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            close(fd);
+            input->map = map;
+            input->maplength = st.st_size;
+            if (setdata(input, map, st.st_size) != 0)
+            {
+                closeinput(input);
+                errno = EINVAL;
+                return -1;
+            }
+            return 0;
+        }
+    }
+
+    rc = readall(input, fd);
+    if (rc != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return rc;
+    }
+    close(fd);
+    return 0;
+}
+
+void closeinput(struct input *input)
+{
+    if (input->map)
+    {
+        munmap(input->map, input->maplength);
+    }
+    if (!input->arena)
+    {
+        free(input->buffer);
+    }
+    input->map = NULL;
+    input->buffer = NULL;
+    input->data = NULL;
+    input->length = 0;
+}
+
+/* Slurp a non-mappable file into a growing buffer */
+static int readall(struct input *input, int fd)
+{
+    size_t size = 0, allocated = 4096;
+    char *buffer;
+
+    if (input->arena)
+    {
+        buffer = arenaalloc(input->arena, allocated);
+    }
+    else
+    {
+        buffer = malloc(allocated);
+    }
+    if (!buffer) return -1;
+    for (;;)
+    {
+        ssize_t got;
+
+        if (size == allocated)
+        {
+            char *grown;
+
+            if (input->arena)
+            {
+                grown = arenagrow(input->arena, buffer, size, allocated * 2);
+            }
+            else
+            {
+                grown = realloc(buffer, allocated * 2);
+            }
+            if (!grown)
+            {
+                if (!input->arena) free(buffer);
+                return -1;
+            }
+            buffer = grown;
+            allocated *= 2;
+        }
+
+        got = read(fd, buffer + size, allocated - size);
+        if (got < 0)
+        {
+            int saved;
+
+            if (EINTR == errno) continue;
+            saved = errno;
+            if (!input->arena) free(buffer);
+            errno = saved;
+            return -1;
+        }
+        if (0 == got) break;
+        size += got;
+    }
+
+    input->buffer = buffer;
+    if (setdata(input, buffer, size) != 0)
+    {
+        closeinput(input);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Open an image, find a file in it and use it, as openmemberinput() */
+static int readmember(struct input *input, const char *name)
+{
+    size_t pathlength = archivepath(name);
+    struct archive archive;
+    struct archivefile file;
+    char *path;
+    int saved, rc = -1;
+
+    path = malloc(pathlength + 1);
+    if (!path) return -1;
+    memcpy(path, name, pathlength);
+    path[pathlength] = 0;
+    if (openarchive(&archive, path) != 0)
+    {
+        saved = errno;
+        free(path);
+        errno = saved;
+        return -1;
+    }
+    free(path);
+
+    if (findarchivefile(&archive, name + pathlength + 1, &file) == 0)
+    {
+        rc = usemember(input, &archive, &file);
+    }
+
+    /* A file used in place needs the mapping of the image, which is ours */
+    if (0 == rc && !input->buffer)
+    {
+        input->map = archive.map;
+        input->maplength = archive.maplength;
+        return 0;
+    }
+    saved = errno;
+    closearchive(&archive);
+    errno = saved;
+    return rc;
+}
+
+/*
+ * Use a file in an open image in place if it is stored in one piece,
+ * with its load address kept apart, or else read it into a buffer
+ */
+static int usemember(struct input *input, const struct archive *archive,
+                     const struct archivefile *file)
+{
+    const char *data;
+    char *buffer;
+    unsigned loadaddress;
+
+    data = input->raw ? NULL : archivefiledata(archive, file, &loadaddress);
+    if (data)
+    {
+        input->data = data;
+        input->length = file->length - 2;
+        input->loadaddress = loadaddress;
+        return 0;
+    }
+
+    if (input->arena)
+    {
+        buffer = arenaalloc(input->arena, file->length ? file->length : 1);
+    }
+    else
+    {
+        buffer = malloc(file->length ? file->length : 1);
+    }
+    if (!buffer) return -1;
+    if (readarchivefile(archive, file, buffer) != 0)
+    {
+        if (!input->arena) free(buffer);
+        return -1;
+    }
+
+    input->buffer = buffer;
+    if (setdata(input, buffer, file->length) != 0)
+    {
+        closeinput(input);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Split off the load address, or find the charset in a snapshot */
+static int setdata(struct input *input, const char *file, size_t size)
+{
+    if (input->raw)
+    {
+        input->data = file;
+        input->length = size;
+        return 0;
+    }
+    if (issnapshot(file, size))
+    {
+        unsigned address;
+        const char *charset = snapshotcharset(file, size, &address);
+
+        if (!charset) return -1;
+        input->data = charset;
+        input->length = SNAPSHOT_CHARSET;
+        input->loadaddress = address;
+        return 0;
+    }
+    if (size < 2) return -1;
+    input->loadaddress = (unsigned char) file[0] |
+                         ((unsigned char) file[1] << 8);
+    input->data = file + 2;
+    input->length = size - 2;
+    return 0;
+}
+
+static void initinput(struct input *input, struct arena *arena, int raw)
+{
+    input->data = NULL;
+    input->length = 0;
+    input->loadaddress = 0;
+    input->map = NULL;
+    input->maplength = 0;
+    input->buffer = NULL;
+    input->arena = arena;
+    input->raw = raw;
+}
@@ -0,0 +1,82 @@
+/*
+ * font2pbm
+ * Font file input, memory mapped where possible.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+struct arena;
+struct archive;
+struct archivefile;
+
+/*
+ * An opened font file. data points just past the two byte load address
+ * and is valid until closeinput() is called. Regular files are mapped
+ * and used in place; pipes and terminals are read into a buffer that
+ * grows as needed, so there is no upper limit on the font size. Files
+ * inside images, named as described for archivepath(), are used in
+ * place in the mapped image if they are stored in one piece, as on tapes
+ * and cartridges, and are otherwise copied out into a buffer. The buffer
+ * comes from an arena if one is given, and is then released with the
+ * arena rather than by closeinput(). A VICE snapshot is not a font file
+ * but stands for the charset on screen when it was taken: data points
+ * to those 2048 bytes inside it and the load address is where the VIC-II
+ * found them.
+ */
+struct input
+{
+    const char *data;
+    size_t length;
+    unsigned loadaddress;
+
+    /* Private */
+    void *map;
+    size_t maplength;
+    char *buffer;
+    struct arena *arena;
+    int raw;
+};
+
+/*
+ * Open a font file, or stdin if filename is NULL, reading into arena if
+ * it is not NULL. Returns 0 on success, or -1 with errno set. Files
+ * shorter than the load address fail with EINVAL.
+ */
+int openinput(struct input *, const char *filename, struct arena *);
+
+/*
+ * Open a file as it is, to take slices of at offsets: data is the whole
+ * file with its load address and loadaddress is 0. Snapshots are not
+ * looked into, and files in images are always copied out.
+ */
+int openrawinput(struct input *, const char *filename, struct arena *);
+
+/*
+ * Open a file in an image that is already open, as listed by
+ * nextarchivefile(), so that an image holding many fonts is only opened
+ * and searched once. The image must stay open until closeinput().
+ */
+int openmemberinput(struct input *, const struct archive *,
+                    const struct archivefile *, struct arena *);
+
+/* Release the data of an opened input */
+void closeinput(struct input *);
+
+#endif
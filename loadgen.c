@@ -0,0 +1,232 @@
+/*
+ * font2pbm
+ * Load generator for the conversion daemon.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "font2pbm.h"
+#include "stats.h"
+#include "server.h"
+
+/*
+ * Each client thread opens one connection and sends its requests back to
+ * back, timing every round trip. The fonts follow the batch corpus: 1x1
+ * with 64 characters, with every eighth request a 2x2 one of 256.
+ */
+struct client
+{
+    const char *path;
+    int requests;
+    unsigned long long *latency;
+    int failed;
+    char error[256];
+};
+
+/* Every client sends the same font data, only the layout varies */
+static char font[2 + 256 * 4 * 8];
+
+static void *clientmain(void *);
+static int compare(const void *, const void *);
+static int readall(int, char *, size_t);
+static int writeall(int, const char *, size_t);
+
+int main(int argc, char *argv[])
+{
+    struct client *clients;
+    pthread_t *handles;
+    unsigned long long *all, start, wall;
+    int numclients = 4, requests = 10000, i, total, failed = 0;
+
+    if (argc < 2 || argc > 4 ||
+        (argc > 2 && (sscanf(argv[2], "%d", &numclients) != 1 ||
+                      numclients < 1)) ||
+        (argc > 3 && (sscanf(argv[3], "%d", &requests) != 1 ||
+                      requests < 1)))
+    {
+        printf("Usage: %s socket [clients [requests per client]]\n",
+               argv[0]);
+        return 1;
+    }
+
+    total = numclients * requests;
+    clients = calloc(numclients, sizeof (struct client));
+    handles = malloc(numclients * sizeof (pthread_t));
+    all = malloc(total * sizeof (unsigned long long));
+    if (!clients || !handles || !all)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", argv[0]);
+        return 1;
+    }
+
+    /* Load address $3000, then pseudo-random glyph data */
+    font[0] = 0x00;
+    font[1] = 0x30;
+    for (i = 2; i < (int) sizeof font; ++ i)
+    {
+        font[i] = (char) (i * 2654435761u >> 13);
+    }
+
+    start = nanotime();
+    for (i = 0; i < numclients; ++ i)
+    {
+        clients[i].path = argv[1];
+        clients[i].requests = requests;
+        clients[i].latency = all + i * requests;
+        if (pthread_create(&handles[i], NULL, clientmain, &clients[i]) != 0)
+        {
+            fprintf(stderr, "%s: Can't start thread\n", argv[0]);
+            return 1;
+        }
+    }
+    for (i = 0; i < numclients; ++ i)
+    {
+        pthread_join(handles[i], NULL);
+        if (clients[i].failed)
+        {
+            fprintf(stderr, "%s: %s\n", argv[0], clients[i].error);
+            failed = 1;
+        }
+    }
+    wall = nanotime() - start;
+    if (failed) return 1;
+
+    qsort(all, total, sizeof (unsigned long long), compare);
+    printf("{\"clients\":%d,\"requests\":%d,\"wall_s\":%.3f,"
+           "\"requests_per_s\":%.1f,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+           "\"max_us\":%.1f}\n",
+           numclients, total, wall / 1e9, total / (wall / 1e9),
+           all[total / 2] / 1e3, all[(int) (total * 0.99)] / 1e3,
+           all[total - 1] / 1e3);
+
+    free(all);
+    free(handles);
+    free(clients);
+    return 0;
+}
+
+static void *clientmain(void *arg)
+{
+    struct client *client = arg;
+    struct sockaddr_un addr;
+    unsigned char request[SERVER_HEADER], header[SERVER_HEADER];
+    char *response;
+    size_t maxsize = pbmsize(2, 2, 256);
+    int fd, i;
+
+    response = malloc(maxsize);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, client->path, sizeof addr.sun_path - 1);
+    if (!response || fd < 0 ||
+        connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0)
+    {
+        snprintf(client->error, sizeof client->error,
+                 "Can't connect to \"%s\": %s", client->path,
+                 strerror(errno));
+        client->failed = 1;
+        if (fd >= 0) close(fd);
+        free(response);
+        return NULL;
+    }
+
+    for (i = 0; i < client->requests; ++ i)
+    {
+        int big = 7 == i % 8;
+        int x = big ? 2 : 1, chars = big ? 256 : 64;
+        size_t length = 2 + chars * x * x * 8, size;
+        unsigned long long start = nanotime();
+
+        request[0] = x;
+        request[1] = x;
+        request[2] = chars >> 8;
+        request[3] = chars & 0xff;
+        request[4] = request[5] = 0;
+        request[6] = length >> 8;
+        request[7] = length & 0xff;
+        if (writeall(fd, (const char *) request, sizeof request) != 0 ||
+            writeall(fd, font, length) != 0 ||
+            readall(fd, (char *) header, sizeof header) != 0)
+        {
+            snprintf(client->error, sizeof client->error,
+                     "Connection lost: %s", strerror(errno));
+            client->failed = 1;
+            break;
+        }
+
+        size = ((size_t) header[4] << 24) | (header[5] << 16) |
+               (header[6] << 8) | header[7];
+        if (header[0] != SERVER_OK || size != pbmsize(x, x, chars) ||
+            readall(fd, response, size) != 0)
+        {
+            snprintf(client->error, sizeof client->error,
+                     "Bad response to request %d", i);
+            client->failed = 1;
+            break;
+        }
+        client->latency[i] = nanotime() - start;
+    }
+
+    close(fd);
+    free(response);
+    return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Read exactly length bytes. Returns 0, or -1 on end of file or error */
+static int readall(int fd, char *buffer, size_t length)
+{
+    while (length)
+    {
+        ssize_t got = read(fd, buffer, length);
+
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0) return -1;
+        buffer += got;
+        length -= got;
+    }
+    return 0;
+}
+
+/* Write all of a buffer. Returns 0, or -1 on error */
+static int writeall(int fd, const char *buffer, size_t length)
+{
+    while (length)
+    {
+        ssize_t sent = write(fd, buffer, length);
+
+        if (sent < 0 && EINTR == errno) continue;
+        if (sent < 0) return -1;
+        buffer += sent;
+        length -= sent;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * mkcorpus
+ * Generate a deterministic synthetic corpus of Commodore 64 fonts for
+ * benchmarking font2pbm.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * The corpus mimics the archive: mostly small 1x1 fonts of 64 characters,
+ * with every eighth font a 2x2 one of 256 characters, sixteen times the
+ * size. The file list is written to stdout in the batch manifest format,
+ * so it can be piped straight into "font2pbm -o dir".
+ */
+int main(int argc, char *argv[])
+{
+    unsigned long seed;
+    int count, i;
+
+    if (argc != 3 || sscanf(argv[2], "%d", &count) != 1 || count < 0)
+    {
+        printf("Usage: %s dir count\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 0; i < count; ++ i)
+    {
+        int big = 7 == i % 8;
+        int xsize = big ? 2 : 1, ysize = big ? 2 : 1, chars = big ? 256 : 64;
+        long bytes = chars * xsize * ysize * 8, j;
+        char name[4096];
+        FILE *f;
+
+        snprintf(name, sizeof name, "%s/font%06d.prg", argv[1], i);
+        f = fopen(name, "wb");
+        if (!f)
+        {
+            perror(name);
+            return 1;
+        }
+
+        /* Load address $3000, then pseudo-random glyph data */
+        fputc(0x00, f);
+        fputc(0x30, f);
+        seed = 12345 + i;
+        for (j = 0; j < bytes; ++ j)
+        {
+            seed = seed * 1103515245 + 12345;
+            fputc((int) (seed >> 16) & 0xff, f);
+        }
+        if (fclose(f) != 0)
+        {
+            perror(name);
+            return 1;
+        }
+
+        printf("%dx%d %d %s\n", xsize, ysize, chars, name);
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * font2pbm
+ * Buffered output with few system calls.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include "output.h"
+
+/* Buffers start on a page and are a whole number of pages */
+#define OUTPUT_ALIGN 4096
+
+static int writebuffered(struct output *, const char *, size_t);
+static int copyfrom(struct output *, int, size_t);
+static int fail(struct output *);
+
+int openoutput(struct output *out, int fd, FILE *file, size_t size)
+{
+    void *buffer;
+
+    if (size < OUTPUT_MINSIZE) size = OUTPUT_MINSIZE;
+    if (size > OUTPUT_MAXSIZE) size = OUTPUT_MAXSIZE;
+    size = (size + OUTPUT_ALIGN - 1) & ~(size_t) (OUTPUT_ALIGN - 1);
+    if (posix_memalign(&buffer, OUTPUT_ALIGN, size) != 0)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    out->fd = fd;
+    out->file = file;
+    out->buffer = buffer;
+    out->size = size;
+    out->used = 0;
+    out->pipe = -1;
+    out->error = 0;
+    out->syscalls = 0;
+    return 0;
+}
+
+void attachoutput(struct output *out, int fd)
+{
+    out->fd = fd;
+    out->used = 0;
+    out->pipe = 0;
+    out->error = 0;
+    out->syscalls = 0;
+}
+
+char *outputreserve(struct output *out, size_t size)
+{
+    if (out->error)
+    {
+        fail(out);
+        return NULL;
+    }
+    if (size > out->size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (size > out->size - out->used && flushoutput(out) != 0) return NULL;
+    return out->buffer + out->used;
+}
+
+void outputcommit(struct output *out, size_t size)
+{
+    out->used += size;
+}
+
+int outputwrite(struct output *out, const void *data, size_t size)
+{
+    if (out->error) return fail(out);
+
+    /* Small writes are collected, anything else goes out with them */
+    if (size <= out->size - out->used)
+    {
+        memcpy(out->buffer + out->used, data, size);
+        out->used += size;
+        return 0;
+    }
+    return writebuffered(out, data, size);
+}
+
+int outputfill(struct output *out, int c, size_t size)
+{
+    while (size)
+    {
+        size_t chunk = size < out->size ? size : out->size;
+        char *space = outputreserve(out, chunk);
+
+        if (!space) return -1;
+        memset(space, c, chunk);
+        outputcommit(out, chunk);
+        size -= chunk;
+    }
+    return 0;
+}
+
+int outputfrom(struct output *out, int fd, size_t size)
+{
+    loff_t offset = 0;
+
+    if (flushoutput(out) != 0) return -1;
+    if (out->pipe < 0)
+    {
+        struct stat st;
+
+        out->pipe = fstat(out->fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    }
+
+    /* Let the kernel move the data, unless it can't for these files */
+    while (out->fd >= 0 && offset < (loff_t) size)
+    {
+        ssize_t done;
+
+        if (out->pipe)
+        {
+            done = splice(fd, &offset, out->fd, NULL, size - offset,
+                          SPLICE_F_MOVE);
+        }
+        else
+        {
+            off_t start = offset;
+
+            done = sendfile(out->fd, fd, &start, size - offset);
+            if (done > 0) offset = start;
+        }
+        ++ out->syscalls;
+        if (done < 0 && EINTR == errno) continue;
+        if (done < 0 && 0 == offset && (EINVAL == errno || ENOSYS == errno))
+        {
+            break;
+        }
+        if (done < 0)
+        {
+            out->error = errno;
+            return -1;
+        }
+        if (0 == done)
+        {
+            /* The file is shorter than promised */
+            out->error = EIO;
+            return fail(out);
+        }
+    }
+    if (offset == (loff_t) size) return 0;
+    return copyfrom(out, fd, size);
+}
+
+int flushoutput(struct output *out)
+{
+    return writebuffered(out, NULL, 0);
+}
+
+int closeoutput(struct output *out)
+{
+    int rc = flushoutput(out);
+
+    free(out->buffer);
+    out->buffer = NULL;
+    out->size = out->used = 0;
+    return rc;
+}
+
+/*
+ * Write the buffer followed by size bytes of data, emptying the buffer.
+ * With a descriptor this is a single writev() unless it is cut short.
+ */
+static int writebuffered(struct output *out, const char *data, size_t size)
+{
+    struct iovec iov[2], *next = iov;
+    int count = 0;
+
+    if (out->error) return fail(out);
+    if (out->used)
+    {
+        iov[count].iov_base = out->buffer;
+        iov[count ++].iov_len = out->used;
+    }
+    if (size)
+    {
+        iov[count].iov_base = (char *) data;
+        iov[count ++].iov_len = size;
+    }
+
+    while (count)
+    {
+        ssize_t done;
+
+        if (out->fd < 0)
+        {
+            done = fwrite(next->iov_base, 1, next->iov_len, out->file);
+            ++ out->syscalls;
+            if (done != (ssize_t) next->iov_len)
+            {
+                out->error = errno ? errno : EIO;
+                return -1;
+            }
+        }
+        else
+        {
+            done = writev(out->fd, next, count);
+            ++ out->syscalls;
+            if (done < 0)
+            {
+                if (EINTR == errno) continue;
+                out->error = errno;
+                return -1;
+            }
+        }
+
+        /* Skip what has been written */
+        while (count && (size_t) done >= next->iov_len)
+        {
+            done -= next->iov_len;
+            ++ next;
+            -- count;
+        }
+        if (count)
+        {
+            next->iov_base = (char *) next->iov_base + done;
+            next->iov_len -= done;
+        }
+    }
+    out->used = 0;
+    return 0;
+}
+
+/* Copy a file through the buffer, for when the kernel can't */
+static int copyfrom(struct output *out, int fd, size_t size)
+{
+    off_t offset = 0;
+
+    while ((size_t) offset < size)
+    {
+        size_t chunk = size - offset < out->size ? size - offset : out->size;
+        char *space = outputreserve(out, chunk);
+        ssize_t got;
+
+        if (!space) return -1;
+        got = pread(fd, space, chunk, offset);
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0)
+        {
+            out->error = got < 0 ? errno : EIO;
+            return -1;
+        }
+        outputcommit(out, got);
+        offset += got;
+    }
+    return 0;
+}
+
+/* Report the error that stopped the output */
+static int fail(struct output *out)
+{
+    errno = out->error;
+    return -1;
+}
@@ -0,0 +1,97 @@
+/*
+ * font2pbm
+ * Buffered output with few system calls.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Output is collected in one page aligned buffer and reaches the
+ * descriptor in as few calls as possible. Writes that do not fit go out
+ * together with what is buffered in a single writev(), converters can
+ * render straight into the buffer with outputreserve(), and whole files
+ * are copied with splice() or sendfile() without passing through user
+ * space. Streams without a descriptor of their own are written with
+ * fwrite() instead.
+ *
+ * After the first error every call fails with the same errno, so callers
+ * only need to check the result of closeoutput().
+ */
+struct output
+{
+    int fd;                     /* Descriptor, or -1 to use file */
+    FILE *file;
+    char *buffer;
+    size_t size, used;
+    int pipe;                   /* fd is a pipe, -1 until known */
+    int error;                  /* errno of the first failure, or 0 */
+    unsigned long syscalls;     /* Calls made to write the output */
+};
+
+/*
+ * Limits for the buffer size. The largest is what a pipe holds by
+ * default; bigger buffers cost more in page faults than they save in
+ * calls.
+ */
+#define OUTPUT_MINSIZE 4096
+#define OUTPUT_MAXSIZE 65536
+
+/*
+ * Set up output to fd, or to file if fd is -1, with a buffer big enough
+ * for size bytes within the limits above. size is a hint, usually the
+ * size of the image. Returns 0, or -1 if out of memory.
+ */
+int openoutput(struct output *, int fd, FILE *file, size_t size);
+
+/*
+ * Switch a flushed output to another descriptor, which must not be a
+ * pipe, keeping the buffer. Clears the error and the call counter.
+ */
+void attachoutput(struct output *, int fd);
+
+/*
+ * Get room for size bytes in the buffer, flushing it first if needed.
+ * The bytes are added by outputcommit(). Returns NULL with errno set on
+ * failure, or if size is more than the buffer holds.
+ */
+char *outputreserve(struct output *, size_t size);
+void outputcommit(struct output *, size_t size);
+
+/* Add data, or size bytes of c. Return 0, or -1 with errno set */
+int outputwrite(struct output *, const void *, size_t size);
+int outputfill(struct output *, int c, size_t size);
+
+/*
+ * Add size bytes read from fd, starting at its beginning. Returns 0, or
+ * -1 with errno set.
+ */
+int outputfrom(struct output *, int fd, size_t size);
+
+/* Write out what is buffered. Returns 0, or -1 with errno set */
+int flushoutput(struct output *);
+
+/*
+ * Flush and release the buffer. The descriptor or stream is left open.
+ * Returns 0, or -1 with errno set if anything failed.
+ */
+int closeoutput(struct output *);
+
+#endif
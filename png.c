@@ -0,0 +1,348 @@
+/*
+ * font2pbm
+ * PNG output.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "convert.h"
+#include "deflate.h"
+#include "pool.h"
+
+/*
+ * Everything before the compressed data: the signature, the header chunk
+ * and the start of the data chunk
+ */
+#define PNGSIGNATURE "\211PNG\r\n\032\n"
+#define PNGPREFIX (8 + 12 + 13 + 8)
+
+/*
+ * Scanlines are compressed in chunks of about this many bytes, each of
+ * which can go to a different thread. The chunks only depend on the size
+ * of the image, so the file is the same whatever the number of threads.
+ * Matches reach back into the previous chunk by up to PNGDICTIONARY
+ * bytes, the whole deflate window, so little is lost by the split.
+ */
+#define PNGCHUNK 131072
+#define PNGDICTIONARY 32768
+
+/* Filtered scanlines being compressed */
+struct pngchunks
+{
+    const unsigned char *raw;
+    size_t rawsize, chunksize, rowlength;
+    int level;
+    struct deflatestream *streams;
+    unsigned long *adlers;
+};
+
+/* CRC-32 of each byte value, for the chunk checksums */
+static const unsigned long crctable[256] =
+{
+    0x00000000UL, 0x77073096UL, 0xee0e612cUL, 0x990951baUL,
+    0x076dc419UL, 0x706af48fUL, 0xe963a535UL, 0x9e6495a3UL,
+    0x0edb8832UL, 0x79dcb8a4UL, 0xe0d5e91eUL, 0x97d2d988UL,
+    0x09b64c2bUL, 0x7eb17cbdUL, 0xe7b82d07UL, 0x90bf1d91UL,
+    0x1db71064UL, 0x6ab020f2UL, 0xf3b97148UL, 0x84be41deUL,
+    0x1adad47dUL, 0x6ddde4ebUL, 0xf4d4b551UL, 0x83d385c7UL,
+    0x136c9856UL, 0x646ba8c0UL, 0xfd62f97aUL, 0x8a65c9ecUL,
+    0x14015c4fUL, 0x63066cd9UL, 0xfa0f3d63UL, 0x8d080df5UL,
+    0x3b6e20c8UL, 0x4c69105eUL, 0xd56041e4UL, 0xa2677172UL,
+    0x3c03e4d1UL, 0x4b04d447UL, 0xd20d85fdUL, 0xa50ab56bUL,
+    0x35b5a8faUL, 0x42b2986cUL, 0xdbbbc9d6UL, 0xacbcf940UL,
+    0x32d86ce3UL, 0x45df5c75UL, 0xdcd60dcfUL, 0xabd13d59UL,
+    0x26d930acUL, 0x51de003aUL, 0xc8d75180UL, 0xbfd06116UL,
+    0x21b4f4b5UL, 0x56b3c423UL, 0xcfba9599UL, 0xb8bda50fUL,
+    0x2802b89eUL, 0x5f058808UL, 0xc60cd9b2UL, 0xb10be924UL,
+    0x2f6f7c87UL, 0x58684c11UL, 0xc1611dabUL, 0xb6662d3dUL,
+    0x76dc4190UL, 0x01db7106UL, 0x98d220bcUL, 0xefd5102aUL,
+    0x71b18589UL, 0x06b6b51fUL, 0x9fbfe4a5UL, 0xe8b8d433UL,
+    0x7807c9a2UL, 0x0f00f934UL, 0x9609a88eUL, 0xe10e9818UL,
+    0x7f6a0dbbUL, 0x086d3d2dUL, 0x91646c97UL, 0xe6635c01UL,
+    0x6b6b51f4UL, 0x1c6c6162UL, 0x856530d8UL, 0xf262004eUL,
+    0x6c0695edUL, 0x1b01a57bUL, 0x8208f4c1UL, 0xf50fc457UL,
+    0x65b0d9c6UL, 0x12b7e950UL, 0x8bbeb8eaUL, 0xfcb9887cUL,
+    0x62dd1ddfUL, 0x15da2d49UL, 0x8cd37cf3UL, 0xfbd44c65UL,
+    0x4db26158UL, 0x3ab551ceUL, 0xa3bc0074UL, 0xd4bb30e2UL,
+    0x4adfa541UL, 0x3dd895d7UL, 0xa4d1c46dUL, 0xd3d6f4fbUL,
+    0x4369e96aUL, 0x346ed9fcUL, 0xad678846UL, 0xda60b8d0UL,
+    0x44042d73UL, 0x33031de5UL, 0xaa0a4c5fUL, 0xdd0d7cc9UL,
+    0x5005713cUL, 0x270241aaUL, 0xbe0b1010UL, 0xc90c2086UL,
+    0x5768b525UL, 0x206f85b3UL, 0xb966d409UL, 0xce61e49fUL,
+    0x5edef90eUL, 0x29d9c998UL, 0xb0d09822UL, 0xc7d7a8b4UL,
+    0x59b33d17UL, 0x2eb40d81UL, 0xb7bd5c3bUL, 0xc0ba6cadUL,
+    0xedb88320UL, 0x9abfb3b6UL, 0x03b6e20cUL, 0x74b1d29aUL,
+    0xead54739UL, 0x9dd277afUL, 0x04db2615UL, 0x73dc1683UL,
+    0xe3630b12UL, 0x94643b84UL, 0x0d6d6a3eUL, 0x7a6a5aa8UL,
+    0xe40ecf0bUL, 0x9309ff9dUL, 0x0a00ae27UL, 0x7d079eb1UL,
+    0xf00f9344UL, 0x8708a3d2UL, 0x1e01f268UL, 0x6906c2feUL,
+    0xf762575dUL, 0x806567cbUL, 0x196c3671UL, 0x6e6b06e7UL,
+    0xfed41b76UL, 0x89d32be0UL, 0x10da7a5aUL, 0x67dd4accUL,
+    0xf9b9df6fUL, 0x8ebeeff9UL, 0x17b7be43UL, 0x60b08ed5UL,
+    0xd6d6a3e8UL, 0xa1d1937eUL, 0x38d8c2c4UL, 0x4fdff252UL,
+    0xd1bb67f1UL, 0xa6bc5767UL, 0x3fb506ddUL, 0x48b2364bUL,
+    0xd80d2bdaUL, 0xaf0a1b4cUL, 0x36034af6UL, 0x41047a60UL,
+    0xdf60efc3UL, 0xa867df55UL, 0x316e8eefUL, 0x4669be79UL,
+    0xcb61b38cUL, 0xbc66831aUL, 0x256fd2a0UL, 0x5268e236UL,
+    0xcc0c7795UL, 0xbb0b4703UL, 0x220216b9UL, 0x5505262fUL,
+    0xc5ba3bbeUL, 0xb2bd0b28UL, 0x2bb45a92UL, 0x5cb36a04UL,
+    0xc2d7ffa7UL, 0xb5d0cf31UL, 0x2cd99e8bUL, 0x5bdeae1dUL,
+    0x9b64c2b0UL, 0xec63f226UL, 0x756aa39cUL, 0x026d930aUL,
+    0x9c0906a9UL, 0xeb0e363fUL, 0x72076785UL, 0x05005713UL,
+    0x95bf4a82UL, 0xe2b87a14UL, 0x7bb12baeUL, 0x0cb61b38UL,
+    0x92d28e9bUL, 0xe5d5be0dUL, 0x7cdcefb7UL, 0x0bdbdf21UL,
+    0x86d3d2d4UL, 0xf1d4e242UL, 0x68ddb3f8UL, 0x1fda836eUL,
+    0x81be16cdUL, 0xf6b9265bUL, 0x6fb077e1UL, 0x18b74777UL,
+    0x88085ae6UL, 0xff0f6a70UL, 0x66063bcaUL, 0x11010b5cUL,
+    0x8f659effUL, 0xf862ae69UL, 0x616bffd3UL, 0x166ccf45UL,
+    0xa00ae278UL, 0xd70dd2eeUL, 0x4e048354UL, 0x3903b3c2UL,
+    0xa7672661UL, 0xd06016f7UL, 0x4969474dUL, 0x3e6e77dbUL,
+    0xaed16a4aUL, 0xd9d65adcUL, 0x40df0b66UL, 0x37d83bf0UL,
+    0xa9bcae53UL, 0xdebb9ec5UL, 0x47b2cf7fUL, 0x30b5ffe9UL,
+    0xbdbdf21cUL, 0xcabac28aUL, 0x53b39330UL, 0x24b4a3a6UL,
+    0xbad03605UL, 0xcdd70693UL, 0x54de5729UL, 0x23d967bfUL,
+    0xb3667a2eUL, 0xc4614ab8UL, 0x5d681b02UL, 0x2a6f2b94UL,
+    0xb40bbe37UL, 0xc30c8ea1UL, 0x5a05df1bUL, 0x2d02ef8dUL
+};
+
+static void compresschunk(void *, int, int);
+static unsigned long crc32(unsigned long, const unsigned char *, size_t);
+static void put32(unsigned char *, unsigned long);
+
+/*
+ * The image is written as a 1-bit grayscale PNG, in which set bits are
+ * white, so every byte is inverted on the way in. Each scanline gets
+ * filter type 0, as recommended for images of less than eight bits per
+ * pixel, which also keeps blank areas as runs of the same byte for the
+ * encoder.
+ */
+int formatpngparallel(const char *bitmap, int width, int height, int fast,
+                      int threads, char **png, size_t *size)
+{
+    static const unsigned char iend[12] =
+    {
+        0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xae, 0x42, 0x60, 0x82
+    };
+    size_t stride = ((size_t) width + 7) / 8, rowlength = stride + 1;
+    size_t rawsize, i, idat;
+    unsigned char prefix[PNGPREFIX], trailer[8], zlib[2], *raw;
+    struct deflatestream s;
+    struct pngchunks chunks;
+    unsigned long adler = 1;
+    int row, numchunks, chunk;
+
+    if (width < 1 || height < 1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    rawsize = rowlength * height;
+    raw = malloc(rawsize);
+    if (!raw) return -1;
+    for (row = 0; row < height; ++ row)
+    {
+        unsigned char *line = raw + row * rowlength;
+        const unsigned char *from = (const unsigned char *) bitmap +
+                                    row * stride;
+
+        line[0] = 0;
+        for (i = 0; i < stride; ++ i) line[i + 1] = ~from[i];
+    }
+
+    /* Signature and header, then the data chunk with its length later */
+    memcpy(prefix, PNGSIGNATURE, 8);
+    put32(prefix + 8, 13);
+    memcpy(prefix + 12, "IHDR", 4);
+    put32(prefix + 16, width);
+    put32(prefix + 20, height);
+    prefix[24] = 1;             /* Bit depth */
+    prefix[25] = 0;             /* Grayscale */
+    prefix[26] = prefix[27] = prefix[28] = 0;
+    put32(prefix + 29, crc32(0, prefix + 12, 17));
+    memcpy(prefix + 37, "IDAT", 4);
+
+    /* The zlib stream: header, deflate data, Adler-32 */
+    zlib[0] = 0x78;
+    zlib[1] = fast ? 0x01 : 0xda;
+    initdeflate(&s);
+    deflateraw(&s, prefix, PNGPREFIX);
+    deflateraw(&s, zlib, 2);
+
+    /* Compress the chunks of whole scanlines, then join them in order */
+    chunks.raw = raw;
+    chunks.rawsize = rawsize;
+    chunks.rowlength = rowlength;
+    chunks.chunksize = PNGCHUNK > rowlength ?
+                       PNGCHUNK / rowlength * rowlength : rowlength;
+    chunks.level = fast ? DEFLATE_FAST : DEFLATE_BEST;
+    numchunks = (int) ((rawsize + chunks.chunksize - 1) / chunks.chunksize);
+    chunks.streams = malloc(numchunks * sizeof (struct deflatestream));
+    chunks.adlers = malloc(numchunks * sizeof (unsigned long));
+    if (!chunks.streams || !chunks.adlers)
+    {
+        s.failed = 1;
+    }
+    else
+    {
+        for (chunk = 0; chunk < numchunks; ++ chunk)
+        {
+            initdeflate(&chunks.streams[chunk]);
+        }
+        if (runpool(threads, numchunks, compresschunk, &chunks) != 0)
+        {
+            s.failed = 1;
+        }
+        for (chunk = 0; chunk < numchunks; ++ chunk)
+        {
+            struct deflatestream *part = &chunks.streams[chunk];
+            size_t length = chunk < numchunks - 1 ? chunks.chunksize :
+                            rawsize - chunk * chunks.chunksize;
+
+            if (part->failed) s.failed = 1;
+            deflateraw(&s, part->data, part->length);
+            adler = adler32combine(adler, chunks.adlers[chunk], length);
+            freedeflate(part);
+        }
+    }
+    free(chunks.streams);
+    free(chunks.adlers);
+    free(raw);
+    put32(trailer, adler);
+    deflateraw(&s, trailer, 4);
+
+    /* Finish the data chunk and end the file */
+    idat = s.length - PNGPREFIX;
+    if (!s.failed && idat > 0x7fffffffUL)
+    {
+        freedeflate(&s);
+        errno = EFBIG;
+        return -1;
+    }
+    if (!s.failed)
+    {
+        put32(s.data + PNGPREFIX - 8, idat);
+        put32(trailer, crc32(0, s.data + PNGPREFIX - 4, idat + 4));
+        deflateraw(&s, trailer, 4);
+        deflateraw(&s, iend, sizeof iend);
+    }
+    if (s.failed)
+    {
+        freedeflate(&s);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *png = (char *) s.data;
+    *size = s.length;
+    return 0;
+}
+
+int formatpng(const char *bitmap, int width, int height, int fast,
+              char **png, size_t *size)
+{
+    return formatpngparallel(bitmap, width, height, fast, 1, png, size);
+}
+
+/* The same for a font in a layout */
+int layoutpng(int x, int y, const char *data, int numchars,
+              const struct layout *layout, int fast, char **png,
+              size_t *size)
+{
+    struct geometry geometry;
+    char *bitmap;
+    int rc;
+
+    if (getgeometry(x, y, numchars, layout, &geometry) != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    bitmap = malloc(geometry.datasize ? geometry.datasize : 1);
+    if (!bitmap) return -1;
+    renderlayout(x, y, data, numchars, layout, bitmap, geometry.datasize);
+    rc = formatpng(bitmap, geometry.width, geometry.height, fast, png, size);
+    free(bitmap);
+    return rc;
+}
+
+/* Add a PNG to an output. Returns 0, or -1 with errno set */
+int writepng(struct output *out, const char *bitmap, int width, int height,
+             int fast)
+{
+    char *png;
+    size_t size;
+    int rc;
+
+    if (formatpng(bitmap, width, height, fast, &png, &size) != 0) return -1;
+    rc = outputwrite(out, png, size);
+    free(png);
+    return rc;
+}
+
+/* Write a bitmap from createpbm() as a PNG file */
+int printpng(struct pbm pbm, int fast, FILE *out)
+{
+    char *png;
+    size_t size;
+    int rc = 0;
+
+    if (formatpng(pbm.data, pbm.x, pbm.y, fast, &png, &size) != 0)
+    {
+        return -1;
+    }
+    if (fwrite(png, 1, size, out) != size) rc = -1;
+    free(png);
+    return rc;
+}
+
+/* Pool task: compress one chunk and take its checksum */
+static void compresschunk(void *context, int index, int worker)
+{
+    struct pngchunks *chunks = context;
+    size_t start = (size_t) index * chunks->chunksize;
+    size_t size = chunks->rawsize - start < chunks->chunksize ?
+                  chunks->rawsize - start : chunks->chunksize;
+
+    (void) worker;
+    deflatechunk(&chunks->streams[index], chunks->raw + start,
+                 start < PNGDICTIONARY ? start : PNGDICTIONARY, size,
+                 chunks->level, chunks->rowlength,
+                 start + size == chunks->rawsize);
+    chunks->adlers[index] = adler32(1, chunks->raw + start, size);
+}
+
+static unsigned long crc32(unsigned long crc, const unsigned char *data,
+                           size_t size)
+{
+    crc ^= 0xffffffffUL;
+    while (size --)
+    {
+        crc = crctable[(crc ^ *data ++) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffUL;
+}
+
+/* Store a 32-bit number, most significant byte first */
+static void put32(unsigned char *p, unsigned long value)
+{
+    p[0] = (value >> 24) & 0xff;
+    p[1] = (value >> 16) & 0xff;
+    p[2] = (value >> 8) & 0xff;
+    p[3] = value & 0xff;
+}
@@ -0,0 +1,210 @@
+/*
+ * font2pbm
+ * Work-stealing thread pool used by batch conversion and PNG output.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+/*
+ * Each worker owns a range of task indices. The owner takes work from the
+ * front of its range, thieves take the back half. Ranges are small enough
+ * that a mutex per range is cheaper than getting a lock-free deque right.
+ */
+struct range
+{
+    pthread_mutex_t lock;
+    int begin, end;
+};
+
+struct pool
+{
+    struct range *ranges;
+    int threads;
+    pooltask task;
+    void *context;
+};
+
+struct worker
+{
+    struct pool *pool;
+    int id;
+};
+
+static int takeown(struct range *);
+static int steal(struct pool *, int);
+static void *workermain(void *);
+
+int runpool(int threads, int count, pooltask task, void *context)
+{
+    struct pool pool;
+    struct worker *workers;
+    pthread_t *handles;
+    int i, started;
+
+    if (threads < 1) threads = 1;
+    if (threads > count) threads = count > 0 ? count : 1;
+
+    pool.threads = threads;
+    pool.task = task;
+    pool.context = context;
+    pool.ranges = malloc(threads * sizeof (struct range));
+    workers = malloc(threads * sizeof (struct worker));
+    handles = malloc(threads * sizeof (pthread_t));
+    if (!pool.ranges || !workers || !handles)
+    {
+        free(pool.ranges);
+        free(workers);
+        free(handles);
+        return -1;
+    }
+
+    /* Split the indices evenly to begin with */
+    for (i = 0; i < threads; ++ i)
+    {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].begin = (int) ((long long) count * i / threads);
+        pool.ranges[i].end = (int) ((long long) count * (i + 1) / threads);
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    /*
+     * The calling thread acts as worker 0. If a thread fails to start,
+     * its share is simply stolen by the others.
+     */
+    for (started = 1; started < threads; ++ started)
+    {
+        if (pthread_create(&handles[started], NULL, workermain,
+                           &workers[started]) != 0)
+        {
+            break;
+        }
+    }
+    workermain(&workers[0]);
+    for (i = 1; i < started; ++ i)
+    {
+        pthread_join(handles[i], NULL);
+    }
+
+    for (i = 0; i < threads; ++ i)
+    {
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+    }
+    free(pool.ranges);
+    free(workers);
+    free(handles);
+    return 0;
+}
+
+int numcpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+/* Take the next index from the front of our own range, or -1 */
+static int takeown(struct range *range)
+{
+    int index = -1;
+
+    pthread_mutex_lock(&range->lock);
+    if (range->begin < range->end)
+    {
+        index = range->begin ++;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return index;
+}
+
+/*
+ * Steal the back half of the largest range owned by another worker and
+ * make it our own. Returns 0 if there was anything to steal, -1 if all
+ * work has been handed out.
+ */
+static int steal(struct pool *pool, int self)
+{
+    for (;;)
+    {
+        int i, victim = -1, largest = 0;
+
+        /* Find the victim; the choice is re-checked when stealing */
+        for (i = 0; i < pool->threads; ++ i)
+        {
+            int left;
+
+            if (i == self) continue;
+            pthread_mutex_lock(&pool->ranges[i].lock);
+            left = pool->ranges[i].end - pool->ranges[i].begin;
+            pthread_mutex_unlock(&pool->ranges[i].lock);
+            if (left > largest)
+            {
+                largest = left;
+                victim = i;
+            }
+        }
+        if (victim < 0) return -1;
+
+        pthread_mutex_lock(&pool->ranges[victim].lock);
+        {
+            struct range *from = &pool->ranges[victim];
+            int left = from->end - from->begin;
+
+            if (left > 0)
+            {
+                /* Leave the victim the front half, rounding in its favour */
+                int mid = from->end - left / 2;
+                int begin, end;
+
+                if (left == 1) mid = from->begin;
+                begin = mid;
+                end = from->end;
+                from->end = mid;
+                pthread_mutex_unlock(&from->lock);
+
+                pthread_mutex_lock(&pool->ranges[self].lock);
+                pool->ranges[self].begin = begin;
+                pool->ranges[self].end = end;
+                pthread_mutex_unlock(&pool->ranges[self].lock);
+                return 0;
+            }
+        }
+        pthread_mutex_unlock(&pool->ranges[victim].lock);
+    }
+}
+
+static void *workermain(void *arg)
+{
+    struct worker *worker = arg;
+    struct pool *pool = worker->pool;
+    struct range *own = &pool->ranges[worker->id];
+
+    for (;;)
+    {
+        int index = takeown(own);
+
+        if (index < 0)
+        {
+            if (steal(pool, worker->id) < 0) break;
+            continue;
+        }
+        pool->task(pool->context, index, worker->id);
+    }
+    return NULL;
+}
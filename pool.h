@@ -0,0 +1,41 @@
+/*
+ * font2pbm
+ * Work-stealing thread pool used by batch conversion and PNG output.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * Task callback. Called once for every index in [0, count), from any of
+ * the worker threads. worker is the number of the calling thread, in
+ * [0, threads), and can be used to index per-thread state.
+ */
+typedef void (*pooltask)(void *context, int index, int worker);
+
+/*
+ * Run count tasks on the given number of threads. Each thread starts
+ * with an even, contiguous share of the indices and steals half of the
+ * remaining work from the busiest thread when it runs out. Returns 0 on
+ * success, or -1 if out of memory.
+ */
+int runpool(int threads, int count, pooltask task, void *context);
+
+/* Number of online processors, at least 1 */
+int numcpus(void);
+
+#endif
@@ -0,0 +1,865 @@
+/*
+ * font2pbm
+ * Finding charsets inside other data.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "font2pbm.h"
+#include "glyph.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define HAVE_X86_KERNELS
+# include <immintrin.h>
+#endif
+
+/*
+ * Glyphs are drawn with strokes, so neighbouring pixels agree much more
+ * often than in code, tables or packed data, where a set bit says little
+ * about the next one; random bits agree a third of the time. Windows
+ * whose agreement is below this percentage get no closer look.
+ */
+#define SCANBASE 45
+
+/* Hits must score at least this after the closer look */
+#define SCANMINIMUM 0.5
+
+/* Mostly empty or mostly full windows are not charsets */
+#define INKMIN (SCANWINDOW * 8 / 20)
+#define INKMAX (SCANWINDOW * 6)
+
+/*
+ * Counts are kept three to a word, in fields wide enough for a whole
+ * window, so one addition updates them all: pixel pairs both set and
+ * either set, and set pixels or nothing.
+ */
+#define FIELD 21
+#define FIELDMASK ((1ULL << FIELD) - 1)
+#define PACK(a, b, c) \
+    ((uint64_t) (a) | (uint64_t) (b) << FIELD | (uint64_t) (c) << 2 * FIELD)
+#define GET(word, n) ((unsigned long) ((word) >> (n) * FIELD & FIELDMASK))
+
+/* Set bits in each byte value */
+#define ONES2(n) (n), (n) + 1, (n) + 1, (n) + 2
+#define ONES4(n) ONES2(n), ONES2((n) + 1), ONES2((n) + 1), ONES2((n) + 2)
+#define ONES6(n) ONES4(n), ONES4((n) + 1), ONES4((n) + 1), ONES4((n) + 2)
+static const unsigned char ones[256] =
+{
+    ONES6(0), ONES6(1), ONES6(1), ONES6(2)
+};
+
+/*
+ * Kernels slide the window a byte at a time over the data and consider
+ * the windows step apart. Vector kernels only pass over windows that
+ * don't look drawn, as scanslide() does, so every kernel finds the same
+ * charsets.
+ */
+typedef int (*scanfunc)(const unsigned char *, size_t, size_t,
+                        struct scanhit *, int);
+struct scankernel
+{
+    const char *name;
+    scanfunc scan;
+    int (*supported)(void);
+};
+
+static int scanslide(const unsigned char *, size_t, size_t,
+                     struct scanhit *, int);
+static int scancells(const unsigned char *, size_t, size_t,
+                     struct scanhit *, int);
+static scanfunc getscan(void);
+static void consider(const unsigned char *, size_t, uint64_t, uint64_t,
+                     struct scanhit *, int *, int);
+static int looksdrawn(uint64_t, uint64_t);
+static double signature(const unsigned char *);
+static void addhit(struct scanhit *, int *, int, size_t, double);
+static int overlaps(size_t, size_t);
+
+int scanfont(const char *data, size_t length, size_t step,
+             struct scanhit *hits, int max)
+{
+    if (length < SCANWINDOW || max < 1) return 0;
+    if (!step) step = 1;
+
+    /* Windows that all start on the same 8 byte grid share their cells */
+    if (0 == step % 8)
+    {
+        return scancells((const unsigned char *) data, length, step,
+                         hits, max);
+    }
+    return getscan()((const unsigned char *) data, length, step, hits, max);
+}
+
+/*
+ * Portable kernel, sliding the window a byte at a time. Rows are paired
+ * with the next row whatever the offset, and the pairs are also kept
+ * apart by where they start modulo 8: in a window at offset o, the pairs
+ * starting at o + 7, o + 15 and so on span two cells and don't count.
+ * The pairs are remembered until they leave the window.
+ */
+static int scanslide(const unsigned char *data, size_t length, size_t step,
+                     struct scanhit *hits, int max)
+{
+    uint64_t rows[256], horizontal = 0, vertical = 0, seams[8] = { 0 };
+    uint64_t pairs[SCANWINDOW];
+    size_t offset, j, next = 0;
+    int i, found = 0;
+
+    for (i = 0; i < 256; ++ i)
+    {
+        rows[i] = PACK(ones[i & (i >> 1) & 0x7f], ones[(i | (i >> 1)) & 0x7f],
+                       ones[i]);
+    }
+
+    for (j = 0; j < SCANWINDOW; ++ j)
+    {
+        horizontal += rows[data[j]];
+        if (j + 1 < SCANWINDOW)
+        {
+            pairs[j] = PACK(ones[data[j] & data[j + 1]],
+                            ones[data[j] | data[j + 1]], 0);
+            vertical += pairs[j];
+            seams[j & 7] += pairs[j];
+        }
+    }
+
+    for (offset = 0; ; ++ offset)
+    {
+        if (offset == next)
+        {
+            next += step;
+            consider(data, offset, horizontal,
+                     vertical - seams[(offset + 7) & 7], hits, &found, max);
+        }
+
+        /* Slide one byte; the pair leaving makes room for the new one */
+        if (offset + SCANWINDOW >= length) break;
+        j = offset;
+        horizontal -= rows[data[j]];
+        vertical -= pairs[j % SCANWINDOW];
+        seams[j & 7] -= pairs[j % SCANWINDOW];
+        j = offset + SCANWINDOW;
+        horizontal += rows[data[j]];
+        pairs[(j - 1) % SCANWINDOW] = PACK(ones[data[j - 1] & data[j]],
+                                           ones[data[j - 1] | data[j]], 0);
+        vertical += pairs[(j - 1) % SCANWINDOW];
+        seams[(j - 1) & 7] += pairs[(j - 1) % SCANWINDOW];
+    }
+    return found;
+}
+
+/*
+ * Slide the window a cell at a time, counting each cell once with whole
+ * word operations. The counts of the cells in the window are remembered
+ * until they leave it.
+ */
+static int scancells(const unsigned char *data, size_t length, size_t step,
+                     struct scanhit *hits, int max)
+{
+    uint64_t horizontal = 0, vertical = 0;
+    uint64_t cellh[SCANWINDOW / 8], cellv[SCANWINDOW / 8];
+    size_t cells = length / 8, k, next = 0;
+    int found = 0;
+
+    for (k = 0; k < cells; ++ k)
+    {
+        size_t slot = k % (SCANWINDOW / 8);
+        glyph g;
+
+        if (k >= SCANWINDOW / 8)
+        {
+            /* The window before this cell joins */
+            if (8 * (k - SCANWINDOW / 8) == next)
+            {
+                next += step;
+                consider(data, 8 * (k - SCANWINDOW / 8), horizontal,
+                         vertical, hits, &found, max);
+            }
+            horizontal -= cellh[slot];
+            vertical -= cellv[slot];
+        }
+
+        g = loadglyph((const char *) data + 8 * k);
+        cellh[slot] = PACK(popcountglyph(g & (g >> 1) & GLYPHBYTES(0x7f)),
+                           popcountglyph((g | (g >> 1)) & GLYPHBYTES(0x7f)),
+                           popcountglyph(g));
+        cellv[slot] = PACK(popcountglyph(g & (g << 8)),
+                           popcountglyph((g | (g << 8)) & ~(glyph) 0xff), 0);
+        horizontal += cellh[slot];
+        vertical += cellv[slot];
+    }
+    if (8 * (cells - SCANWINDOW / 8) == next)
+    {
+        consider(data, next, horizontal, vertical, hits, &found, max);
+    }
+    return found;
+}
+
+/*
+ * Score the window at offset, given its counts, and keep it if it is one
+ * of the best. Only windows that look like glyphs get the closer look.
+ */
+static void consider(const unsigned char *data, size_t offset,
+                     uint64_t horizontal, uint64_t vertical,
+                     struct scanhit *hits, int *found, int max)
+{
+    double score;
+
+    if (!looksdrawn(horizontal, vertical)) return;
+    score = ((double) GET(horizontal, 0) / GET(horizontal, 1) +
+             (double) GET(vertical, 0) / GET(vertical, 1)) / 2 +
+            signature(data + offset);
+    if (score > 1) score = 1;
+    if (score >= SCANMINIMUM) addhit(hits, found, max, offset, score);
+}
+
+/*
+ * Whether the pixels of a window agree with their neighbours often
+ * enough for glyphs, and it is neither mostly empty nor mostly full.
+ */
+static int looksdrawn(uint64_t horizontal, uint64_t vertical)
+{
+    unsigned long hboth = GET(horizontal, 0), heither = GET(horizontal, 1);
+    unsigned long ink = GET(horizontal, 2);
+    unsigned long vboth = GET(vertical, 0), veither = GET(vertical, 1);
+
+    return heither && veither && ink >= INKMIN && ink <= INKMAX &&
+           100 * ((unsigned long long) hboth * veither +
+                  (unsigned long long) vboth * heither) >=
+           2ULL * SCANBASE * heither * veither;
+}
+
+/*
+ * What sets a charset apart from other data made of cells, such as
+ * bitmaps and fill patterns: few blank or repeated cells, with screen
+ * code 32 blank; letters 1 to 26 that differ from each other and leave
+ * the bottom row for the baseline; and often a second half that is the
+ * first one reversed. Returns a bonus of up to 0.3, less a penalty if
+ * the cells are mostly blank or the same.
+ */
+static double signature(const unsigned char *data)
+{
+    glyph cells[256];
+    int i, k, blank = 0, repeated = 0, letters = 0, reversed = 0;
+    double bonus;
+
+    for (i = 0; i < 256; ++ i)
+    {
+        cells[i] = loadglyph((const char *) data + i * 8);
+        if (!cells[i]) ++ blank;
+        if (i && cells[i] == cells[i - 1]) ++ repeated;
+    }
+    for (i = 1; i <= 26; ++ i)
+    {
+        if (!cells[i] || (cells[i] & 0xff)) continue;
+        for (k = 1; k < i && cells[k] != cells[i]; ++ k)
+            ;
+        if (k == i) ++ letters;
+    }
+    for (i = 0; i < 128; ++ i)
+    {
+        if (cells[i + 128] == ~cells[i]) ++ reversed;
+    }
+
+    bonus = (cells[32] ? 0 : 0.1) + 0.1 * letters / 26 +
+            0.1 * reversed / 128;
+    if (blank > 64 || repeated > 64) bonus -= 0.3;
+    return bonus;
+}
+
+/*
+ * Keep the best hits, best first, letting no two overlap: a window next
+ * to a better one is the same charset seen slightly off.
+ */
+static void addhit(struct scanhit *hits, int *found, int max,
+                   size_t offset, double score)
+{
+    int i, k;
+
+    for (i = 0; i < *found; ++ i)
+    {
+        if (overlaps(hits[i].offset, offset) && hits[i].score >= score)
+        {
+            return;
+        }
+    }
+
+    /* Worse ones that overlap are replaced by this one */
+    for (i = k = 0; i < *found; ++ i)
+    {
+        if (!overlaps(hits[i].offset, offset)) hits[k ++] = hits[i];
+    }
+    *found = k;
+
+    if (*found == max && hits[max - 1].score >= score) return;
+    if (*found < max) ++ *found;
+    for (i = *found - 1; i > 0 && hits[i - 1].score < score; -- i)
+    {
+        hits[i] = hits[i - 1];
+    }
+    hits[i].offset = offset;
+    hits[i].score = score;
+}
+
+static int overlaps(size_t a, size_t b)
+{
+    return (a > b ? a - b : b - a) < SCANWINDOW;
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * Vector kernels look at SCANBLOCK windows at once. Their counts are
+ * kept as running totals over the bytes of the block and its
+ * windows, 16 bits wide, which is enough for a window: ink[p] for the
+ * set pixels in the bytes before p, hboth[p] and heither[p] for the
+ * horizontal pixel pairs in them, vboth[p] and veither[p] for the
+ * vertical pairs starting before p, and sboth[p] and seither[p] for the
+ * vertical pairs starting before p at p - 8, p - 16 and so on. Bit o of
+ * pass is set for a window that may look drawn, see looksdrawn().
+ */
+#define SCANBLOCK 4096
+#define SCANSPAN (SCANBLOCK + SCANWINDOW + 8)
+struct scanblock
+{
+    uint16_t ink[SCANSPAN], hboth[SCANSPAN], heither[SCANSPAN];
+    uint16_t vboth[SCANSPAN], veither[SCANSPAN];
+    uint16_t sboth[SCANSPAN], seither[SCANSPAN];
+    uint64_t pass[SCANBLOCK / 64];
+};
+
+/* Fills in the totals and pass for the n windows at the start of data */
+typedef void (*fillfunc)(const unsigned char *data, int n,
+                         struct scanblock *);
+
+/*
+ * Fill in the totals from byte and pair from onwards, for the n windows
+ * of a block, carrying on from the totals before them. The vector
+ * kernels leave the last few bytes to this.
+ */
+static void scantotals(const unsigned char *data, int from, int n,
+                       struct scanblock *block)
+{
+    int bytes = n + SCANWINDOW - 1, p;
+
+    for (p = from; p < bytes; ++ p)
+    {
+        unsigned b = data[p], shifted = b >> 1;
+
+        block->ink[p + 1] = block->ink[p] + ones[b];
+        block->hboth[p + 1] = block->hboth[p] + ones[b & shifted];
+        block->heither[p + 1] = block->heither[p] +
+                                ones[(b | shifted) & 0x7f];
+        if (p + 1 < bytes)
+        {
+            unsigned both = ones[b & data[p + 1]];
+            unsigned either = ones[b | data[p + 1]];
+
+            block->vboth[p + 1] = block->vboth[p] + both;
+            block->veither[p + 1] = block->veither[p] + either;
+            block->sboth[p + 8] = block->sboth[p] + both;
+            block->seither[p + 8] = block->seither[p] + either;
+        }
+    }
+}
+
+/* Flag the windows from from to n that look drawn */
+static void scanfilter(int from, int n, struct scanblock *block)
+{
+    int o;
+
+    for (o = from; o < n; ++ o)
+    {
+        int end = o + SCANWINDOW - 1;
+        uint16_t ink = block->ink[o + SCANWINDOW] - block->ink[o];
+        uint16_t hboth, heither, vboth, veither;
+
+        if (ink < INKMIN || ink > INKMAX) continue;
+        hboth = block->hboth[o + SCANWINDOW] - block->hboth[o];
+        heither = block->heither[o + SCANWINDOW] - block->heither[o];
+        vboth = block->vboth[end] - block->vboth[o] -
+                block->sboth[end] + block->sboth[o + 7];
+        veither = block->veither[end] - block->veither[o] -
+                  block->seither[end] + block->seither[o + 7];
+        if (looksdrawn(PACK(hboth, heither, ink), PACK(vboth, veither, 0)))
+        {
+            block->pass[o / 64] |= 1ULL << (o % 64);
+        }
+    }
+}
+
+/* The horizontal counts of the window at offset o of a block */
+static uint64_t horizontalat(const struct scanblock *block, int o)
+{
+    return PACK((uint16_t) (block->hboth[o + SCANWINDOW] - block->hboth[o]),
+                (uint16_t) (block->heither[o + SCANWINDOW] -
+                            block->heither[o]),
+                (uint16_t) (block->ink[o + SCANWINDOW] - block->ink[o]));
+}
+
+/*
+ * The vertical counts of the same window, less the pairs that span two
+ * cells, those starting at o + 7, o + 15 and so on
+ */
+static uint64_t verticalat(const struct scanblock *block, int o)
+{
+    int end = o + SCANWINDOW - 1;
+
+    return PACK((uint16_t) (block->vboth[end] - block->vboth[o] -
+                            block->sboth[end] + block->sboth[o + 7]),
+                (uint16_t) (block->veither[end] - block->veither[o] -
+                            block->seither[end] + block->seither[o + 7]),
+                0);
+}
+
+/*
+ * Slide the window a byte at a time, a block of offsets at once. fill
+ * works out the running totals over the bytes the windows of the block
+ * cover and flags the windows worth considering; their counts are the
+ * differences of two totals.
+ */
+static int scanblocks(const unsigned char *data, size_t length,
+                      size_t step, struct scanhit *hits, int max,
+                      fillfunc fill)
+{
+    struct scanblock block;
+    size_t offsets = length - SCANWINDOW + 1, base;
+    int found = 0;
+
+    for (base = 0; base < offsets; base += SCANBLOCK)
+    {
+        int n = offsets - base < SCANBLOCK ? offsets - base : SCANBLOCK;
+        int word;
+
+        fill(data + base, n, &block);
+        for (word = 0; word < (n + 63) / 64; ++ word)
+        {
+            uint64_t bits = block.pass[word];
+
+            while (bits)
+            {
+                int o = word * 64 + __builtin_ctzll(bits);
+
+                bits &= bits - 1;
+                if ((base + o) % step) continue;
+                consider(data, base + o, horizontalat(&block, o),
+                         verticalat(&block, o), hits, &found, max);
+            }
+        }
+    }
+    return found;
+}
+
+/*
+ * Vector kernels. Each byte's counts are found sixteen or thirty-two at a
+ * time, widened to 16 bits and summed up in log steps on top of the last
+ * total. The test of looksdrawn() is done in single precision with a
+ * little room to spare, so that rounding can only let a window through.
+ */
+#define NEARLY (2.0f * SCANBASE / 100 * (1 - 1.0f / 4096))
+
+static int hassse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+/* Set bits in each byte, the SSE2 way without a lookup */
+__attribute__((target("sse2")))
+static __m128i popcountsse2(__m128i x)
+{
+    const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33);
+
+    x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi16(x, 1), m1));
+    x = _mm_add_epi8(_mm_and_si128(x, m2),
+                     _mm_and_si128(_mm_srli_epi16(x, 2), m2));
+    return _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi16(x, 4)),
+                         _mm_set1_epi8(0x0f));
+}
+
+/* Running totals of eight counts, on top of the last of the totals before */
+__attribute__((target("sse2")))
+static __m128i totalsse2(__m128i x, __m128i last)
+{
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+    return _mm_add_epi16(x, _mm_shuffle_epi32(_mm_shufflehi_epi16(last, 0xff),
+                                              0xff));
+}
+
+/* Store the totals of sixteen byte counts at total, keeping the last */
+__attribute__((target("sse2")))
+static void storesse2(uint16_t *total, __m128i counts, __m128i *last)
+{
+    __m128i lo = totalsse2(_mm_unpacklo_epi8(counts, _mm_setzero_si128()),
+                           *last);
+    __m128i hi = totalsse2(_mm_unpackhi_epi8(counts, _mm_setzero_si128()),
+                           lo);
+
+    _mm_storeu_si128((__m128i *) total, lo);
+    _mm_storeu_si128((__m128i *) (total + 8), hi);
+    *last = hi;
+}
+
+/* The same for the totals eight pairs apart */
+__attribute__((target("sse2")))
+static void storestridesse2(uint16_t *total, __m128i counts, __m128i *last)
+{
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(counts, _mm_setzero_si128()),
+                               *last);
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(counts, _mm_setzero_si128()),
+                               lo);
+
+    _mm_storeu_si128((__m128i *) total, lo);
+    _mm_storeu_si128((__m128i *) (total + 8), hi);
+    *last = hi;
+}
+
+/* looksdrawn() for four windows, one in each lane */
+__attribute__((target("sse2")))
+static int drawnsse2(__m128i hboth, __m128i heither, __m128i ink,
+                     __m128i vboth, __m128i veither)
+{
+    __m128 hb = _mm_cvtepi32_ps(hboth), he = _mm_cvtepi32_ps(heither);
+    __m128 vb = _mm_cvtepi32_ps(vboth), ve = _mm_cvtepi32_ps(veither);
+    __m128 n = _mm_cvtepi32_ps(ink);
+    __m128 agree = _mm_add_ps(_mm_mul_ps(hb, ve), _mm_mul_ps(vb, he));
+    __m128 pass = _mm_cmpge_ps(agree, _mm_mul_ps(_mm_mul_ps(he, ve),
+                                                 _mm_set1_ps(NEARLY)));
+
+    pass = _mm_and_ps(pass, _mm_cmpge_ps(n, _mm_set1_ps(INKMIN)));
+    pass = _mm_and_ps(pass, _mm_cmple_ps(n, _mm_set1_ps(INKMAX)));
+    return _mm_movemask_ps(pass);
+}
+
+__attribute__((target("sse2")))
+static void fillsse2(const unsigned char *data, int n,
+                     struct scanblock *block)
+{
+    const __m128i low7 = _mm_set1_epi8(0x7f), zero = _mm_setzero_si128();
+    __m128i ink = zero, hboth = zero, heither = zero;
+    __m128i vboth = zero, veither = zero, sboth = zero, seither = zero;
+    int bytes = n + SCANWINDOW - 1, p, o;
+
+    memset(block->pass, 0, sizeof block->pass);
+    memset(block->sboth, 0, 8 * sizeof block->sboth[0]);
+    memset(block->seither, 0, 8 * sizeof block->seither[0]);
+    block->ink[0] = block->hboth[0] = block->heither[0] = 0;
+    block->vboth[0] = block->veither[0] = 0;
+
+    for (p = 0; p + 17 <= bytes; p += 16)
+    {
+        __m128i b = _mm_loadu_si128((const __m128i *) (data + p));
+        __m128i c = _mm_loadu_si128((const __m128i *) (data + p + 1));
+        __m128i shifted = _mm_and_si128(_mm_srli_epi16(b, 1), low7);
+        __m128i both = popcountsse2(_mm_and_si128(b, c));
+        __m128i either = popcountsse2(_mm_or_si128(b, c));
+
+        storesse2(block->ink + p + 1, popcountsse2(b), &ink);
+        storesse2(block->hboth + p + 1,
+                  popcountsse2(_mm_and_si128(b, shifted)), &hboth);
+        storesse2(block->heither + p + 1,
+                  popcountsse2(_mm_and_si128(_mm_or_si128(b, shifted), low7)),
+                  &heither);
+        storesse2(block->vboth + p + 1, both, &vboth);
+        storesse2(block->veither + p + 1, either, &veither);
+        storestridesse2(block->sboth + p + 8, both, &sboth);
+        storestridesse2(block->seither + p + 8, either, &seither);
+    }
+    scantotals(data, p, n, block);
+
+    for (o = 0; o + 8 <= n; o += 8)
+    {
+        int end = o + SCANWINDOW - 1, bits;
+        __m128i hb, he, in, vb, ve;
+
+        hb = _mm_sub_epi16(
+            _mm_loadu_si128((const __m128i *) (block->hboth + o + SCANWINDOW)),
+            _mm_loadu_si128((const __m128i *) (block->hboth + o)));
+        he = _mm_sub_epi16(
+            _mm_loadu_si128((const __m128i *) (block->heither + o +
+                                               SCANWINDOW)),
+            _mm_loadu_si128((const __m128i *) (block->heither + o)));
+        in = _mm_sub_epi16(
+            _mm_loadu_si128((const __m128i *) (block->ink + o + SCANWINDOW)),
+            _mm_loadu_si128((const __m128i *) (block->ink + o)));
+        vb = _mm_sub_epi16(
+            _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *) (block->vboth + end)),
+                _mm_loadu_si128((const __m128i *) (block->vboth + o))),
+            _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *) (block->sboth + end)),
+                _mm_loadu_si128((const __m128i *) (block->sboth + o + 7))));
+        ve = _mm_sub_epi16(
+            _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *) (block->veither + end)),
+                _mm_loadu_si128((const __m128i *) (block->veither + o))),
+            _mm_sub_epi16(
+                _mm_loadu_si128((const __m128i *) (block->seither + end)),
+                _mm_loadu_si128((const __m128i *) (block->seither + o + 7))));
+
+        bits = drawnsse2(_mm_unpacklo_epi16(hb, zero),
+                         _mm_unpacklo_epi16(he, zero),
+                         _mm_unpacklo_epi16(in, zero),
+                         _mm_unpacklo_epi16(vb, zero),
+                         _mm_unpacklo_epi16(ve, zero)) |
+               drawnsse2(_mm_unpackhi_epi16(hb, zero),
+                         _mm_unpackhi_epi16(he, zero),
+                         _mm_unpackhi_epi16(in, zero),
+                         _mm_unpackhi_epi16(vb, zero),
+                         _mm_unpackhi_epi16(ve, zero)) << 4;
+        block->pass[o / 64] |= (uint64_t) bits << (o % 64);
+    }
+    scanfilter(o, n, block);
+}
+
+static int scansse2(const unsigned char *data, size_t length, size_t step,
+                    struct scanhit *hits, int max)
+{
+    return scanblocks(data, length, step, hits, max, fillsse2);
+}
+
+static int hasavx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+/* Set bits in each byte, by looking up each half */
+__attribute__((target("avx2")))
+static __m256i popcountavx2(__m256i x)
+{
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+
+    return _mm256_add_epi8(
+        _mm256_shuffle_epi8(table, _mm256_and_si256(x, low4)),
+        _mm256_shuffle_epi8(table,
+                            _mm256_and_si256(_mm256_srli_epi16(x, 4), low4)));
+}
+
+/*
+ * Running totals of sixteen counts on top of the last of the totals
+ * before. The steps work within each 128-bit lane, so the low lane's
+ * total is added to the high lane at the end.
+ */
+__attribute__((target("avx2")))
+static __m256i totalavx2(__m256i x, __m256i last)
+{
+    x = _mm256_add_epi16(x, _mm256_slli_si256(x, 2));
+    x = _mm256_add_epi16(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi16(x, _mm256_slli_si256(x, 8));
+    x = _mm256_add_epi16(x, _mm256_shuffle_epi8(
+                                _mm256_permute2x128_si256(x, x, 0x08),
+                                _mm256_set1_epi16(0x0f0e)));
+    return _mm256_add_epi16(x, _mm256_shuffle_epi8(
+                                   _mm256_permute4x64_epi64(last, 0xff),
+                                   _mm256_set1_epi16(0x0706)));
+}
+
+/* Store the totals of thirty-two byte counts at total, keeping the last */
+__attribute__((target("avx2")))
+static void storeavx2(uint16_t *total, __m256i counts, __m256i *last)
+{
+    __m256i lo = totalavx2(
+        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(counts)), *last);
+    __m256i hi = totalavx2(
+        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(counts, 1)), lo);
+
+    _mm256_storeu_si256((__m256i *) total, lo);
+    _mm256_storeu_si256((__m256i *) (total + 16), hi);
+    *last = hi;
+}
+
+/*
+ * The same for the totals eight pairs apart: the low lane adds to the
+ * high lane of the totals before, the high lane to the low lane
+ */
+__attribute__((target("avx2")))
+static __m256i strideavx2(__m256i x, __m256i last)
+{
+    x = _mm256_add_epi16(x, _mm256_permute2x128_si256(last, last, 0x81));
+    return _mm256_add_epi16(x, _mm256_permute2x128_si256(x, x, 0x08));
+}
+
+__attribute__((target("avx2")))
+static void storestrideavx2(uint16_t *total, __m256i counts, __m256i *last)
+{
+    __m256i lo = strideavx2(
+        _mm256_cvtepu8_epi16(_mm256_castsi256_si128(counts)), *last);
+    __m256i hi = strideavx2(
+        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(counts, 1)), lo);
+
+    _mm256_storeu_si256((__m256i *) total, lo);
+    _mm256_storeu_si256((__m256i *) (total + 16), hi);
+    *last = hi;
+}
+
+/* looksdrawn() for eight windows, one in each 32-bit lane */
+__attribute__((target("avx2")))
+static int drawnavx2(__m128i hboth, __m128i heither, __m128i ink,
+                     __m128i vboth, __m128i veither)
+{
+    __m256 hb = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(hboth));
+    __m256 he = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(heither));
+    __m256 vb = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(vboth));
+    __m256 ve = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(veither));
+    __m256 n = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(ink));
+    __m256 agree = _mm256_add_ps(_mm256_mul_ps(hb, ve), _mm256_mul_ps(vb, he));
+    __m256 pass = _mm256_cmp_ps(agree,
+                                _mm256_mul_ps(_mm256_mul_ps(he, ve),
+                                              _mm256_set1_ps(NEARLY)),
+                                _CMP_GE_OQ);
+
+    pass = _mm256_and_ps(pass, _mm256_cmp_ps(n, _mm256_set1_ps(INKMIN),
+                                             _CMP_GE_OQ));
+    pass = _mm256_and_ps(pass, _mm256_cmp_ps(n, _mm256_set1_ps(INKMAX),
+                                             _CMP_LE_OQ));
+    return _mm256_movemask_ps(pass);
+}
+
+/* A window's counts from two totals of each kind */
+#define WINDOWAVX2(total, o, end) \
+    _mm256_sub_epi16( \
+        _mm256_loadu_si256((const __m256i *) ((total) + (end))), \
+        _mm256_loadu_si256((const __m256i *) ((total) + (o))))
+
+__attribute__((target("avx2")))
+static void fillavx2(const unsigned char *data, int n,
+                     struct scanblock *block)
+{
+    const __m256i low7 = _mm256_set1_epi8(0x7f);
+    __m256i ink, hboth, heither, vboth, veither, sboth, seither;
+    int bytes = n + SCANWINDOW - 1, p, o;
+
+    ink = hboth = heither = _mm256_setzero_si256();
+    vboth = veither = sboth = seither = _mm256_setzero_si256();
+    memset(block->pass, 0, sizeof block->pass);
+    memset(block->sboth, 0, 8 * sizeof block->sboth[0]);
+    memset(block->seither, 0, 8 * sizeof block->seither[0]);
+    block->ink[0] = block->hboth[0] = block->heither[0] = 0;
+    block->vboth[0] = block->veither[0] = 0;
+
+    for (p = 0; p + 33 <= bytes; p += 32)
+    {
+        __m256i b = _mm256_loadu_si256((const __m256i *) (data + p));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (data + p + 1));
+        __m256i shifted = _mm256_and_si256(_mm256_srli_epi16(b, 1), low7);
+        __m256i both = popcountavx2(_mm256_and_si256(b, c));
+        __m256i either = popcountavx2(_mm256_or_si256(b, c));
+
+        storeavx2(block->ink + p + 1, popcountavx2(b), &ink);
+        storeavx2(block->hboth + p + 1,
+                  popcountavx2(_mm256_and_si256(b, shifted)), &hboth);
+        storeavx2(block->heither + p + 1,
+                  popcountavx2(_mm256_and_si256(_mm256_or_si256(b, shifted),
+                                                low7)), &heither);
+        storeavx2(block->vboth + p + 1, both, &vboth);
+        storeavx2(block->veither + p + 1, either, &veither);
+        storestrideavx2(block->sboth + p + 8, both, &sboth);
+        storestrideavx2(block->seither + p + 8, either, &seither);
+    }
+    scantotals(data, p, n, block);
+
+    for (o = 0; o + 16 <= n; o += 16)
+    {
+        int end = o + SCANWINDOW - 1, bits;
+        __m256i hb = WINDOWAVX2(block->hboth, o, o + SCANWINDOW);
+        __m256i he = WINDOWAVX2(block->heither, o, o + SCANWINDOW);
+        __m256i in = WINDOWAVX2(block->ink, o, o + SCANWINDOW);
+        __m256i vb = _mm256_sub_epi16(WINDOWAVX2(block->vboth, o, end),
+                                      WINDOWAVX2(block->sboth, o + 7, end));
+        __m256i ve = _mm256_sub_epi16(WINDOWAVX2(block->veither, o, end),
+                                      WINDOWAVX2(block->seither, o + 7, end));
+
+        bits = drawnavx2(_mm256_castsi256_si128(hb),
+                         _mm256_castsi256_si128(he),
+                         _mm256_castsi256_si128(in),
+                         _mm256_castsi256_si128(vb),
+                         _mm256_castsi256_si128(ve)) |
+               drawnavx2(_mm256_extracti128_si256(hb, 1),
+                         _mm256_extracti128_si256(he, 1),
+                         _mm256_extracti128_si256(in, 1),
+                         _mm256_extracti128_si256(vb, 1),
+                         _mm256_extracti128_si256(ve, 1)) << 8;
+        block->pass[o / 64] |= (uint64_t) bits << (o % 64);
+    }
+    scanfilter(o, n, block);
+}
+
+static int scanavx2(const unsigned char *data, size_t length, size_t step,
+                    struct scanhit *hits, int max)
+{
+    return scanblocks(data, length, step, hits, max, fillavx2);
+}
+#endif
+
+static int always(void)
+{
+    return 1;
+}
+
+static const struct scankernel scankernels[] =
+{
+#ifdef HAVE_X86_KERNELS
+    { "avx2", scanavx2, hasavx2 },
+    { "sse2", scansse2, hassse2 },
+#endif
+    { "scalar", scanslide, always },
+    { NULL, NULL, NULL }
+};
+
+static scanfunc selected;
+static pthread_once_t selectonce = PTHREAD_ONCE_INIT;
+
+static void selectscan(void)
+{
+    const char *want = getenv("FONT2PBM_SCAN");
+    const struct scankernel *kernel;
+
+    /* Requested kernel, if any, otherwise the first supported one */
+    for (kernel = scankernels; want && kernel->name; ++ kernel)
+    {
+        if (strcmp(want, kernel->name) == 0 && kernel->supported())
+        {
+            selected = kernel->scan;
+            return;
+        }
+    }
+    for (kernel = scankernels; kernel->name; ++ kernel)
+    {
+        if (kernel->supported())
+        {
+            selected = kernel->scan;
+            return;
+        }
+    }
+}
+
+/*
+ * The best kernel supported by this CPU. The FONT2PBM_SCAN environment
+ * variable can name a kernel to use instead, if it is supported.
+ */
+static scanfunc getscan(void)
+{
+    pthread_once(&selectonce, selectscan);
+    return selected;
+}
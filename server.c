@@ -0,0 +1,542 @@
+/*
+ * font2pbm
+ * Conversion daemon listening on a Unix domain socket.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "font2pbm.h"
+#include "arena.h"
+#include "stats.h"
+#include "server.h"
+
+/* Initial size of the per-worker arenas, enough for any 2x2 font */
+#define ARENASIZE 65536
+
+/* Seconds a client may take to send the rest of a request */
+#define READTIMEOUT 5
+
+/*
+ * The main thread polls the listening socket and all idle connections.
+ * A connection with a request waiting is moved to the ready queue, and
+ * a worker answers one request on it and hands it back through the
+ * returned list, so a few workers can serve any number of clients.
+ */
+struct fdlist
+{
+    int *fds;
+    int count, size;
+};
+
+struct server
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    struct fdlist ready;        /* Waiting for a worker */
+    int readyhead;
+    struct fdlist returned;     /* Done, to be polled again */
+    int wakefd[2];              /* Tells the main thread about returns */
+    int stopping;
+    struct stats *stats;        /* One per worker */
+    struct arena *arenas;
+    struct cache *cache;
+};
+
+struct worker
+{
+    struct server *server;
+    int id;
+};
+
+static volatile sig_atomic_t stopsignal;
+static int wakesignal;
+
+static void onsignal(int);
+static int pushfd(struct fdlist *, int);
+static void *workermain(void *);
+static int serveone(struct server *, int, int);
+static int readall(int, char *, size_t);
+static int sendall(int, const char *, size_t);
+static void putbe32(unsigned char *, unsigned long);
+
+int runserver(const char *progname, const char *path, int threads,
+              struct stats *total, struct cache *cache)
+{
+    struct server server;
+    struct worker *workers = NULL;
+    pthread_t *handles = NULL;
+    struct sockaddr_un addr;
+    struct pollfd *polls = NULL;
+    struct fdlist idle = { NULL, 0, 0 };
+    struct sigaction sa;
+    struct stat st;
+    int listenfd, i, started = 0, rc = 1;
+
+    if (threads < 1) threads = 1;
+    if (strlen(path) >= sizeof addr.sun_path)
+    {
+        fprintf(stderr, "%s: Socket path too long \"%s\"\n", progname, path);
+        return 1;
+    }
+
+    memset(&server, 0, sizeof server);
+    server.wakefd[0] = server.wakefd[1] = -1;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.wakeup, NULL);
+    server.cache = cache;
+
+    /* Replace a stale socket left behind by an earlier run */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenfd < 0 ||
+        bind(listenfd, (struct sockaddr *) &addr, sizeof addr) != 0 ||
+        listen(listenfd, SOMAXCONN) != 0)
+    {
+        fprintf(stderr, "%s: Can't listen on \"%s\": %s\n",
+                progname, path, strerror(errno));
+        if (listenfd >= 0) close(listenfd);
+        return 1;
+    }
+    fcntl(listenfd, F_SETFL, O_NONBLOCK);
+
+    if (pipe(server.wakefd) != 0)
+    {
+        fprintf(stderr, "%s: Can't create pipe: %s\n",
+                progname, strerror(errno));
+        goto out;
+    }
+    fcntl(server.wakefd[0], F_SETFL, O_NONBLOCK);
+    fcntl(server.wakefd[1], F_SETFL, O_NONBLOCK);
+
+    /* Signals end the main loop through the wake pipe */
+    wakesignal = server.wakefd[1];
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = onsignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    /* Per-worker buffers are set up once and reused for every request */
+    server.stats = calloc(threads, sizeof (struct stats));
+    server.arenas = calloc(threads, sizeof (struct arena));
+    workers = malloc(threads * sizeof (struct worker));
+    handles = malloc(threads * sizeof (pthread_t));
+    if (!server.stats || !server.arenas || !workers || !handles)
+    {
+        fprintf(stderr, "%s: Out of memroy\n", progname);
+        goto out;
+    }
+    for (i = 0; i < threads; ++ i)
+    {
+        if (initarena(&server.arenas[i], ARENASIZE) != 0)
+        {
+            fprintf(stderr, "%s: Out of memroy\n", progname);
+            goto out;
+        }
+    }
+
+    for (started = 0; started < threads; ++ started)
+    {
+        workers[started].server = &server;
+        workers[started].id = started;
+        if (pthread_create(&handles[started], NULL, workermain,
+                           &workers[started]) != 0)
+        {
+            fprintf(stderr, "%s: Can't start thread: %s\n",
+                    progname, strerror(errno));
+            goto out;
+        }
+    }
+
+    while (!stopsignal)
+    {
+        struct pollfd *newpolls;
+        char drain[64];
+        int n;
+
+        /* Take back connections the workers are done with */
+        pthread_mutex_lock(&server.lock);
+        for (i = 0; i < server.returned.count; ++ i)
+        {
+            if (pushfd(&idle, server.returned.fds[i]) != 0)
+            {
+                close(server.returned.fds[i]);
+            }
+        }
+        server.returned.count = 0;
+        pthread_mutex_unlock(&server.lock);
+
+        newpolls = realloc(polls, (idle.count + 2) * sizeof (struct pollfd));
+        if (!newpolls)
+        {
+            fprintf(stderr, "%s: Out of memroy\n", progname);
+            goto out;
+        }
+        polls = newpolls;
+        polls[0].fd = server.wakefd[0];
+        polls[1].fd = listenfd;
+        for (i = 0; i < idle.count; ++ i)
+        {
+            polls[i + 2].fd = idle.fds[i];
+        }
+        for (i = 0; i < idle.count + 2; ++ i)
+        {
+            polls[i].events = POLLIN;
+            polls[i].revents = 0;
+        }
+
+        n = poll(polls, idle.count + 2, -1);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+            fprintf(stderr, "%s: poll: %s\n", progname, strerror(errno));
+            goto out;
+        }
+
+        while (read(server.wakefd[0], drain, sizeof drain) > 0)
+            /* nothing */;
+
+        /* Hand connections with a request waiting to the workers */
+        pthread_mutex_lock(&server.lock);
+        for (i = idle.count - 1; i >= 0; -- i)
+        {
+            if (polls[i + 2].revents)
+            {
+                if (pushfd(&server.ready, idle.fds[i]) != 0)
+                {
+                    close(idle.fds[i]);
+                }
+                idle.fds[i] = idle.fds[-- idle.count];
+                pthread_cond_signal(&server.wakeup);
+            }
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        if (polls[1].revents)
+        {
+            int fd;
+            struct timeval tv = { READTIMEOUT, 0 };
+
+            while ((fd = accept(listenfd, NULL, NULL)) >= 0)
+            {
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+                if (pushfd(&idle, fd) != 0) close(fd);
+            }
+        }
+    }
+    rc = 0;
+
+out:
+    /* Let the workers finish the requests they have, then stop them */
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.wakeup);
+    pthread_mutex_unlock(&server.lock);
+    for (i = 0; i < started; ++ i)
+    {
+        pthread_join(handles[i], NULL);
+    }
+
+    for (i = 0; i < idle.count; ++ i) close(idle.fds[i]);
+    for (i = server.readyhead; i < server.ready.count; ++ i)
+    {
+        close(server.ready.fds[i]);
+    }
+    for (i = 0; i < server.returned.count; ++ i)
+    {
+        close(server.returned.fds[i]);
+    }
+    for (i = 0; server.stats && i < threads; ++ i)
+    {
+        addstats(total, &server.stats[i]);
+    }
+    for (i = 0; server.arenas && i < threads; ++ i)
+    {
+        freearena(&server.arenas[i]);
+    }
+
+    close(listenfd);
+    unlink(path);
+    if (server.wakefd[0] >= 0) close(server.wakefd[0]);
+    if (server.wakefd[1] >= 0) close(server.wakefd[1]);
+    free(idle.fds);
+    free(server.ready.fds);
+    free(server.returned.fds);
+    free(polls);
+    free(server.stats);
+    free(server.arenas);
+    free(workers);
+    free(handles);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.wakeup);
+    return rc;
+}
+
+static void onsignal(int sig)
+{
+    int saved = errno;
+
+    (void) sig;
+    stopsignal = 1;
+    if (write(wakesignal, "", 1) < 0) { /* pipe full, already woken */ }
+    errno = saved;
+}
+
+/* Append a descriptor to a list. Returns 0, or -1 if out of memory */
+static int pushfd(struct fdlist *list, int fd)
+{
+    if (list->count == list->size)
+    {
+        int newsize = list->size ? list->size * 2 : 16;
+        int *newfds = realloc(list->fds, newsize * sizeof (int));
+
+        if (!newfds) return -1;
+        list->fds = newfds;
+        list->size = newsize;
+    }
+    list->fds[list->count ++] = fd;
+    return 0;
+}
+
+static void *workermain(void *arg)
+{
+    struct worker *worker = arg;
+    struct server *server = worker->server;
+    int fd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (server->readyhead == server->ready.count && !server->stopping)
+        {
+            pthread_cond_wait(&server->wakeup, &server->lock);
+        }
+        if (server->readyhead == server->ready.count)
+        {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        fd = server->ready.fds[server->readyhead ++];
+        if (server->readyhead == server->ready.count)
+        {
+            server->readyhead = server->ready.count = 0;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        if (serveone(server, worker->id, fd) != 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        /* Keep the connection open for the next request */
+        pthread_mutex_lock(&server->lock);
+        if (pushfd(&server->returned, fd) != 0)
+        {
+            close(fd);
+        }
+        pthread_mutex_unlock(&server->lock);
+        if (write(server->wakefd[1], "", 1) < 0) { /* already woken */ }
+    }
+}
+
+/*
+ * Read one request from fd and send the response. Returns 0 if the
+ * connection can take another request, or -1 if it should be closed:
+ * end of file, an I/O error, or a request too broken to answer.
+ */
+static int serveone(struct server *server, int id, int fd)
+{
+    struct arena *arena = &server->arenas[id];
+    struct stats *stats = &server->stats[id];
+    unsigned char header[SERVER_HEADER];
+    const char *message = NULL;
+    char *file, *response;
+    const char *data;
+    unsigned long length;
+    unsigned long long start, now;
+    int x, y, numchars;
+    size_t size;
+
+    if (readall(fd, (char *) header, sizeof header) != 0) return -1;
+    start = nanotime();
+
+    x = header[0];
+    y = header[1];
+    numchars = (header[2] << 8) | header[3];
+    length = ((unsigned long) header[4] << 24) | (header[5] << 16) |
+             (header[6] << 8) | header[7];
+    if (length > SERVER_MAXFONT)
+    {
+        /* Too big to skip past, so drop the client after telling it */
+        message = "Font file too large";
+        header[0] = SERVER_ERROR;
+        header[1] = header[2] = header[3] = 0;
+        putbe32(header + 4, strlen(message));
+        sendall(fd, (const char *) header, sizeof header);
+        sendall(fd, message, strlen(message));
+        ++ stats->files;
+        ++ stats->failed;
+        return -1;
+    }
+
+    ++ stats->files;
+    resetarena(arena);
+    file = arenaalloc(arena, length ? length : 1);
+    if (!file)
+    {
+        ++ stats->failed;
+        return -1;
+    }
+    if (readall(fd, file, length) != 0)
+    {
+        ++ stats->failed;
+        return -1;
+    }
+    stats->bytesin += length;
+    now = nanotime();
+    stats->readns += now - start;
+    start = now;
+
+    /* A size of 0 asks for the layout to be detected */
+    if (0 == x)
+    {
+        struct detection detection;
+
+        if (detectfont(file, length, &detection) == 0)
+        {
+            x = detection.x;
+            y = detection.y;
+            numchars = detection.numchars;
+        }
+        else
+        {
+            message = "Can't detect font layout";
+        }
+    }
+
+    size = 0;
+    response = NULL;
+    if (!message)
+    {
+        data = readfont(file, length, x, y, numchars, NULL);
+        size = pbmsize(x, y, numchars);
+        if (!data || !size)
+        {
+            message = "Invalid request";
+        }
+        else if (!(response = arenaalloc(arena, SERVER_HEADER + size)))
+        {
+            message = "Out of memroy";
+        }
+        else
+        {
+            if (server->cache)
+            {
+                size = cachedformatpbm(server->cache, stats, x, y, data,
+                                       numchars, NULL,
+                                       response + SERVER_HEADER, size);
+            }
+            else
+            {
+                size = formatpbm(x, y, data, numchars,
+                                 response + SERVER_HEADER, size);
+            }
+            response[0] = SERVER_OK;
+            stats->glyphs += numchars;
+        }
+    }
+    if (message)
+    {
+        size = strlen(message);
+        response = arenaalloc(arena, SERVER_HEADER + size);
+        if (!response)
+        {
+            ++ stats->failed;
+            return -1;
+        }
+        response[0] = SERVER_ERROR;
+        memcpy(response + SERVER_HEADER, message, size);
+        ++ stats->failed;
+    }
+    response[1] = response[2] = response[3] = 0;
+    putbe32((unsigned char *) response + 4, size);
+    now = nanotime();
+    stats->convertns += now - start;
+    start = now;
+
+    /* Header and body go out in one write */
+    if (sendall(fd, response, SERVER_HEADER + size) != 0) return -1;
+    stats->bytesout += SERVER_HEADER + size;
+    stats->writens += nanotime() - start;
+    return 0;
+}
+
+/* Read exactly length bytes. Returns 0, or -1 on end of file or error */
+static int readall(int fd, char *buffer, size_t length)
+{
+    while (length)
+    {
+        ssize_t got = read(fd, buffer, length);
+
+        if (got < 0 && EINTR == errno) continue;
+        if (got <= 0) return -1;
+        buffer += got;
+        length -= got;
+    }
+    return 0;
+}
+
+/* Write all of a buffer to a socket. Returns 0, or -1 on error */
+static int sendall(int fd, const char *buffer, size_t length)
+{
+    while (length)
+    {
+        ssize_t sent = send(fd, buffer, length, MSG_NOSIGNAL);
+
+        if (sent < 0 && EINTR == errno) continue;
+        if (sent < 0) return -1;
+        buffer += sent;
+        length -= sent;
+    }
+    return 0;
+}
+
+static void putbe32(unsigned char *p, unsigned long value)
+{
+    p[0] = (value >> 24) & 0xff;
+    p[1] = (value >> 16) & 0xff;
+    p[2] = (value >> 8) & 0xff;
+    p[3] = value & 0xff;
+}
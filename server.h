@@ -0,0 +1,62 @@
+/*
+ * font2pbm
+ * Conversion daemon listening on a Unix domain socket.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "stats.h"
+#include "cache.h"
+
+/*
+ * Protocol. A client connects and sends any number of requests, each
+ * answered in order before the next is read.
+ *
+ * Request:   byte 0     x, the character width in cells (1 or 2), or 0
+ *                       to detect the layout, see detectfont()
+ *            byte 1     y, the character height in cells (1 or 2)
+ *            bytes 2-3  number of characters, big endian
+ *            bytes 4-7  length of the font file, big endian
+ *            the font file, load address first
+ *
+ *            With x 0, y and the number of characters are ignored and
+ *            taken from the font; a font that can't be detected gets an
+ *            error response.
+ *
+ * Response:  byte 0     status, SERVER_OK or SERVER_ERROR
+ *            bytes 1-3  zero
+ *            bytes 4-7  length of the body, big endian
+ *            the body: a PBM file, or an error message on failure
+ */
+#define SERVER_OK 0
+#define SERVER_ERROR 1
+#define SERVER_HEADER 8
+
+/* Largest font file accepted */
+#define SERVER_MAXFONT (1024 * 1024)
+
+/*
+ * Listen on path and serve requests with a fixed pool of worker threads
+ * until SIGINT or SIGTERM. Converted fonts are looked up in and added to
+ * cache unless it is NULL. Counters are added to stats. Returns the
+ * process exit code.
+ */
+int runserver(const char *progname, const char *path, int threads,
+              struct stats *stats, struct cache *cache);
+
+#endif
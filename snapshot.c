@@ -0,0 +1,144 @@
+/*
+ * font2pbm
+ * Charsets in use in VICE snapshots of a C64.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <errno.h>
+#include "snapshot.h"
+
+/* The file header, with the VICE version added by newer releases */
+#define VSFMAGIC "VICE Snapshot File\032"
+#define VSFMACHINE "C64"
+#define VSFHEADER (19 + 2 + 16)
+#define VSFVERSIONMAGIC "VICE Version\032"
+#define VSFVERSION (13 + 4 + 4)
+
+/* Each module has a name, a version and a size that includes all this */
+#define MODULENAME 16
+#define MODULEHEADER (MODULENAME + 2 + 4)
+
+/* C64MEM: the processor port and cartridge lines, then the RAM */
+#define RAMOFFSET 4
+#define RAMSIZE 65536
+
+/* VIC-II, as saved by x64: the registers follow the internal state */
+#define VICMAJOR 1
+#define VICREGISTERS (3 + 40 + 1024 + 4 + 40 + 1 + 4 + 1 + 2)
+#define VICMEMORY 0x18
+
+/* CIA2: the port registers come first, bits 0-1 of port A are the bank */
+#define CIAPORTA 0
+#define CIADDRA 2
+
+/* C64ROM: KERNAL, BASIC and the character ROM */
+#define CHARGENOFFSET (8192 + 8192)
+#define CHARGENSIZE 4096
+
+static const unsigned char *findmodule(const unsigned char *, size_t,
+                                       const char *, size_t *);
+
+int issnapshot(const char *data, size_t length)
+{
+    return length >= VSFHEADER &&
+           0 == memcmp(data, VSFMAGIC, strlen(VSFMAGIC));
+}
+
+const char *snapshotcharset(const char *data, size_t length,
+                            unsigned *address)
+{
+    const unsigned char *file = (const unsigned char *) data;
+    const unsigned char *mem, *vic, *cia, *rom;
+    size_t memsize, vicsize, ciasize, romsize;
+    unsigned bank, base;
+
+    /* x64sc saves the VIC-II differently, so only x64 is understood */
+    if (!issnapshot(data, length) ||
+        strncmp(data + VSFHEADER - 16, VSFMACHINE, 16) != 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mem = findmodule(file, length, "C64MEM", &memsize);
+    vic = findmodule(file, length, "VIC-II", &vicsize);
+    cia = findmodule(file, length, "CIA2", &ciasize);
+    if (!mem || !vic || !cia || memsize < RAMOFFSET + RAMSIZE ||
+        vic[-MODULEHEADER + MODULENAME] != VICMAJOR ||
+        vicsize < VICREGISTERS + 64 || ciasize < CIADDRA + 1)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Lines set as inputs are pulled up, and the bank bits are inverted */
+    bank = 3 & ~(cia[CIAPORTA] | ~cia[CIADDRA]);
+    base = bank * 0x4000 + ((vic[VICREGISTERS + VICMEMORY] >> 1) & 7) * 2048;
+    *address = base;
+
+    /* Banks 0 and 2 see the character ROM at $1000-$1FFF */
+    if (0 == (bank & 1) && 0x1000 == (base & 0x3000))
+    {
+        rom = findmodule(file, length, "C64ROM", &romsize);
+        if (!rom || romsize < CHARGENOFFSET + CHARGENSIZE)
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+        return (const char *) rom + CHARGENOFFSET + (base & 0x800);
+    }
+    return (const char *) mem + RAMOFFSET + base;
+}
+
+/*
+ * Walk the modules after the header, returning the contents of the one
+ * with the given name and storing their size. Returns NULL if there is
+ * none or the modules before it are damaged.
+ */
+static const unsigned char *findmodule(const unsigned char *file,
+                                       size_t length, const char *name,
+                                       size_t *size)
+{
+    size_t offset = VSFHEADER;
+
+    if (length >= offset + VSFVERSION &&
+        0 == memcmp(file + offset, VSFVERSIONMAGIC, strlen(VSFVERSIONMAGIC)))
+    {
+        offset += VSFVERSION;
+    }
+
+    while (length - offset >= MODULEHEADER)
+    {
+        const unsigned char *module = file + offset;
+        size_t modulesize = module[MODULENAME + 2] |
+                            (module[MODULENAME + 3] << 8) |
+                            ((size_t) module[MODULENAME + 4] << 16) |
+                            ((size_t) module[MODULENAME + 5] << 24);
+
+        if (modulesize < MODULEHEADER || modulesize > length - offset)
+        {
+            return NULL;
+        }
+        if (0 == strncmp((const char *) module, name, MODULENAME))
+        {
+            *size = modulesize - MODULEHEADER;
+            return module + MODULEHEADER;
+        }
+        offset += modulesize;
+    }
+    return NULL;
+}
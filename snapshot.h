@@ -0,0 +1,43 @@
+/*
+ * font2pbm
+ * Charsets in use in VICE snapshots of a C64.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+
+/* A charset as the VIC-II sees it, 256 cells of eight bytes */
+#define SNAPSHOT_CHARSET 2048
+
+/* Whether the data is a VICE snapshot, from its signature */
+int issnapshot(const char *data, size_t length);
+
+/*
+ * Find the charset the VIC-II of a snapshotted C64 was displaying. Its
+ * address is the VIC bank selected through CIA 2 port A plus the offset
+ * in $D018, and the charset is returned in place inside data, in the
+ * saved RAM or, where the VIC sees the character ROM, in the saved ROMs.
+ * The address is stored in *address. Returns NULL with errno set to
+ * EINVAL if the snapshot is not of an x64 C64, is damaged or lacks the
+ * modules needed, which includes the ROMs for a charset in ROM.
+ */
+const char *snapshotcharset(const char *data, size_t length,
+                            unsigned *address);
+
+#endif
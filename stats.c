@@ -0,0 +1,71 @@
+/*
+ * font2pbm
+ * Counters and stage timings for conversions.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+unsigned long long nanotime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void addstats(struct stats *total, const struct stats *stats)
+{
+    total->files += stats->files;
+    total->failed += stats->failed;
+    total->bytesin += stats->bytesin;
+    total->bytesout += stats->bytesout;
+    total->glyphs += stats->glyphs;
+    total->readns += stats->readns;
+    total->convertns += stats->convertns;
+    total->writens += stats->writens;
+    total->cachehits += stats->cachehits;
+    total->cachemisses += stats->cachemisses;
+}
+
+void printstats(FILE *out, const struct stats *stats,
+                unsigned long long wallns)
+{
+    struct rusage usage;
+    long peak = 0;
+
+    /* ru_maxrss is in kilobytes on Linux and the BSDs */
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        peak = usage.ru_maxrss;
+    }
+
+    fprintf(out, "{\"files\":%lu,\"failed\":%lu,"
+                 "\"bytes_read\":%llu,\"bytes_written\":%llu,"
+                 "\"glyphs\":%llu,"
+                 "\"read_s\":%.6f,\"convert_s\":%.6f,\"write_s\":%.6f,"
+                 "\"cache_hits\":%lu,\"cache_misses\":%lu,"
+                 "\"wall_s\":%.6f,\"peak_memory_bytes\":%lld}\n",
+            stats->files, stats->failed,
+            stats->bytesin, stats->bytesout, stats->glyphs,
+            stats->readns / 1e9, stats->convertns / 1e9,
+            stats->writens / 1e9, stats->cachehits, stats->cachemisses,
+            wallns / 1e9, (long long) peak * 1024);
+}
@@ -0,0 +1,50 @@
+/*
+ * font2pbm
+ * Counters and stage timings for conversions.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/*
+ * Totals for one or more conversions. The stage times are summed over
+ * all threads, so in batch mode they can add up to more than the wall
+ * clock time.
+ */
+struct stats
+{
+    unsigned long files, failed;
+    unsigned long long bytesin, bytesout, glyphs;
+    unsigned long long readns, convertns, writens;
+    unsigned long cachehits, cachemisses;
+};
+
+/* Monotonic clock in nanoseconds */
+unsigned long long nanotime(void);
+
+/* Add the counters of one stats structure to another */
+void addstats(struct stats *total, const struct stats *);
+
+/*
+ * Print stats as a single line JSON object, including the wall clock
+ * time given and the peak resident memory of the process.
+ */
+void printstats(FILE *, const struct stats *, unsigned long long wallns);
+
+#endif
@@ -0,0 +1,1861 @@
+/*
+ * testconvert
+ * Checks of the font2pbm library, cache and daemon, run by "make check".
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "convert.h"
+#include "archive.h"
+#include "input.h"
+#include "snapshot.h"
+#include "cache.h"
+#include "server.h"
+
+#define MAXCHARS 1024
+
+static int failures;
+
+/*
+ * The original conversion loop, with the image made tall enough for a
+ * partial last row and the slots past the end of the font left blank.
+ */
+static char *reference(int x, int y, const char *data, int numchars,
+                       int *height)
+{
+    int charsperline = 32 / x, i;
+    char *image;
+
+    *height = (numchars + charsperline - 1) / charsperline * 8 * y;
+    image = calloc(1, 256 / 8 * *height);
+    if (!image) return NULL;
+
+    for (i = 0; i < numchars; ++ i)
+    {
+        int xchar, ychar;
+
+        for (xchar = 0; xchar < x; ++ xchar)
+        {
+            int xpos = (i % charsperline) * 8 * x + xchar * 8;
+
+            for (ychar = 0; ychar < y; ++ ychar)
+            {
+                int ypos = (i / charsperline) * 8 * y + 8 * ychar;
+                int fontofs = (i + (xchar + ychar * x) * numchars) * 8;
+                int pbmofs = ypos * 256 / 8 + xpos / 8, line;
+
+                for (line = 0; line < 8; ++ line)
+                {
+                    image[pbmofs + line * 256 / 8] = data[fontofs + line];
+                }
+            }
+        }
+    }
+    return image;
+}
+
+static void fail(const char *what, int x, int y, int numchars)
+{
+    if (failures ++ < 20)
+    {
+        fprintf(stderr, "testconvert: %s differs for %dx%d %d\n",
+                what, x, y, numchars);
+    }
+}
+
+/* Read back everything written to a temporary file */
+static char *readback(FILE *file, size_t *length)
+{
+    long size;
+    char *buffer;
+
+    fflush(file);
+    size = ftell(file);
+    buffer = malloc(size ? size : 1);
+    if (!buffer) return NULL;
+    rewind(file);
+    if (fread(buffer, 1, size, file) != (size_t) size)
+    {
+        free(buffer);
+        return NULL;
+    }
+    *length = size;
+    return buffer;
+}
+
+/*
+ * Convert one font through every interface, with the data in a buffer of
+ * exactly its size so that reading past the end shows up under a memory
+ * checker, and compare with createpbm(), itself checked against the
+ * original loop.
+ */
+static void checkfont(int x, int y, const char *font, int numchars)
+{
+    size_t datasize = (size_t) numchars * x * y * 8, length, headerlength;
+    char *data = malloc(datasize), *expect, *formatted, *streamed;
+    char header[80];
+    struct pbm pbm;
+    int height;
+    FILE *file;
+
+    if (!data)
+    {
+        fail("allocation", x, y, numchars);
+        return;
+    }
+    memcpy(data, font, datasize);
+
+    expect = reference(x, y, data, numchars, &height);
+    pbm = createpbm(x, y, data, numchars);
+    if (!expect || !pbm.data || pbm.x != 256 || pbm.y != height ||
+        memcmp(pbm.data, expect, 256 / 8 * height) != 0)
+    {
+        fail("createpbm()", x, y, numchars);
+    }
+
+    /* The same image, with a header, from the other interfaces */
+    headerlength = sprintf(header, "P4\n# Commodore 64 font converted by "
+                           "font2pbm\n256 %d\n", height);
+    length = pbmsize(x, y, numchars);
+    formatted = malloc(length);
+    if (!formatted || !pbm.data ||
+        length != headerlength + 256 / 8 * height ||
+        formatpbm(x, y, data, numchars, formatted, length) != length ||
+        memcmp(formatted, header, headerlength) != 0 ||
+        memcmp(formatted + headerlength, pbm.data, length - headerlength))
+    {
+        fail("formatpbm()", x, y, numchars);
+    }
+
+    file = tmpfile();
+    streamed = NULL;
+    if (file && 0 == streampbm(x, y, data, numchars, file))
+    {
+        streamed = readback(file, &length);
+    }
+    if (!streamed || !formatted || length != pbmsize(x, y, numchars) ||
+        memcmp(streamed, formatted, length) != 0)
+    {
+        fail("streampbm()", x, y, numchars);
+    }
+
+    if (file) fclose(file);
+    free(streamed);
+    free(formatted);
+    free(pbm.data);
+    free(expect);
+    free(data);
+}
+
+/*
+ * Lay out a font pixel by pixel, as described for struct layout, into a
+ * PBM file. Returns the file, which the caller frees, or NULL.
+ */
+static char *referencelayout(int x, int y, const char *data, int numchars,
+                             const struct layout *layout, size_t *size)
+{
+    int perrow = layout->perrow ? layout->perrow : 32 / x;
+    int pad = layout->padding;
+    int height = layout->cellheight ? layout->cellheight : 8;
+    int bytes = layout->cellbytes ? layout->cellbytes : height;
+    int rows = (numchars + perrow - 1) / perrow;
+    int width = perrow * 8 * x + (perrow - 1) * pad;
+    int lines = rows * (height * y + pad) - pad, stride = (width + 7) / 8;
+    int k, row, column, xcell, ycell, line, bit, left, top, headerlength;
+    char *file;
+    unsigned char *image;
+
+    headerlength = snprintf(NULL, 0, "P4\n# Commodore 64 font converted by "
+                            "font2pbm\n%d %d\n", width, lines);
+    *size = headerlength + (size_t) lines * stride;
+    file = calloc(1, *size + 1);
+    if (!file) return NULL;
+    sprintf(file, "P4\n# Commodore 64 font converted by font2pbm\n%d %d\n",
+            width, lines);
+    image = (unsigned char *) file + headerlength;
+
+    for (k = 0; k < numchars; ++ k)
+    {
+        row = layout->columnmajor ? k % rows : k / perrow;
+        column = layout->columnmajor ? k / rows : k % perrow;
+        left = column * (8 * x + pad);
+        top = row * (height * y + pad);
+        for (ycell = 0; ycell < y; ++ ycell)
+        {
+            for (xcell = 0; xcell < x; ++ xcell)
+            {
+                const char *cell = data + (k + (size_t) (xcell + ycell * x) *
+                                           numchars) * bytes;
+
+                for (line = 0; line < height; ++ line)
+                {
+                    for (bit = 0; bit < 8; ++ bit)
+                    {
+                        int px = left + xcell * 8 + bit;
+                        int py = top + ycell * height + line;
+
+                        if (cell[line] >> (7 - bit) & 1)
+                        {
+                            image[py * stride + px / 8] |= 0x80 >> px % 8;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return file;
+}
+
+/*
+ * Lay out a font with formatlayout() and streamlayout() and compare both
+ * with the reference. With wide rows, padding and tall cells a row of
+ * characters is bigger than the output buffer, which streaming has to
+ * handle.
+ */
+static void checklayout(int x, int y, const char *font, int numchars,
+                        const struct layout *layout)
+{
+    size_t size = layoutsize(x, y, numchars, layout), length = 0, expected;
+    char *formatted = malloc(size ? size : 1), *streamed = NULL;
+    char *expect = referencelayout(x, y, font, numchars, layout, &expected);
+    FILE *file = tmpfile();
+
+    if (!size || !formatted || !expect || size != expected ||
+        formatlayout(x, y, font, numchars, layout, formatted, size) != size ||
+        memcmp(formatted, expect, size) != 0)
+    {
+        fail("formatlayout()", x, y, numchars);
+    }
+    if (file && 0 == streamlayout(x, y, font, numchars, layout, file))
+    {
+        streamed = readback(file, &length);
+    }
+    if (!size || !expect || !streamed || length != size ||
+        memcmp(streamed, expect, size) != 0)
+    {
+        fail("streamlayout()", x, y, numchars);
+    }
+
+    if (file) fclose(file);
+    free(streamed);
+    free(expect);
+    free(formatted);
+}
+
+/*
+ * Hide a charset drawn with strokes at offset in noise and scan for it,
+ * trying every offset and every step-th. Each glyph is a bar across and
+ * a bar down, in places that set the letters apart.
+ */
+static void checkscan(const char *noise, size_t length, size_t offset,
+                      size_t step)
+{
+    char *data = malloc(length);
+    struct scanhit hits[3];
+    int c, line, n, i, hit = 0;
+
+    if (!data)
+    {
+        fail("scanfont()", 1, 1, 256);
+        return;
+    }
+    memcpy(data, noise, length);
+    for (c = 0; c < 256; ++ c)
+    {
+        for (line = 0; line < 8; ++ line)
+        {
+            char *row = data + offset + c * 8 + line;
+
+            *row = 0;
+            if (32 == c % 128 || 7 == line) continue;
+            *row = (char) (0xc0 >> c % 7);
+            if (line == c / 7 % 7) *row |= 0x7e;
+        }
+    }
+
+    n = scanfont(data, length, step, hits, 3);
+    for (i = 0; i < n; ++ i)
+    {
+        if (hits[i].offset == offset) hit = 1;
+    }
+    if (!hit) fail("scanfont()", 1, 1, 256);
+    free(data);
+}
+
+/*
+ * A reference inflater (RFC 1951) to read back the PNG files, written
+ * for clarity rather than speed
+ */
+struct inflater
+{
+    const unsigned char *in;
+    size_t inlength, inpos;
+    unsigned char *out;
+    size_t outlength, outpos;
+    unsigned long bitbuf;
+    int bitcount;
+    int error;
+};
+
+/* Canonical Huffman code: number of codes of each length, and symbols */
+struct huffman
+{
+    short count[16];
+    short symbol[288];
+};
+
+/* Take need bits from the input, least significant first */
+static int getbits(struct inflater *s, int need)
+{
+    unsigned long value = s->bitbuf;
+
+    while (s->bitcount < need)
+    {
+        if (s->inpos == s->inlength)
+        {
+            s->error = 1;
+            return 0;
+        }
+        value |= (unsigned long) s->in[s->inpos ++] << s->bitcount;
+        s->bitcount += 8;
+    }
+    s->bitbuf = value >> need;
+    s->bitcount -= need;
+    return (int) (value & ((1UL << need) - 1));
+}
+
+/* Build a code from code lengths. Returns -1 if it is over-subscribed */
+static int buildhuffman(struct huffman *h, const short *lengths, int n)
+{
+    short offsets[16];
+    int left = 1, len, symbol;
+
+    memset(h->count, 0, sizeof h->count);
+    for (symbol = 0; symbol < n; ++ symbol) ++ h->count[lengths[symbol]];
+    for (len = 1; len < 16; ++ len)
+    {
+        left = left * 2 - h->count[len];
+        if (left < 0) return -1;
+    }
+    offsets[1] = 0;
+    for (len = 1; len < 15; ++ len)
+    {
+        offsets[len + 1] = offsets[len] + h->count[len];
+    }
+    for (symbol = 0; symbol < n; ++ symbol)
+    {
+        if (lengths[symbol]) h->symbol[offsets[lengths[symbol]] ++] = symbol;
+    }
+    return 0;
+}
+
+/* Decode one symbol a bit at a time. Returns -1 on bad input */
+static int decodesymbol(struct inflater *s, const struct huffman *h)
+{
+    int code = 0, first = 0, index = 0, len;
+
+    for (len = 1; len < 16 && !s->error; ++ len)
+    {
+        code |= getbits(s, 1);
+        if (code - h->count[len] < first)
+        {
+            return h->symbol[index + code - first];
+        }
+        index += h->count[len];
+        first = (first + h->count[len]) << 1;
+        code <<= 1;
+    }
+    s->error = 1;
+    return -1;
+}
+
+/* Decode literals and matches up to the end of a block */
+static void inflatecodes(struct inflater *s, const struct huffman *lencode,
+                         const struct huffman *distcode)
+{
+    static const short lbase[29] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const short lextra[29] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const short dbase[30] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577
+    };
+    static const short dextra[30] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+    int symbol, distsymbol;
+    size_t length, distance;
+
+    for (;;)
+    {
+        symbol = decodesymbol(s, lencode);
+        if (s->error || 256 == symbol) return;
+        if (symbol < 256)
+        {
+            if (s->outpos == s->outlength)
+            {
+                s->error = 1;
+                return;
+            }
+            s->out[s->outpos ++] = (unsigned char) symbol;
+            continue;
+        }
+        symbol -= 257;
+        if (symbol >= 29)
+        {
+            s->error = 1;
+            return;
+        }
+        length = lbase[symbol] + getbits(s, lextra[symbol]);
+        distsymbol = decodesymbol(s, distcode);
+        if (s->error || distsymbol >= 30)
+        {
+            s->error = 1;
+            return;
+        }
+        distance = dbase[distsymbol] + getbits(s, dextra[distsymbol]);
+        if (s->error || distance > s->outpos ||
+            length > s->outlength - s->outpos)
+        {
+            s->error = 1;
+            return;
+        }
+        while (length --)
+        {
+            s->out[s->outpos] = s->out[s->outpos - distance];
+            ++ s->outpos;
+        }
+    }
+}
+
+/* A stored block, which starts on a byte boundary */
+static void inflatestored(struct inflater *s)
+{
+    size_t length, complement;
+
+    s->bitbuf = 0;
+    s->bitcount = 0;
+    if (s->inlength - s->inpos < 4)
+    {
+        s->error = 1;
+        return;
+    }
+    length = s->in[s->inpos] | s->in[s->inpos + 1] << 8;
+    complement = s->in[s->inpos + 2] | s->in[s->inpos + 3] << 8;
+    if ((length ^ 0xffff) != complement ||
+        s->inlength - s->inpos - 4 < length ||
+        s->outlength - s->outpos < length)
+    {
+        s->error = 1;
+        return;
+    }
+    memcpy(s->out + s->outpos, s->in + s->inpos + 4, length);
+    s->inpos += 4 + length;
+    s->outpos += length;
+}
+
+/* A block with the fixed codes */
+static void inflatefixed(struct inflater *s)
+{
+    struct huffman lencode, distcode;
+    short lengths[288];
+    int symbol;
+
+    for (symbol = 0; symbol < 288; ++ symbol)
+    {
+        lengths[symbol] = symbol < 144 ? 8 : symbol < 256 ? 9 :
+                          symbol < 280 ? 7 : 8;
+    }
+    buildhuffman(&lencode, lengths, 288);
+    for (symbol = 0; symbol < 30; ++ symbol) lengths[symbol] = 5;
+    buildhuffman(&distcode, lengths, 30);
+    inflatecodes(s, &lencode, &distcode);
+}
+
+/* A block with codes described at its start */
+static void inflatedynamic(struct inflater *s)
+{
+    static const short order[19] =
+    {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    struct huffman lencode, distcode;
+    short lengths[320];
+    int nlen, ndist, ncode, index, symbol, repeat, previous;
+
+    nlen = getbits(s, 5) + 257;
+    ndist = getbits(s, 5) + 1;
+    ncode = getbits(s, 4) + 4;
+    if (nlen > 286 || ndist > 30)
+    {
+        s->error = 1;
+        return;
+    }
+    memset(lengths, 0, sizeof lengths);
+    for (index = 0; index < ncode; ++ index)
+    {
+        lengths[order[index]] = (short) getbits(s, 3);
+    }
+    if (s->error || buildhuffman(&lencode, lengths, 19) != 0)
+    {
+        s->error = 1;
+        return;
+    }
+
+    index = 0;
+    while (index < nlen + ndist && !s->error)
+    {
+        symbol = decodesymbol(s, &lencode);
+        if (symbol < 16)
+        {
+            if (symbol >= 0) lengths[index ++] = (short) symbol;
+            continue;
+        }
+        previous = 0;
+        if (16 == symbol)
+        {
+            if (0 == index) break;
+            previous = lengths[index - 1];
+            repeat = 3 + getbits(s, 2);
+        }
+        else if (17 == symbol)
+        {
+            repeat = 3 + getbits(s, 3);
+        }
+        else
+        {
+            repeat = 11 + getbits(s, 7);
+        }
+        if (index + repeat > nlen + ndist) break;
+        while (repeat --) lengths[index ++] = (short) previous;
+    }
+    if (s->error || index != nlen + ndist || 0 == lengths[256] ||
+        buildhuffman(&lencode, lengths, nlen) != 0 ||
+        buildhuffman(&distcode, lengths + nlen, ndist) != 0)
+    {
+        s->error = 1;
+        return;
+    }
+    inflatecodes(s, &lencode, &distcode);
+}
+
+/*
+ * Inflate a raw deflate stream into exactly outlength bytes. Returns 0,
+ * or -1 if the data is bad, the size is wrong or bytes are left over.
+ */
+static int inflate(const unsigned char *in, size_t inlength,
+                   unsigned char *out, size_t outlength)
+{
+    struct inflater s;
+    int last, type;
+
+    memset(&s, 0, sizeof s);
+    s.in = in;
+    s.inlength = inlength;
+    s.out = out;
+    s.outlength = outlength;
+    do
+    {
+        last = getbits(&s, 1);
+        type = getbits(&s, 2);
+        if (s.error) break;
+        switch (type)
+        {
+        case 0:
+            inflatestored(&s);
+            break;
+        case 1:
+            inflatefixed(&s);
+            break;
+        case 2:
+            inflatedynamic(&s);
+            break;
+        default:
+            s.error = 1;
+        }
+    } while (!last && !s.error);
+    if (s.error || s.outpos != outlength || s.inpos != inlength) return -1;
+    return 0;
+}
+
+/* CRC-32 one bit at a time, independent of the table in png.c */
+static unsigned long referencecrc(const unsigned char *data, size_t size)
+{
+    unsigned long crc = 0xffffffffUL;
+    int bit;
+
+    while (size --)
+    {
+        crc ^= *data ++;
+        for (bit = 0; bit < 8; ++ bit)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320UL : crc >> 1;
+        }
+    }
+    return crc ^ 0xffffffffUL;
+}
+
+/* Adler-32 by its definition */
+static unsigned long referenceadler(const unsigned char *data, size_t size)
+{
+    unsigned long a = 1, b = 0;
+
+    while (size --)
+    {
+        a = (a + *data ++) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+    return (unsigned long) p[0] << 24 | (unsigned long) p[1] << 16 |
+           (unsigned long) p[2] << 8 | p[3];
+}
+
+/*
+ * Read back a PNG file and compare it with the bitmap it was made from:
+ * the chunk CRCs, the header, the zlib wrapping and Adler-32, and every
+ * scanline, which must have filter type 0 and the bytes inverted.
+ * Returns 0, or -1 if anything is wrong.
+ */
+static int readpng(const char *file, size_t size, const char *bitmap,
+                   int width, int height)
+{
+    const unsigned char *png = (const unsigned char *) file;
+    size_t stride = ((size_t) width + 7) / 8, rowlength = stride + 1;
+    size_t pos = 8, idatlength = 0, length, i;
+    unsigned char *idat = NULL, *raw = NULL, *grown;
+    int row, chunks = 0, ended = 0, rc = -1;
+
+    if (size < 8 || memcmp(png, "\211PNG\r\n\032\n", 8) != 0) return -1;
+    while (!ended)
+    {
+        if (size - pos < 12) goto out;
+        length = get32(png + pos);
+        if (length > size - pos - 12 ||
+            referencecrc(png + pos + 4, length + 4) !=
+            get32(png + pos + 8 + length))
+        {
+            goto out;
+        }
+        if (0 == chunks ++)
+        {
+            if (memcmp(png + pos + 4, "IHDR", 4) != 0 || length != 13 ||
+                get32(png + pos + 8) != (unsigned long) width ||
+                get32(png + pos + 12) != (unsigned long) height ||
+                memcmp(png + pos + 16, "\1\0\0\0\0", 5) != 0)
+            {
+                goto out;
+            }
+        }
+        else if (0 == memcmp(png + pos + 4, "IDAT", 4))
+        {
+            grown = realloc(idat, idatlength + length + 1);
+            if (!grown) goto out;
+            idat = grown;
+            memcpy(idat + idatlength, png + pos + 8, length);
+            idatlength += length;
+        }
+        else if (0 == memcmp(png + pos + 4, "IEND", 4))
+        {
+            ended = 1;
+        }
+        pos += 12 + length;
+    }
+    if (pos != size || idatlength < 6 || idat[0] != 0x78 ||
+        (idat[0] << 8 | idat[1]) % 31 != 0 || (idat[1] & 0x20))
+    {
+        goto out;
+    }
+
+    raw = malloc(rowlength * height);
+    if (!raw ||
+        inflate(idat + 2, idatlength - 6, raw, rowlength * height) != 0 ||
+        referenceadler(raw, rowlength * height) !=
+        get32(idat + idatlength - 4))
+    {
+        goto out;
+    }
+    for (row = 0; row < height; ++ row)
+    {
+        const unsigned char *line = raw + row * rowlength;
+
+        if (line[0] != 0) goto out;
+        for (i = 0; i < stride; ++ i)
+        {
+            unsigned char inverted = ~bitmap[row * stride + i];
+
+            if (line[i + 1] != inverted) goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    free(raw);
+    free(idat);
+    return rc;
+}
+
+/*
+ * Encode the image of a font at both levels and read it back. The
+ * bitmap from createpbm() is the reference for the pixels.
+ */
+static void checkpng(int x, int y, const char *font, int numchars)
+{
+    struct pbm pbm = createpbm(x, y, font, numchars);
+    char *png;
+    size_t size;
+    int fast;
+
+    for (fast = 0; fast < 2; ++ fast)
+    {
+        if (!pbm.data ||
+            formatpng(pbm.data, pbm.x, pbm.y, fast, &png, &size) != 0)
+        {
+            fail("formatpng()", x, y, numchars);
+            continue;
+        }
+        if (readpng(png, size, pbm.data, pbm.x, pbm.y) != 0)
+        {
+            fail("formatpng()", x, y, numchars);
+        }
+        free(png);
+    }
+    free(pbm.data);
+}
+
+/*
+ * Compress an image of several PNG chunks on one thread and on four,
+ * which must give the same file, and read it back. The image repeats
+ * every 5000 bytes, so matches reach back across chunk boundaries into
+ * the dictionary of the previous chunk.
+ */
+static void checkparallelpng(const char *noise)
+{
+    const int width = 256, height = 12000;
+    size_t datasize = (size_t) width / 8 * height, size[2], i;
+    char *bitmap = malloc(datasize), *png[2] = { NULL, NULL };
+    int fast, pass;
+
+    if (!bitmap)
+    {
+        fail("formatpngparallel()", width, height, 0);
+        return;
+    }
+    for (i = 0; i < datasize; ++ i) bitmap[i] = noise[i % 5000];
+    for (fast = 0; fast < 2; ++ fast)
+    {
+        for (pass = 0; pass < 2; ++ pass)
+        {
+            if (formatpngparallel(bitmap, width, height, fast,
+                                  pass ? 4 : 1, &png[pass], &size[pass]))
+            {
+                png[pass] = NULL;
+            }
+        }
+        if (!png[0] || !png[1] || size[0] != size[1] ||
+            memcmp(png[0], png[1], size[0]) != 0 ||
+            readpng(png[0], size[0], bitmap, width, height) != 0)
+        {
+            fail("formatpngparallel()", width, height, fast);
+        }
+        free(png[0]);
+        free(png[1]);
+    }
+    free(bitmap);
+}
+
+/*
+ * Apply transforms to one character pixel by pixel. The character is
+ * *width by *height pixels, pixels[row * 16 + column], and a quarter
+ * turn swaps the two.
+ */
+static void referencetransform(char pixels[16 * 16], int *width,
+                               int *height, const struct transform *t,
+                               int count)
+{
+    char old[16 * 16];
+    int w, h, row, column, from, fromrow;
+
+    for (; count > 0; -- count, ++ t)
+    {
+        memcpy(old, pixels, sizeof old);
+        w = *width;
+        h = *height;
+        if (TRANSFORM_ROTATE == t->op)
+        {
+            *width = h;
+            *height = w;
+        }
+        for (row = 0; row < *height; ++ row)
+        {
+            for (column = 0; column < *width; ++ column)
+            {
+                char *pixel = &pixels[row * 16 + column];
+
+                switch (t->op)
+                {
+                    case TRANSFORM_HFLIP:
+                        *pixel = old[row * 16 + w - 1 - column];
+                        break;
+
+                    case TRANSFORM_VFLIP:
+                        *pixel = old[(h - 1 - row) * 16 + column];
+                        break;
+
+                    case TRANSFORM_ROTATE:
+                        *pixel = old[(h - 1 - column) * 16 + row];
+                        break;
+
+                    case TRANSFORM_INVERT:
+                        *pixel = !old[row * 16 + column];
+                        break;
+
+                    case TRANSFORM_SHIFT:
+                        from = column - t->dx;
+                        fromrow = row - t->dy;
+                        *pixel = from >= 0 && from < w && fromrow >= 0 &&
+                                 fromrow < h ? old[fromrow * 16 + from] : 0;
+                        break;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Transform a font and compare every character with the reference, in
+ * place or into another buffer
+ */
+static void checktransform(int x, int y, const char *font, int numchars,
+                           const struct transform *transforms, int count,
+                           int inplace)
+{
+    size_t datasize = (size_t) numchars * x * y * 8;
+    char *data = malloc(datasize), *out = inplace ? data : malloc(datasize);
+    char pixels[16 * 16];
+    int newx = x, newy = y, width, height, i, row, column, ok = 1;
+
+    if (!data || !out)
+    {
+        fail("allocation", x, y, numchars);
+        free(data);
+        if (!inplace) free(out);
+        return;
+    }
+    memcpy(data, font, datasize);
+    if (transformfont(&newx, &newy, data, numchars, transforms, count,
+                      out) != 0)
+    {
+        ok = 0;
+    }
+
+    /* Pixel (column, row) is in cell row / 8 * x + column / 8 */
+    for (i = 0; i < numchars && ok; ++ i)
+    {
+        width = x * 8;
+        height = y * 8;
+        for (row = 0; row < height; ++ row)
+        {
+            for (column = 0; column < width; ++ column)
+            {
+                size_t cell = (size_t) (row / 8 * x + column / 8);
+
+                pixels[row * 16 + column] =
+                    font[(cell * numchars + i) * 8 + row % 8] >>
+                    (7 - column % 8) & 1;
+            }
+        }
+        referencetransform(pixels, &width, &height, transforms, count);
+        if (width != newx * 8 || height != newy * 8)
+        {
+            ok = 0;
+            break;
+        }
+        for (row = 0; row < height; ++ row)
+        {
+            for (column = 0; column < width; ++ column)
+            {
+                size_t cell = (size_t) (row / 8 * newx + column / 8);
+
+                if ((out[(cell * numchars + i) * 8 + row % 8] >>
+                     (7 - column % 8) & 1) != pixels[row * 16 + column])
+                {
+                    ok = 0;
+                }
+            }
+        }
+    }
+    if (!ok) fail("transformfont()", x, y, numchars);
+
+    if (!inplace) free(out);
+    free(data);
+}
+
+/* Write a scratch file. Returns 0, or -1 */
+static int writefile(const char *path, const void *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    int rc = 0;
+
+    if (!file) return -1;
+    if (fwrite(data, 1, size, file) != size) rc = -1;
+    if (fclose(file) != 0) rc = -1;
+    return rc;
+}
+
+/* Offset of a sector in a D64 image */
+static size_t d64offset(int track, int sector)
+{
+    size_t offset = 0;
+    int t;
+
+    for (t = 1; t < track; ++ t)
+    {
+        offset += t <= 17 ? 21 : t <= 24 ? 19 : t <= 30 ? 18 : 17;
+    }
+    return (offset + sector) * 256;
+}
+
+/* Add a directory entry to slot of sector 18/1 and chain file from track */
+static void d64file(unsigned char *image, int slot, int type,
+                    const char *name, const char *file, size_t length,
+                    int track)
+{
+    unsigned char *entry = image + d64offset(18, 1) + 32 * slot;
+    size_t used;
+    int sector = 0;
+
+    entry[2] = (unsigned char) type;
+    entry[3] = (unsigned char) track;
+    entry[4] = 0;
+    memset(entry + 5, 0xa0, 16);
+    memcpy(entry + 5, name, strlen(name));
+    for (;;)
+    {
+        unsigned char *data = image + d64offset(track, sector);
+
+        used = length < 254 ? length : 254;
+        memcpy(data + 2, file, used);
+        file += used;
+        length -= used;
+        if (!length)
+        {
+            data[0] = 0;
+            data[1] = (unsigned char) (used + 1);
+            return;
+        }
+        data[0] = (unsigned char) track;
+        data[1] = (unsigned char) ++ sector;
+    }
+}
+
+/*
+ * Compare an opened input with a font file: the load address in its
+ * first two bytes, then the data
+ */
+static int sameinput(const struct input *input, const char *file,
+                     size_t length)
+{
+    return input->length == length - 2 &&
+           input->loadaddress == (unsigned) ((unsigned char) file[0] |
+                                             (unsigned char) file[1] << 8) &&
+           0 == memcmp(input->data, file + 2, length - 2);
+}
+
+/*
+ * Build disk images of 35, 40 and 42 tracks, with and without error
+ * bytes, holding a font on the last track, a scratched file and a file
+ * never closed. The font must be listed, read and opened by name and
+ * from the listing, and nothing else.
+ */
+static void checkdisk(const char *dir, const char *font)
+{
+    static const struct
+    {
+        size_t length;
+        int tracks;
+    } sizes[6] =
+    {
+        { 174848, 35 }, { 175531, 35 },
+        { 196608, 40 }, { 197376, 40 },
+        { 205312, 42 }, { 206114, 42 }
+    };
+    char path[4096], member[4200], file[2050], buffer[2050];
+    unsigned char *image;
+    struct archive archive;
+    struct archivefile entry;
+    struct input input;
+    int i, listed, ok;
+
+    memcpy(file, "\0\x30", 2);
+    memcpy(file + 2, font, 2048);
+    snprintf(path, sizeof path, "%s/fonts.d64", dir);
+    snprintf(member, sizeof member, "%s:big*", path);
+    for (i = 0; i < 6; ++ i)
+    {
+        image = calloc(1, sizes[i].length);
+        if (!image)
+        {
+            fail("archive", sizes[i].tracks, 1, 0);
+            continue;
+        }
+        memset(image + d64offset(sizes[i].tracks + 1, 0), 1,
+               sizes[i].length - d64offset(sizes[i].tracks + 1, 0));
+        image[d64offset(18, 0)] = 18;
+        image[d64offset(18, 0) + 1] = 1;
+        image[d64offset(18, 1) + 1] = 0xff;
+        d64file(image, 0, 0x00, "GONE", file, 300, 20);
+        d64file(image, 1, 0x82, "BIGFONT", file, sizeof file,
+                sizes[i].tracks);
+        d64file(image, 2, 0x02, "OPEN", file, 300, 22);
+
+        ok = 0 == writefile(path, image, sizes[i].length) &&
+             0 == openarchive(&archive, path);
+        if (ok)
+        {
+            ok = archive.tracks == sizes[i].tracks;
+            listed = 0;
+            rewindarchive(&entry);
+            while (ok && nextarchivefile(&archive, &entry) > 0)
+            {
+                ++ listed;
+                ok = 0 == strcmp(entry.name, "BIGFONT") &&
+                     ARCHIVE_PRG == entry.type && !entry.broken &&
+                     entry.length == sizeof file &&
+                     0 == readarchivefile(&archive, &entry, buffer) &&
+                     0 == memcmp(buffer, file, sizeof file) &&
+                     0 == openmemberinput(&input, &archive, &entry, NULL);
+                if (ok)
+                {
+                    ok = sameinput(&input, file, sizeof file);
+                    closeinput(&input);
+                }
+            }
+            ok = ok && 1 == listed;
+            closearchive(&archive);
+        }
+        if (ok && 0 == openinput(&input, member, NULL))
+        {
+            ok = sameinput(&input, file, sizeof file);
+            closeinput(&input);
+        }
+        else
+        {
+            ok = 0;
+        }
+        if (!ok) fail("disk image", sizes[i].tracks, 1, 0);
+        free(image);
+    }
+    unlink(path);
+}
+
+/* Add an entry to the directory of a tape image */
+static void t64entry(unsigned char *image, int slot, int type,
+                     unsigned start, unsigned end, unsigned long offset,
+                     const char *name)
+{
+    unsigned char *entry = image + 64 + 32 * slot;
+
+    entry[0] = (unsigned char) type;
+    entry[1] = 0x82;
+    entry[2] = start & 255;
+    entry[3] = start >> 8;
+    entry[4] = end & 255;
+    entry[5] = end >> 8;
+    entry[8] = offset & 255;
+    entry[9] = offset >> 8 & 255;
+    entry[10] = offset >> 16 & 255;
+    entry[11] = offset >> 24 & 255;
+    memset(entry + 16, ' ', 16);
+    memcpy(entry + 16, name, strlen(name));
+}
+
+/*
+ * List the files in an image and compare their names and lengths. With
+ * data given, each file must be used in place in the image and start
+ * with the bytes at its offset in data.
+ */
+static int listimage(const char *path, int count, const char *const *names,
+                     const size_t *lengths, const size_t *offsets,
+                     const unsigned char *data)
+{
+    struct archive archive;
+    struct archivefile file;
+    struct input input;
+    int listed = 0, ok;
+
+    if (openarchive(&archive, path) != 0) return 0;
+    ok = 1;
+    rewindarchive(&file);
+    while (ok && nextarchivefile(&archive, &file) > 0)
+    {
+        ok = listed < count && 0 == strcmp(file.name, names[listed]) &&
+             file.length == lengths[listed];
+        if (ok && offsets[listed])
+        {
+            ok = 0 == openmemberinput(&input, &archive, &file, NULL);
+            if (ok)
+            {
+                ok = input.data == (const char *) archive.data +
+                                   offsets[listed] &&
+                     0 == memcmp(input.data, data + offsets[listed],
+                                 lengths[listed] - 2);
+                closeinput(&input);
+            }
+        }
+        else if (ok)
+        {
+            ok = file.broken;
+        }
+        ++ listed;
+    }
+    closearchive(&archive);
+    return ok && listed == count;
+}
+
+/*
+ * A tape whose directory is out of order, with a free entry, an end
+ * address of zero, one past the next file and one past the end of the
+ * image, one shorter than the space up to the next file, and a file
+ * starting past the end. Lengths include the load address.
+ */
+static void checktape(const char *dir, const char *font)
+{
+    static const char *const names[5] =
+    {
+        "ZERO", "LONG", "SHORT", "LAST", "GONE"
+    };
+    static const size_t lengths[5] = { 1002, 2002, 102, 502, 0 };
+    static const size_t offsets[5] = { 3000, 1000, 4000, 5000, 0 };
+    unsigned char image[5500];
+    char path[4096];
+
+    memset(image, 0, sizeof image);
+    memcpy(image, "C64S tape image file", 20);
+    image[34] = 7;
+    memcpy(image + 500, font, sizeof image - 500);
+    t64entry(image, 0, 1, 0x3000, 0x0000, 3000, "ZERO");
+    t64entry(image, 1, 0, 0x3000, 0x3800, 500, "FREE");
+    t64entry(image, 2, 1, 0x2000, 0x2fff, 1000, "LONG");
+    t64entry(image, 3, 1, 0x1000, 0x1064, 4000, "SHORT");
+    t64entry(image, 4, 1, 0x0801, 0xffff, 5000, "LAST");
+    t64entry(image, 5, 1, 0x0801, 0x0901, 99999, "GONE");
+    t64entry(image, 6, 0, 0, 0, 0, "");
+
+    snprintf(path, sizeof path, "%s/fonts.t64", dir);
+    if (writefile(path, image, sizeof image) != 0 ||
+        !listimage(path, 5, names, lengths, offsets, image))
+    {
+        fail("tape image", 1, 1, 0);
+    }
+    unlink(path);
+}
+
+/* Add a chip packet to a cartridge image at offset, returning its end */
+static size_t crtchip(unsigned char *image, size_t offset, int type,
+                      int bank, unsigned address, size_t size,
+                      const char *rom)
+{
+    unsigned char *chip = image + offset;
+
+    memcpy(chip, "CHIP", 4);
+    chip[4] = chip[5] = 0;
+    chip[6] = (16 + size) >> 8 & 255;
+    chip[7] = (16 + size) & 255;
+    chip[8] = 0;
+    chip[9] = (unsigned char) type;
+    chip[10] = 0;
+    chip[11] = (unsigned char) bank;
+    chip[12] = address >> 8;
+    chip[13] = address & 255;
+    chip[14] = size >> 8 & 255;
+    chip[15] = size & 255;
+    if (rom) memcpy(chip + 16, rom, size);
+    return offset + 16 + size;
+}
+
+/*
+ * A cartridge with two banks of ROM at $8000 and $A000, a RAM chip that
+ * is not listed and a last chip cut short
+ */
+static void checkcartridge(const char *dir, const char *font)
+{
+    static const char *const names[5] =
+    {
+        "BANK0-8000", "BANK0-A000", "BANK1-8000", "BANK1-A000", "BANK2-8000"
+    };
+    static const size_t lengths[5] = { 8194, 8194, 2050, 2050, 0 };
+    static const size_t offsets[5] = { 80, 8288, 16768, 18832, 0 };
+    static unsigned char image[20996];
+    char path[4096];
+    size_t end;
+
+    memset(image, 0, sizeof image);
+    memcpy(image, "C64 CARTRIDGE   ", 16);
+    image[19] = 64;
+    end = crtchip(image, 64, 0, 0, 0x8000, 8192, font);
+    end = crtchip(image, end, 0, 0, 0xa000, 8192, font + 8192);
+    end = crtchip(image, end, 1, 1, 0xde00, 256, NULL);
+    end = crtchip(image, end, 0, 1, 0x8000, 2048, font + 5);
+    end = crtchip(image, end, 2, 1, 0xa000, 2048, font + 7);
+    crtchip(image, end, 0, 2, 0x8000, 8192, NULL);
+
+    snprintf(path, sizeof path, "%s/game.crt", dir);
+    if (writefile(path, image, sizeof image) != 0 ||
+        !listimage(path, 5, names, lengths, offsets, image))
+    {
+        fail("cartridge image", 1, 1, 0);
+    }
+    unlink(path);
+}
+
+/*
+ * Add a module to a snapshot at *offset, returning where its contents
+ * go. The size in the header includes the header.
+ */
+static unsigned char *vsfmodule(unsigned char *file, size_t *offset,
+                                const char *name, int major, size_t size)
+{
+    unsigned char *module = file + *offset;
+
+    size += 16 + 2 + 4;
+    memset(module, 0, 16);
+    memcpy(module, name, strlen(name));
+    module[16] = (unsigned char) major;
+    module[17] = 0;
+    module[18] = size & 255;
+    module[19] = size >> 8 & 255;
+    module[20] = size >> 16 & 255;
+    module[21] = size >> 24 & 255;
+    *offset += size;
+    return module + 22;
+}
+
+/*
+ * Build snapshots of a C64 and find the charset for every VIC bank that
+ * CIA 2 can select, with the port lines as outputs or inputs, and every
+ * charset offset in $D018. In banks 0 and 2 the offsets $1000 and $1800
+ * are the character ROM. Snapshots of x64sc, or without the ROMs when
+ * the charset is in ROM, are refused.
+ */
+static void checksnapshot(const char *dir, const char *font)
+{
+    static const unsigned char ddras[3] = { 0x3f, 0x00, 0x01 };
+    static unsigned char file[90000];
+    unsigned char *ram, *vic, *cia, *rom;
+    const char *charset, *expect;
+    char path[4096];
+    size_t length = 0, romoffset;
+    unsigned address, bank, base;
+    int version, pra, d, d018, ok = 1;
+    struct input input;
+
+    memset(file, 0, sizeof file);
+    memcpy(file, "VICE Snapshot File\032", 19);
+    file[19] = 2;
+    memcpy(file + 21, "C64", 3);
+    length = 37;
+    memcpy(file + length, "VICE Version\032", 13);
+    length += 21;
+
+    /* Modules in another order than VICE's, and one that is not needed */
+    vsfmodule(file, &length, "MAINCPU", 1, 40);
+    cia = vsfmodule(file, &length, "CIA2", 2, 30);
+    vic = vsfmodule(file, &length, "VIC-II", 1, 1200);
+    ram = vsfmodule(file, &length, "C64MEM", 0, 4 + 65536);
+    romoffset = length;
+    rom = vsfmodule(file, &length, "C64ROM", 0, 8192 + 8192 + 4096);
+    memcpy(ram + 4, font, 65536);
+    memcpy(rom + 16384, font + 65536, 4096);
+
+    for (version = 0; version < 2; ++ version)
+    {
+        const char *data = (const char *) file;
+        size_t size = length;
+
+        /* Without the version block, as older releases write */
+        if (version)
+        {
+            memmove(file + 37, file + 58, length - 58);
+            size -= 21;
+            ram -= 21;
+            vic -= 21;
+            cia -= 21;
+            rom -= 21;
+            romoffset -= 21;
+        }
+        for (pra = 0; pra < 4; ++ pra)
+        {
+            for (d = 0; d < 3; ++ d)
+            {
+                for (d018 = 0; d018 < 16; ++ d018)
+                {
+                    cia[0] = (unsigned char) (pra | 0xc0);
+                    cia[2] = ddras[d];
+                    vic[1119 + 0x18] = (unsigned char) (d018 << 1 | 0x01);
+
+                    /* Bank 3 - n for bits n, with inputs reading as 1 */
+                    bank = 3 - ((pra | (~ddras[d] & 3)) & 3);
+                    base = bank * 16384 + d018 % 8 * 2048;
+                    expect = (const char *) ram + 4 + base;
+                    if ((0 == bank || 2 == bank) && d018 % 8 / 2 == 1)
+                    {
+                        expect = (const char *) rom + 16384 + d018 % 2 * 2048;
+                    }
+                    charset = snapshotcharset(data, size, &address);
+                    if (!charset || address != base ||
+                        memcmp(charset, expect, SNAPSHOT_CHARSET) != 0)
+                    {
+                        ok = 0;
+                    }
+                }
+            }
+        }
+
+        /* Bank 0 at $1000 needs the ROMs */
+        cia[0] = 3;
+        cia[2] = 0x3f;
+        vic[1119 + 0x18] = 0x14;
+        memcpy(file + romoffset, "C64RAM", 6);
+        if (snapshotcharset(data, size, &address) != NULL) ok = 0;
+        memcpy(file + romoffset, "C64ROM", 6);
+
+        /* Read through openinput(), as a font file */
+        snprintf(path, sizeof path, "%s/screen.vsf", dir);
+        if (writefile(path, file, size) != 0 ||
+            openinput(&input, path, NULL) != 0)
+        {
+            ok = 0;
+        }
+        else
+        {
+            ok = ok && 0x1000 == input.loadaddress &&
+                 SNAPSHOT_CHARSET == input.length &&
+                 0 == memcmp(input.data, rom + 16384, SNAPSHOT_CHARSET);
+            closeinput(&input);
+        }
+        unlink(path);
+
+        /* The x64sc VIC-II state is laid out differently */
+        memcpy(file + 21, "C64SC", 5);
+        if (snapshotcharset(data, size, &address) != NULL) ok = 0;
+        memcpy(file + 21, "C64\0\0", 5);
+    }
+    if (!ok) fail("snapshotcharset()", 1, 1, 256);
+}
+
+/*
+ * Draw a font of x by y cell characters in file order: a bar across and
+ * a bar down each character, in places that set the characters apart,
+ * running over the seams between its cells. Character 32 is a space.
+ */
+static void drawfont(int x, int y, int numchars, char *data)
+{
+    int width = 8 * x, height = 8 * y, c, row, column;
+
+    memset(data, 0, (size_t) numchars * x * y * 8);
+    for (c = 0; c < numchars; ++ c)
+    {
+        int across = 1 + c % (height - 2), down = 1 + c * 3 % (width - 2);
+
+        if (32 == c) continue;
+        for (row = 0; row < height - 1; ++ row)
+        {
+            for (column = 0; column < width - 1; ++ column)
+            {
+                if (row == across || column == down)
+                {
+                    size_t cell = (size_t) (row / 8 * x + column / 8);
+
+                    data[(cell * numchars + c) * 8 + row % 8] |=
+                        (char) (0x80 >> column % 8);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Detect drawn fonts in every size mode, with the usual counts and with
+ * something after the font, and refuse empty, blank and random data
+ */
+static void checkdetect(const char *noise)
+{
+    static const int counts[3] = { 64, 128, 256 };
+    static char data[256 * 4 * 8 + 100];
+    struct detection detection;
+    int m, n, x, y;
+
+    for (m = 0; m < 4; ++ m)
+    {
+        x = 1 + m / 2;
+        y = 1 + m % 2;
+        for (n = 0; n < 3; ++ n)
+        {
+            size_t length = (size_t) counts[n] * x * y * 8;
+
+            drawfont(x, y, counts[n], data);
+            memcpy(data + length, noise, 100);
+            if (detectdata(data, length, 0x3000, &detection) != 0 ||
+                detection.x != x || detection.y != y ||
+                detection.numchars != counts[n] ||
+                detection.loadaddress != 0x3000 ||
+                detectdata(data, length + 100, 0x3000, &detection) != 0 ||
+                detection.x != x || detection.y != y ||
+                detection.numchars != counts[n])
+            {
+                fail("detectdata()", x, y, counts[n]);
+            }
+        }
+    }
+
+    memset(data, 0, sizeof data);
+    if (detectfont(data, 0, &detection) != -1 ||
+        detectfont(data, 9, &detection) != -1 ||
+        detectdata(data, 2048, 0x3000, &detection) != -1 ||
+        detectdata(noise, 2048, 0x3000, &detection) != -1 ||
+        detectdata(noise, 8192, 0x3000, &detection) != -1 ||
+        detectdata(noise, 100, 0x3000, &detection) != -1)
+    {
+        fail("detectdata()", 1, 1, 0);
+    }
+}
+
+/* A daemon run on a thread of its own */
+struct daemon
+{
+    const char *path;
+    struct stats stats;
+    int rc;
+};
+
+static void *rundaemon(void *arg)
+{
+    struct daemon *daemon = arg;
+
+    daemon->rc = runserver("testconvert", daemon->path, 2, &daemon->stats,
+                           NULL);
+    return NULL;
+}
+
+/* Send a request and read the response. Returns the body, or NULL */
+static char *request(int fd, int x, int y, int numchars, const char *file,
+                     size_t length, int *status, size_t *size)
+{
+    unsigned char header[SERVER_HEADER];
+    char *body;
+    size_t done;
+    ssize_t got;
+
+    header[0] = (unsigned char) x;
+    header[1] = (unsigned char) y;
+    header[2] = (unsigned char) (numchars >> 8);
+    header[3] = (unsigned char) numchars;
+    header[4] = (unsigned char) (length >> 24);
+    header[5] = (unsigned char) (length >> 16);
+    header[6] = (unsigned char) (length >> 8);
+    header[7] = (unsigned char) length;
+    if (write(fd, header, sizeof header) != (ssize_t) sizeof header ||
+        write(fd, file, length) != (ssize_t) length)
+    {
+        return NULL;
+    }
+    for (done = 0; done < sizeof header; done += got)
+    {
+        got = read(fd, header + done, sizeof header - done);
+        if (got <= 0) return NULL;
+    }
+    *status = header[0];
+    *size = (size_t) header[4] << 24 | (size_t) header[5] << 16 |
+            (size_t) header[6] << 8 | header[7];
+    body = malloc(*size + 1);
+    for (done = 0; body && done < *size; done += got)
+    {
+        got = read(fd, body + done, *size - done);
+        if (got <= 0)
+        {
+            free(body);
+            return NULL;
+        }
+    }
+    if (body) body[*size] = 0;
+    return body;
+}
+
+/*
+ * Start the daemon on a socket in dir and send it, on one connection, a
+ * font with its layout given, one to detect, noise to detect and a bad
+ * size. Then stop it as SIGTERM does.
+ */
+static void checkdaemon(const char *dir, const char *noise)
+{
+    static char file[2 + 128 * 2 * 8];
+    struct sockaddr_un addr;
+    struct daemon daemon;
+    pthread_t thread;
+    char path[100], *body, *expect;
+    size_t size, expected;
+    int fd, status, tries, ok = 1;
+
+    memset(&daemon, 0, sizeof daemon);
+    snprintf(path, sizeof path, "%s/socket", dir);
+    daemon.path = path;
+    if (strlen(path) >= sizeof addr.sun_path ||
+        pthread_create(&thread, NULL, rundaemon, &daemon) != 0)
+    {
+        fail("runserver()", 0, 0, 0);
+        return;
+    }
+
+    /* Connect once the daemon listens */
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = -1;
+    for (tries = 0; tries < 500 && fd < 0; ++ tries)
+    {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 &&
+            connect(fd, (struct sockaddr *) &addr, sizeof addr) != 0)
+        {
+            close(fd);
+            fd = -1;
+            usleep(10000);
+        }
+    }
+
+    file[0] = 0;
+    file[1] = 0x30;
+    drawfont(2, 1, 128, file + 2);
+    expected = pbmsize(2, 1, 128);
+    expect = malloc(expected);
+    if (fd < 0 || !expect ||
+        formatpbm(2, 1, file + 2, 128, expect, expected) != expected)
+    {
+        ok = 0;
+    }
+
+    /* The same font with its layout given and detected */
+    body = ok ? request(fd, 2, 1, 128, file, sizeof file, &status, &size)
+              : NULL;
+    if (!body || status != SERVER_OK || size != expected ||
+        memcmp(body, expect, size) != 0)
+    {
+        ok = 0;
+    }
+    free(body);
+    body = ok ? request(fd, 0, 9, 9999, file, sizeof file, &status, &size)
+              : NULL;
+    if (!body || status != SERVER_OK || size != expected ||
+        memcmp(body, expect, size) != 0)
+    {
+        ok = 0;
+    }
+    free(body);
+
+    /* Noise can't be detected, and there is no 3x1 mode */
+    body = ok ? request(fd, 0, 0, 0, noise, 2050, &status, &size) : NULL;
+    if (!body || status != SERVER_ERROR ||
+        strcmp(body, "Can't detect font layout") != 0)
+    {
+        ok = 0;
+    }
+    free(body);
+    body = ok ? request(fd, 3, 1, 128, file, sizeof file, &status, &size)
+              : NULL;
+    if (!body || status != SERVER_ERROR ||
+        strcmp(body, "Invalid request") != 0)
+    {
+        ok = 0;
+    }
+    free(body);
+    if (fd >= 0) close(fd);
+
+    /* The workers are running, so the signal handlers are in place */
+    kill(getpid(), SIGTERM);
+    pthread_join(thread, NULL);
+    if (!ok || daemon.rc != 0 || daemon.stats.files != 4 ||
+        daemon.stats.failed != 2 || 0 == access(path, F_OK))
+    {
+        fail("runserver()", 2, 1, 128);
+    }
+    free(expect);
+}
+
+/* Remove a scratch directory and the files in it */
+static void removedir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    char path[4096];
+
+    while (d && (entry = readdir(d)) != NULL)
+    {
+        if ('.' == entry->d_name[0]) continue;
+        snprintf(path, sizeof path, "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d) closedir(d);
+    rmdir(dir);
+}
+
+/*
+ * Check the cache keys against known SHA-256 digests, and that a font
+ * stored in the cache comes back as formatlayout() renders it while a
+ * font differing in one byte does not hit its entry.
+ */
+static void checkcache(const char *font)
+{
+    static const char *const digests[2] =
+    {
+        "609f6e36d2405585188d5cfd761f407c7cc46a7d3f314c88270469dde315fcd1",
+        "a7a54175da00348a27c72f2066933f878e6a453f3ac1a8b81c1b9673273f4923"
+    };
+    char key[CACHEKEYLENGTH + 1], dir[] = "testconvert.XXXXXX";
+    char a[1000], *data, *expect, *out;
+    struct layout layout;
+    struct cache cache;
+    struct stats stats;
+    size_t size;
+    int pass;
+
+    memset(a, 'a', sizeof a);
+    cachekey(key, "", "abc", 3);
+    if (strcmp(key, digests[0]) != 0) fail("cachekey()", 1, 1, 0);
+    cachekey(key, "pbm 1x1 64", a, sizeof a);
+    if (strcmp(key, digests[1]) != 0) fail("cachekey()", 1, 1, 0);
+
+    memset(&layout, 0, sizeof layout);
+    memset(&stats, 0, sizeof stats);
+    size = layoutsize(1, 1, 256, &layout);
+    data = malloc(256 * 8);
+    expect = malloc(size);
+    out = malloc(size);
+    if (!data || !expect || !out || !mkdtemp(dir) ||
+        opencache(&cache, dir, CACHEDEFAULTSIZE) != 0)
+    {
+        fail("opencache()", 1, 1, 256);
+        free(out);
+        free(expect);
+        free(data);
+        return;
+    }
+
+    /* A miss and a hit for the font, then a miss for the changed one */
+    memcpy(data, font, 256 * 8);
+    for (pass = 0; pass < 3; ++ pass)
+    {
+        if (2 == pass) data[1000] ^= 1;
+        formatlayout(1, 1, data, 256, &layout, expect, size);
+        memset(out, 0, size);
+        if (cachedformatpbm(&cache, &stats, 1, 1, data, 256, &layout,
+                            out, size) != size ||
+            memcmp(out, expect, size) != 0)
+        {
+            fail("cachedformatpbm()", 1, 1, 256);
+        }
+    }
+    if (stats.cachehits != 1 || stats.cachemisses != 2)
+    {
+        fail("cache statistics", 1, 1, 256);
+    }
+
+    closecache(&cache);
+    removedir(dir);
+    free(out);
+    free(expect);
+    free(data);
+}
+
+int main(void)
+{
+    static const int modes[4][2] = { { 1, 1 }, { 1, 2 }, { 2, 1 }, { 2, 2 } };
+    static char font[MAXCHARS * 4 * 32];
+    static char blank[MAXCHARS * 4 * 8], repeats[MAXCHARS * 4 * 8];
+    struct layout layout;
+    char dir[] = "testconvert.XXXXXX";
+    unsigned long seed = 1;
+    int m, n, i, checked = 0;
+
+    for (i = 0; i < (int) sizeof font; ++ i)
+    {
+        seed = seed * 1103515245 + 12345;
+        font[i] = (char) (seed >> 16);
+    }
+
+    /* Every count in every size mode, full rows or not */
+    for (m = 0; m < 4; ++ m)
+    {
+        for (n = 1; n <= MAXCHARS; ++ n)
+        {
+            checkfont(modes[m][0], modes[m][1], font, n);
+            ++ checked;
+        }
+    }
+
+    /* A band of 256 padded 2x2 characters with 32 scanline cells */
+    memset(&layout, 0, sizeof layout);
+    layout.perrow = 256;
+    layout.padding = 64;
+    layout.cellheight = 32;
+    checklayout(2, 2, font, 256, &layout);
+    ++ checked;
+
+    /*
+     * One character per row, rows that don't divide the count, column
+     * major order, padding within and across bytes, and taller cells and
+     * cells with unused bytes, in every size mode
+     */
+    for (m = 0; m < 4; ++ m)
+    {
+        static const struct layout layouts[] =
+        {
+            { 1, 0, 0, 0, 0 }, { 7, 0, 0, 0, 0 }, { 13, 0, 0, 0, 0 },
+            { 7, 0, 1, 0, 0 }, { 5, 0, 1, 0, 0 }, { 0, 0, 1, 0, 0 },
+            { 0, 3, 0, 0, 0 }, { 13, 8, 0, 0, 0 }, { 6, 11, 1, 0, 0 },
+            { 0, 0, 0, 16, 0 }, { 0, 0, 0, 8, 16 }, { 9, 2, 1, 5, 7 }
+        };
+        static const int counts[3] = { 1, 23, 100 };
+
+        for (i = 0; i < (int) (sizeof layouts / sizeof layouts[0]); ++ i)
+        {
+            for (n = 0; n < 3; ++ n)
+            {
+                checklayout(modes[m][0], modes[m][1], font, counts[n],
+                            &layouts[i]);
+                ++ checked;
+            }
+        }
+    }
+
+    /*
+     * Every transform on its own and every shift, then a chain that turns
+     * the characters and shifts them diagonally, done in place
+     */
+    for (m = 0; m < 4; ++ m)
+    {
+        static const struct transform chain[4] =
+        {
+            { TRANSFORM_ROTATE, 0, 0 }, { TRANSFORM_SHIFT, 3, -5 },
+            { TRANSFORM_HFLIP, 0, 0 }, { TRANSFORM_INVERT, 0, 0 }
+        };
+        struct transform transform;
+
+        memset(&transform, 0, sizeof transform);
+        for (transform.op = TRANSFORM_HFLIP;
+             transform.op < TRANSFORM_SHIFT; ++ transform.op)
+        {
+            checktransform(modes[m][0], modes[m][1], font, 99,
+                           &transform, 1, 0);
+            ++ checked;
+        }
+        transform.op = TRANSFORM_SHIFT;
+        for (transform.dx = -7; transform.dx <= 7; ++ transform.dx)
+        {
+            for (transform.dy = -7; transform.dy <= 7; ++ transform.dy)
+            {
+                checktransform(modes[m][0], modes[m][1], font, 99,
+                               &transform, 1, 0);
+                ++ checked;
+            }
+        }
+        checktransform(modes[m][0], modes[m][1], font, 99, chain, 4, 1);
+        ++ checked;
+    }
+
+    checkdetect(font);
+    checked += 12;
+
+    /* A charset off the cell grid, past the first block of windows */
+    checkscan(font, sizeof font, 12345, 1);
+    checkscan(font, sizeof font, 12345, 3);
+    checked += 2;
+
+    /*
+     * PNG files at both levels, from noise, from a blank font that is all
+     * runs and from one that repeats every 37 characters
+     */
+    for (i = 0; i < (int) sizeof repeats; ++ i)
+    {
+        repeats[i] = font[i % (37 * 8)];
+    }
+    for (m = 0; m < 4; ++ m)
+    {
+        static const int counts[4] = { 1, 77, 256, 1024 };
+
+        for (n = 0; n < 4; ++ n)
+        {
+            checkpng(modes[m][0], modes[m][1], font, counts[n]);
+            checkpng(modes[m][0], modes[m][1], blank, counts[n]);
+            checkpng(modes[m][0], modes[m][1], repeats, counts[n]);
+            checked += 3;
+        }
+    }
+
+    /* An image of four chunks, 396000 bytes of scanlines */
+    checkparallelpng(font);
+    ++ checked;
+
+    /* Disk, tape and cartridge images, snapshots and the daemon */
+    if (mkdtemp(dir))
+    {
+        checkdisk(dir, font);
+        checktape(dir, font);
+        checkcartridge(dir, font);
+        checksnapshot(dir, font);
+        checkdaemon(dir, font);
+        rmdir(dir);
+    }
+    else
+    {
+        fail("mkdtemp()", 0, 0, 0);
+    }
+    checked += 10;
+
+    checkcache(font);
+    ++ checked;
+
+    if (failures)
+    {
+        fprintf(stderr, "testconvert: %d failures in %d fonts\n",
+                failures, checked);
+        return 1;
+    }
+    printf("testconvert: %d fonts converted correctly\n", checked);
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+ * font2pbm
+ * Flips, rotations and other transforms of whole fonts.
+ * Copyright 2003-2004 Peter Karlsson <peter@softwolves.pp.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * oublished by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include "font2pbm.h"
+#include "glyph.h"
+
+/*
+ * The cells of one character as a grid, cell[row * width + column].
+ * Each transform works on the grid of the character in hand, so the
+ * file can be rewritten in place one character at a time.
+ */
+struct grid
+{
+    glyph cell[4];
+    int width, height;
+};
+
+static void transformcells(const char *, int, const struct transform *,
+                           int, char *);
+static void apply(struct grid *, const struct transform *);
+
+int transformfont(int *x, int *y, const char *data, int numchars,
+                  const struct transform *transforms, int count, char *out)
+{
+    int width = *x, height = *y, i, t, c;
+
+    if (width < 1 || width > 2 || height < 1 || height > 2 || numchars < 0)
+    {
+        return -1;
+    }
+    for (t = 0; t < count; ++ t)
+    {
+        const struct transform *transform = &transforms[t];
+
+        if (TRANSFORM_SHIFT == transform->op &&
+            (transform->dx < -7 || transform->dx > 7 ||
+             transform->dy < -7 || transform->dy > 7))
+        {
+            return -1;
+        }
+        if (TRANSFORM_ROTATE == transform->op)
+        {
+            int swap = width;
+            width = height;
+            height = swap;
+        }
+    }
+
+    /* Single cell characters need no grid, and the loops vectorise */
+    if (1 == *x && 1 == *y)
+    {
+        transformcells(data, numchars, transforms, count, out);
+        return 0;
+    }
+
+    /* Cell c of character i is at (i + c * numchars) * 8, see createpbm() */
+    for (i = 0; i < numchars; ++ i)
+    {
+        struct grid grid;
+
+        grid.width = *x;
+        grid.height = *y;
+        for (c = 0; c < grid.width * grid.height; ++ c)
+        {
+            grid.cell[c] = loadglyph(data + ((size_t) c * numchars + i) * 8);
+        }
+        for (t = 0; t < count; ++ t)
+        {
+            apply(&grid, &transforms[t]);
+        }
+        for (c = 0; c < grid.width * grid.height; ++ c)
+        {
+            storeglyph(out + ((size_t) c * numchars + i) * 8, grid.cell[c]);
+        }
+    }
+
+    *x = width;
+    *y = height;
+    return 0;
+}
+
+/* One pass over the whole font per transform, for 1x1 characters */
+static void transformcells(const char *data, int numchars,
+                           const struct transform *transforms, int count,
+                           char *out)
+{
+    const char *in = data;
+    int i, t, n;
+
+    if (0 == count && data != out)
+    {
+        memmove(out, data, (size_t) numchars * 8);
+    }
+    for (t = 0; t < count; ++ t, in = out)
+    {
+        switch (transforms[t].op)
+        {
+            case TRANSFORM_HFLIP:
+                for (i = 0; i < numchars; ++ i)
+                {
+                    storeglyph(out + i * 8, hflipglyph(loadglyph(in + i * 8)));
+                }
+                break;
+
+            case TRANSFORM_VFLIP:
+                for (i = 0; i < numchars; ++ i)
+                {
+                    storeglyph(out + i * 8, vflipglyph(loadglyph(in + i * 8)));
+                }
+                break;
+
+            case TRANSFORM_ROTATE:
+                for (i = 0; i < numchars; ++ i)
+                {
+                    storeglyph(out + i * 8,
+                               rotateglyph(loadglyph(in + i * 8)));
+                }
+                break;
+
+            case TRANSFORM_INVERT:
+                for (i = 0; i < numchars; ++ i)
+                {
+                    storeglyph(out + i * 8, ~loadglyph(in + i * 8));
+                }
+                break;
+
+            case TRANSFORM_SHIFT:
+                for (i = 0; i < numchars; ++ i)
+                {
+                    glyph g = loadglyph(in + i * 8);
+
+                    if ((n = transforms[t].dx) > 0)
+                    {
+                        g = shiftrightglyph(g, 0, n);
+                    }
+                    else if (n < 0)
+                    {
+                        g = shiftleftglyph(g, 0, -n);
+                    }
+                    if ((n = transforms[t].dy) > 0)
+                    {
+                        g = shiftdownglyph(g, 0, n);
+                    }
+                    else if (n < 0)
+                    {
+                        g = shiftupglyph(g, 0, -n);
+                    }
+                    storeglyph(out + i * 8, g);
+                }
+                break;
+        }
+    }
+}
+
+static void apply(struct grid *grid, const struct transform *transform)
+{
+    glyph *cell = grid->cell, swap, old[4];
+    int w = grid->width, h = grid->height, r, c, n;
+
+    switch (transform->op)
+    {
+        case TRANSFORM_HFLIP:
+            for (r = 0; r < h; ++ r)
+            {
+                swap = cell[r * w];
+                cell[r * w] = hflipglyph(cell[r * w + w - 1]);
+                cell[r * w + w - 1] = hflipglyph(swap);
+            }
+            break;
+
+        case TRANSFORM_VFLIP:
+            for (c = 0; c < w; ++ c)
+            {
+                swap = cell[c];
+                cell[c] = vflipglyph(cell[(h - 1) * w + c]);
+                cell[(h - 1) * w + c] = vflipglyph(swap);
+            }
+            break;
+
+        case TRANSFORM_ROTATE:
+            /* Row r of the result is column r of the original, bottom up */
+            for (c = 0; c < w * h; ++ c) old[c] = cell[c];
+            for (r = 0; r < w; ++ r)
+            {
+                for (c = 0; c < h; ++ c)
+                {
+                    cell[r * h + c] = rotateglyph(old[(h - 1 - c) * w + r]);
+                }
+            }
+            grid->width = h;
+            grid->height = w;
+            break;
+
+        case TRANSFORM_INVERT:
+            for (c = 0; c < w * h; ++ c) cell[c] = ~cell[c];
+            break;
+
+        case TRANSFORM_SHIFT:
+            /* Work away from the edge being filled, so carries are intact */
+            if ((n = transform->dx) > 0)
+            {
+                for (r = 0; r < h; ++ r)
+                {
+                    for (c = w - 1; c >= 0; -- c)
+                    {
+                        cell[r * w + c] = shiftrightglyph(cell[r * w + c],
+                            c ? cell[r * w + c - 1] : 0, n);
+                    }
+                }
+            }
+            else if (n < 0)
+            {
+                for (r = 0; r < h; ++ r)
+                {
+                    for (c = 0; c < w; ++ c)
+                    {
+                        cell[r * w + c] = shiftleftglyph(cell[r * w + c],
+                            c < w - 1 ? cell[r * w + c + 1] : 0, -n);
+                    }
+                }
+            }
+            if ((n = transform->dy) > 0)
+            {
+                for (r = h - 1; r >= 0; -- r)
+                {
+                    for (c = 0; c < w; ++ c)
+                    {
+                        cell[r * w + c] = shiftdownglyph(cell[r * w + c],
+                            r ? cell[(r - 1) * w + c] : 0, n);
+                    }
+                }
+            }
+            else if (n < 0)
+            {
+                for (r = 0; r < h; ++ r)
+                {
+                    for (c = 0; c < w; ++ c)
+                    {
+                        cell[r * w + c] = shiftupglyph(cell[r * w + c],
+                            r < h - 1 ? cell[(r + 1) * w + c] : 0, -n);
+                    }
+                }
+            }
+            break;
+    }
+}